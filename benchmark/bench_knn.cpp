@@ -84,6 +84,23 @@ static void bench_knn3(benchmark::State& state) {
   }
 }
 
+// Define another benchmark
+template <int dim, int k_type>
+static void bench_knn4(benchmark::State& state) {
+  typedef LogTree_t<dim> Tree;
+  auto size = state.range(0);
+  auto k = state.range(1);
+  DSType ds_type = (DSType)state.range(2);
+  parlay::sequence<point<dim>> points;
+  points = BenchmarkDS<dim>(size, ds_type);
+  Tree tree(points);
+
+  // benchmark
+  for (auto _ : state) {
+    RUN_AND_CLEAR((tree.template knn4<(k_type & 2), (k_type & 1)>(points, k)));
+  }
+}
+
 template <int dim, class Tree>
 static void bench_dual_knn(benchmark::State& state) {
   // typedef LogTree_t<dim> Tree;
@@ -100,6 +117,82 @@ static void bench_dual_knn(benchmark::State& state) {
   }
 }
 
+// number of leaves under [node] whose box is within squared distance [r_sqr] of [q]
+template <class nodeT, class pointT>
+static size_t leavesInBall(const nodeT* node, const pointT& q, double r_sqr) {
+  if (node == nullptr || BoundingBoxDistanceSqr(q, q, node->getMin(), node->getMax()) > r_sqr)
+    return 0;
+  if (node->isLeaf()) return 1;
+  return leavesInBall(node->getLeft(), q, r_sqr) + leavesInBall(node->getRight(), q, r_sqr);
+}
+
+// kNN under the build's SPLIT_RULE. Also reports how well the split rule prunes: the number of
+// leaves whose box meets a query's k-NN ball (which no exact kNN search can skip), averaged over a
+// sample of the queries. Compare builds with -DSPLIT_RULE=ROUND_ROBIN and -DSPLIT_RULE=MAX_SPREAD.
+template <int dim, class Tree>
+static void bench_knn_split(benchmark::State& state) {
+  auto size = state.range(0);
+  auto k = state.range(1);
+  DSType ds_type = (DSType)state.range(2);
+  parlay::sequence<point<dim>> points;
+  points = BenchmarkDS<dim>(size, ds_type);
+  Tree tree(points);
+
+  // benchmark
+  for (auto _ : state) {
+    RUN_AND_CLEAR((tree.template knn<false, false>(points, k)));
+  }
+
+  // pruning
+  constexpr size_t num_samples = 1000;
+  auto res = tree.template knn<false, false>(points, k);
+  auto step = points.size() / num_samples;
+  auto leaves = parlay::tabulate(num_samples, [&](size_t s) {
+    const auto& q = points[s * step];
+    double r_sqr = 0;
+    for (int j = 0; j < k; j++)
+      r_sqr = std::max(r_sqr, pointDistanceSqr(q, *res[s * step * k + j]));
+    return leavesInBall(tree.root(), q, r_sqr);
+  });
+  state.counters["split_rule"] = SPLIT_RULE;
+  state.counters["leaves_in_knn_ball"] = (double)parlay::reduce(leaves) / num_samples;
+}
+
+// Approximate kNN: recall vs. throughput. Arguments: {size, k, ds_type, eps (in percent),
+// max_leaves (0 = no cap)}. Recall is the fraction of the exact k nearest neighbors found, averaged
+// over a sample of the queries.
+template <int dim, class Tree>
+static void bench_knn_approx(benchmark::State& state) {
+  auto size = state.range(0);
+  auto k = state.range(1);
+  DSType ds_type = (DSType)state.range(2);
+  knnBuf::approx approx{state.range(3) / 100.0, (size_t)state.range(4)};
+  parlay::sequence<point<dim>> points;
+  points = BenchmarkDS<dim>(size, ds_type);
+  Tree tree(points);
+
+  // benchmark
+  for (auto _ : state) {
+    RUN_AND_CLEAR((tree.template knn<false, false>(points, k, approx)));
+  }
+
+  // recall
+  constexpr size_t num_samples = 1000;
+  auto step = points.size() / num_samples;
+  auto sample = parlay::tabulate(num_samples, [&](size_t s) { return points[s * step]; });
+  auto exact = tree.template knn<false, false>(sample, k);
+  auto res = tree.template knn<false, false>(sample, k, approx);
+  auto found = parlay::tabulate(num_samples, [&](size_t s) {
+    size_t count = 0;
+    for (int j = 0; j < k; j++) {
+      auto begin = exact.begin() + s * k;
+      count += std::find(begin, begin + k, res[s * k + j]) != begin + k;
+    }
+    return count;
+  });
+  state.counters["recall"] = (double)parlay::reduce(found) / (num_samples * k);
+}
+
 // Instantiate benchmarks
 BENCH(knn, 2, COTree_t<2>, 0)
     ->ArgsProduct({{10'000'000},
@@ -121,6 +214,10 @@ BENCH(knn3, 2, 0)
     ->ArgsProduct({{10'000'000},
                    {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
                    {DS_UNIFORM_FILL, DS_UNIFORM_SPHERE, DS_VISUAL_VAR}});
+BENCH(knn4, 2, 0)
+    ->ArgsProduct({{10'000'000},
+                   {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+                   {DS_UNIFORM_FILL, DS_UNIFORM_SPHERE, DS_VISUAL_VAR}});
 BENCH(dual_knn, 2, COTree_t<2>)
     ->ArgsProduct({{10'000'000},
                    {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
@@ -142,6 +239,7 @@ BENCH(knn, 3, LogTree_t<3>, 0)
     ->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_GEO_LIFE}});
 BENCH(knn2, 3, 0)->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_GEO_LIFE}});
 BENCH(knn3, 3, 0)->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_GEO_LIFE}});
+BENCH(knn4, 3, 0)->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_GEO_LIFE}});
 BENCH(dual_knn, 3, COTree_t<3>)
     ->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_GEO_LIFE}});
 BENCH(dual_knn, 3, BHLTree_t<3>)
@@ -169,6 +267,10 @@ BENCH(knn3, 5, 0)
     ->ArgsProduct({{10'000'000},
                    {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
                    {DS_UNIFORM_FILL, DS_VISUAL_VAR}});
+BENCH(knn4, 5, 0)
+    ->ArgsProduct({{10'000'000},
+                   {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+                   {DS_UNIFORM_FILL, DS_VISUAL_VAR}});
 BENCH(dual_knn, 5, COTree_t<5>)
     ->ArgsProduct({{10'000'000},
                    {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
@@ -202,6 +304,10 @@ BENCH(knn3, 7, 0)
     ->ArgsProduct({{10'000'000},
                    {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
                    {DS_UNIFORM_FILL, DS_VISUAL_VAR, DS_HOUSE_HOLD}});
+BENCH(knn4, 7, 0)
+    ->ArgsProduct({{10'000'000},
+                   {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+                   {DS_UNIFORM_FILL, DS_VISUAL_VAR, DS_HOUSE_HOLD}});
 BENCH(dual_knn, 7, COTree_t<7>)
     ->ArgsProduct({{10'000'000},
                    {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
@@ -220,9 +326,31 @@ BENCH(knn, 10, COTree_t<10>, 0)
 BENCH(knn, 10, BHLTree_t<10>, 0)
     ->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_HT}});
 BENCH(knn3, 10, 0)->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_HT}});
+BENCH(knn4, 10, 0)->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_HT}});
 
 BENCH(knn, 16, COTree_t<16>, 0)
     ->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_CHEM}});
 BENCH(knn, 16, BHLTree_t<16>, 0)
     ->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_CHEM}});
 BENCH(knn3, 16, 0)->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_CHEM}});
+BENCH(knn4, 16, 0)->ArgsProduct({{10'000'000}, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, {DS_CHEM}});
+
+BENCH(knn_split, 2, COTree_t<2>)->ArgsProduct({{10'000'000}, {1, 5, 10}, {DS_VISUAL_VAR}});
+BENCH(knn_split, 2, BHLTree_t<2>)->ArgsProduct({{10'000'000}, {1, 5, 10}, {DS_VISUAL_VAR}});
+BENCH(knn_split, 3, COTree_t<3>)->ArgsProduct({{10'000'000}, {1, 5, 10}, {DS_GEO_LIFE}});
+BENCH(knn_split, 3, BHLTree_t<3>)->ArgsProduct({{10'000'000}, {1, 5, 10}, {DS_GEO_LIFE}});
+BENCH(knn_split, 7, COTree_t<7>)->ArgsProduct({{10'000'000}, {1, 5, 10}, {DS_HOUSE_HOLD}});
+BENCH(knn_split, 7, BHLTree_t<7>)->ArgsProduct({{10'000'000}, {1, 5, 10}, {DS_HOUSE_HOLD}});
+
+BENCH(knn_approx, 2, COTree_t<2>)
+    ->ArgsProduct({{10'000'000}, {5, 10}, {DS_VISUAL_VAR}, {0, 10, 50, 100}, {0}})
+    ->ArgsProduct({{10'000'000}, {5, 10}, {DS_VISUAL_VAR}, {0}, {1, 2, 4, 8}});
+BENCH(knn_approx, 2, LogTree_t<2>)
+    ->ArgsProduct({{10'000'000}, {5, 10}, {DS_VISUAL_VAR}, {0, 10, 50, 100}, {0}})
+    ->ArgsProduct({{10'000'000}, {5, 10}, {DS_VISUAL_VAR}, {0}, {1, 2, 4, 8}});
+BENCH(knn_approx, 7, COTree_t<7>)
+    ->ArgsProduct({{10'000'000}, {5, 10}, {DS_HOUSE_HOLD}, {0, 10, 50, 100}, {0}})
+    ->ArgsProduct({{10'000'000}, {5, 10}, {DS_HOUSE_HOLD}, {0}, {1, 2, 4, 8}});
+BENCH(knn_approx, 7, LogTree_t<7>)
+    ->ArgsProduct({{10'000'000}, {5, 10}, {DS_HOUSE_HOLD}, {0, 10, 50, 100}, {0}})
+    ->ArgsProduct({{10'000'000}, {5, 10}, {DS_HOUSE_HOLD}, {0}, {1, 2, 4, 8}});
@@ -236,9 +236,7 @@ using COTree_t = CO_KdTree<dim, point<dim>, parallel, coarsen>;
 template <int dim>
 using BHLTree_t = BHL_KdTree<dim, point<dim>, parallel, coarsen>;
 
-constexpr int NUM_TREES = 21;
-constexpr int BUFFER_LOG2_SIZE = 10;
 template <int dim>
-using LogTree_t = LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, point<dim>, parallel, coarsen>;
+using LogTree_t = LogTree<dim, point<dim>, parallel, coarsen>;
 
 #endif  // BENCHMARK_UTILS_H
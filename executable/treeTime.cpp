@@ -389,9 +389,7 @@ template <int dim, bool parallel, bool coarsen>
 void timeTrees(parlay::sequence<point<dim>>& P, const TestOptions& test_options) {
   typedef CO_KdTree<dim, point<dim>, parallel, coarsen> COTree_t;
   typedef BHL_KdTree<dim, point<dim>, parallel, coarsen> BHLTree_t;
-  constexpr int NUM_TREES = 21;
-  constexpr int BUFFER_LOG2_SIZE = 7;
-  typedef LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, point<dim>, parallel, coarsen> LogTree_t;
+  typedef LogTree<dim, point<dim>, parallel, coarsen> LogTree_t;
 
   std::string thread_str =
       (parallel ? (" (" + std::to_string(parlay::num_workers()) + " threads)") : (" (serial)"));
@@ -1,6 +1,8 @@
 #ifndef BHLKDTREE_H
 #define BHLKDTREE_H
 
+#include <algorithm>
+#include <vector>
 #include "parlay/parallel.h"
 #include "parlay/sequence.h"
 
@@ -29,16 +31,12 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
                          int split_dim)
 #endif
   {
-    if (items.size() <= leaf_size) {  // Base Case
-      assert(items.size() > 0);
-      new (&this->nodes[node_idx]) nodeT(items);
-      return;
-    }
+    assert(items.size() > leaf_size);  // a leaf takes no record: its parent links to it
 
-    // Recursive Case
     bool parallelBuild = parallel && buildInParallel(items.size());  // should we parallelize?
 
     // Make the split
+    split_dim = splitDimension<dim, objT>(items, split_dim, parallelBuild);
     double median;
     size_t right_start;
 
@@ -70,11 +68,16 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     assert(node_idx >= 0);
     assert((size_t)node_idx < this->num_nodes());
     assert(this->nodes[node_idx].isEmpty());
-    auto p = new (&this->nodes[node_idx]) nodeT(split_dim, median, items);
+    auto p = new (&this->nodes[node_idx])
+        nodeT(split_dim, median, right_start, items, this->items.begin());
 
-    // Child functors
+    // Child functors (the base case: a leaf)
     auto next_split_dim = (split_dim + 1) % dim;
     auto left_f = [&]() {
+      if (right_start <= leaf_size) {
+        p->setLeafChild(false);
+        return;
+      }
 #if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
       auto left_idx = 2 * node_idx + 1;
 #elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
@@ -90,10 +93,15 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #endif
     };
     auto right_f = [&]() {
+      if (items.size() - right_start <= leaf_size) {
+        p->setLeafChild(true);
+        return;
+      }
 #if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
       auto right_idx = 2 * node_idx + 2;
 #elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
-      auto right_idx = node_idx + (2 * right_start);
+      // the left subtree takes at most right_start - 1 records
+      auto right_idx = node_idx + right_start;
 #endif
       p->setRight(&this->nodes[right_idx]);
       // this->parents[right_idx] = p;
@@ -114,18 +122,25 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
       left_f();
       right_f();
     }
-    assert(!p->isLeaf());
-    p->recomputeBoundingBox();
+    p->recomputeBoundingBox(this->items.begin(), this->present);
   }
 
   // Base Building Functions
   void buildKdt() {
-    assert(this->size() > leaf_size);  // so it's not degenerate
+    assert(this->size() > 0);  // a buffer can hold a single leaf, e.g. a remainder of 1
+    if (this->size() <= leaf_size) {
+      this->buildLeafRoot(this->size());
+      return;
+    }
     buildKdtRecursive(parlay::slice(this->items.begin(), this->items.begin() + this->size()), 0, 0);
   }
 
   void buildKdt(parlay::slice<bool *, bool *> flags) {
-    assert(this->size() > leaf_size);  // so it's not degenerate
+    assert(this->size() > 0);  // a buffer can hold a single leaf, e.g. a remainder of 1
+    if (this->size() <= leaf_size) {
+      this->buildLeafRoot(this->size());
+      return;
+    }
     buildKdtRecursive(
         parlay::slice(this->items.begin(), this->items.begin() + this->size()), flags, 0, 0);
   }
@@ -141,8 +156,294 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     auto flagSlice = parlay::slice(flags.begin(), flags.end());
     buildKdt(flagSlice);
 #endif
+    this->resetLiveCounts(this->nodes);
+    this->buildLeafSoA();
+  }
+
+#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
+  // Incremental Insert ----------------------------
+  // A subtree that an insert rebuilds over its live points and the new points routed to it: an
+  // interior node, or a leaf (which has no record, so the subtree replacing it goes to the heap
+  // slot it would have had)
+  struct Rebuild {
+    size_t idx;                     // the heap slot of its root
+    nodeT *parent;                  // its parent (nullptr for the root of the tree) ...
+    bool right;                     // ... and the side of it
+    size_t num_live;                // its live points
+    size_t start, end;              // the range of [items] it covered
+    size_t batch_start, batch_end;  // its new points in the routed batch
+    size_t new_start;               // the start of its range after the insert
+  };
+
+  // number of levels below the root of a subtree built over [n] points
+  static int buildHeight(size_t n) {
+    int height = 0;
+    for (; n > leaf_size; n = (n + 1) / 2)
+      height++;
+    return height;
+  }
+
+  // whether the interior nodes of a subtree built over [n] points at heap slot [idx] stay within
+  // the heap slots below it
+  bool fitsAt(size_t idx, size_t n) const {
+    auto depth = 63 - __builtin_clzll(idx + 1);
+    return buildHeight(n) <= __builtin_ctzll(this->max_size) - depth;
+  }
+
+  /*!
+   * Plan the rebuild of the subtree at heap slot [idx] (child [right] of [parent]), which covers
+   * [start, end) of [items] with [num_live] live points, over them and [batch]. Returns false if
+   * it does not fit below [idx].
+   */
+  bool planRebuild(size_t idx,
+                   nodeT *parent,
+                   bool right,
+                   size_t num_live,
+                   size_t start,
+                   size_t end,
+                   parlay::slice<objT *, objT *> batch,
+                   const objT *routed,
+                   std::vector<Rebuild> &plan) {
+    if (!fitsAt(idx, num_live + batch.size())) return false;
+    size_t batch_start = batch.begin() - routed;
+    plan.push_back(
+        {idx, parent, right, num_live, start, end, batch_start, batch_start + batch.size(), 0});
+    return true;
   }
 
+  /*!
+   * Route [batch] (a part of [routed], partitioned in place) down the subtree of [node] (child
+   * [right] of [parent]) and plan the subtrees to rebuild, in order: the leaves that receive
+   * points, unless an ancestor gets unbalanced (a child holding more than BHL_REBUILD_ALPHA of its
+   * points) and is rebuilt instead. Returns false if the subtree has to be rebuilt but does not fit
+   * below [node].
+   */
+  bool planInsert(nodeT *node,
+                  nodeT *parent,
+                  bool right,
+                  parlay::slice<objT *, objT *> batch,
+                  const objT *routed,
+                  std::vector<Rebuild> &plan) {
+    if (batch.size() == 0) return true;
+    auto side_points = [&](bool r) -> size_t {
+      return node->isLeafChild(r)
+                 ? this->present.count(node->getChildStartIdx(r), node->getChildEndIdx(r), false)
+                 : this->countPoints(node->getChild(r));
+    };
+    // the leaf child [r] gets [side_batch], or the interior child routes it further down
+    auto plan_side = [&](bool r, parlay::slice<objT *, objT *> side_batch) {
+      if (side_batch.size() == 0) return true;
+      if (node->isLeafChild(r)) {
+        return planRebuild(2 * (node - this->nodes) + 1 + r, node, r, side_points(r),
+                           node->getChildStartIdx(r), node->getChildEndIdx(r), side_batch, routed,
+                           plan);
+      }
+      return planInsert(node->getChild(r), node, r, side_batch, routed, plan);
+    };
+
+    bool rebuild = !node->hasChild(false) || !node->hasChild(true);
+    if (!rebuild) {
+      size_t mid = serialPartition(batch, node->getSplitDimension(), node->getSplitValue());
+      double left_size = side_points(false) + mid;
+      double right_size = side_points(true) + (batch.size() - mid);
+      rebuild = std::max(left_size, right_size) > BHL_REBUILD_ALPHA * (left_size + right_size);
+      if (!rebuild) {
+        auto num_planned = plan.size();
+        rebuild = !plan_side(false, batch.cut(0, mid)) ||
+                  !plan_side(true, batch.cut(mid, batch.size()));
+        if (rebuild) plan.resize(num_planned);  // rebuild this whole subtree instead
+      }
+    }
+    if (!rebuild) return true;
+    return planRebuild(node - this->nodes, parent, right, this->countPoints(node),
+                       node->getStartIdx(), node->getEndIdx(), batch, routed, plan);
+  }
+
+  // Shift the item ranges of the subtree of [node] by [delta]
+  void shiftSubtree(nodeT *node, long delta) {
+    node->setItemRange(node->getStartIdx() + delta, node->getNumItems());
+    auto left = node->getLeft(), right = node->getRight();
+    if (parallel && left && right && buildInParallel(node->getNumItems())) {
+      parlay::par_do([&]() { shiftSubtree(left, delta); }, [&]() { shiftSubtree(right, delta); });
+    } else {
+      if (left) shiftSubtree(left, delta);
+      if (right) shiftSubtree(right, delta);
+    }
+  }
+
+  /*!
+   * Carry out the planned rebuild [r], once [items] and [present] hold the new layout, and link
+   * the result to its parent.
+   */
+  void rebuildSubtree(const Rebuild &r) {
+    auto n = r.num_live + (r.batch_end - r.batch_start);
+#ifndef NDEBUG
+    // mark the heap slots below [r.idx] as empty again
+    for (size_t level = 1, s = r.idx; s < this->num_nodes(); level *= 2, s = 2 * s + 1) {
+      for (size_t i = s; i < std::min(s + level, this->num_nodes()); i++)
+        this->nodes[i].setEmpty();
+    }
+#endif
+    if (r.parent == nullptr) {  // the whole tree, which starts at the front of [items]
+      assert(r.idx == 0 && r.new_start == 0);
+      if (n <= leaf_size) {
+        this->buildLeafRoot(n);
+        this->resetLiveCounts(this->nodes);
+        return;
+      }
+    } else if (n <= leaf_size) {
+      r.parent->setLeafChild(r.right);  // still a leaf: its parent's new split covers it
+      return;
+    }
+    auto depth = 63 - __builtin_clzll(r.idx + 1);
+    buildKdtRecursive(this->items.cut(r.new_start, r.new_start + n), r.idx, depth % dim);
+    this->resetLiveCounts(this->nodes + r.idx);
+    if (r.parent != nullptr) r.parent->setChild(r.right, this->nodes + r.idx);
+  }
+
+  /*!
+   * Carry out [plan] on the subtree of [node], none of which is rebuilt as a whole, once [items]
+   * and [present] hold the new layout: rebuild the planned subtrees, then fix the ranges, splits,
+   * live counts and bounding boxes of the nodes above them and shift the ranges of the rest.
+   * [plan] is extended with a sentinel at the old end of [items].
+   */
+  void applyInsertPlan(nodeT *node, const std::vector<Rebuild> &plan) {
+    auto first_after = [&](size_t pos) {
+      return std::lower_bound(plan.begin(), plan.end() - 1, pos, [](const Rebuild &r, size_t p) {
+        return r.start < p;
+      });
+    };
+    // where the item at [pos] (before the first rebuild from [pos] on) moves to
+    auto new_pos = [&](size_t pos) {
+      auto next = first_after(pos);
+      return pos + next->new_start - next->start;
+    };
+    auto start = node->getStartIdx(), end = node->getEndIdx();
+    auto first = first_after(start), last = first_after(end);  // the rebuilds in this subtree
+    if (first == last) {  // no new points here
+      long delta = (long)first->new_start - (long)first->start;
+      if (delta != 0) shiftSubtree(node, delta);
+      return;
+    }
+
+    auto apply_side = [&](bool r) {
+      if (!node->hasChild(r)) return;
+      auto k = first_after(node->getChildStartIdx(r));
+      if (k != plan.end() - 1 && k->parent == node && k->right == r) {
+        rebuildSubtree(*k);
+      } else if (!node->isLeafChild(r)) {
+        applyInsertPlan(node->getChild(r), plan);
+      }
+    };
+    if (parallel && node->hasChild(false) && node->hasChild(true) &&
+        buildInParallel(node->getNumItems())) {
+      parlay::par_do([&]() { apply_side(false); }, [&]() { apply_side(true); });
+    } else {
+      apply_side(false);
+      apply_side(true);
+    }
+    auto new_start = new_pos(start), new_split = new_pos(start + node->getSplitOffset());
+    node->setItemRange(new_start, new_pos(end) - new_start);
+    node->setSplitOffset(new_split - new_start);
+    this->addPoints(node, last->batch_start - first->batch_start);
+    node->recomputeBoundingBox(this->items.begin(), this->present);
+  }
+
+  /*!
+   * Insert [points] into a non-empty tree, rebuilding only the subtrees planned by [planInsert]
+   * and moving the items of the others, in place, by the growth of the rebuilt ranges before
+   * them. Returns false, leaving the tree as it is, if the items would not fit in [max_size]
+   * slots with the erased ones still in place.
+   */
+  bool insertIncremental(const parlay::slice<const objT *, const objT *> &points) {
+    auto routed = parlay::tabulate(points.size(), [&](size_t i) { return points[i]; });
+    std::vector<Rebuild> plan;
+    [[maybe_unused]] bool fits = planInsert(this->nodes, nullptr, false,
+                                            routed.cut(0, routed.size()), routed.begin(), plan);
+    assert(fits);  // the whole heap holds up to [max_size] points
+
+    // each rebuilt range is replaced by its live and new points
+    long growth = 0;
+    for (auto &r : plan) {
+      r.new_start = r.start + growth;
+      growth += (long)(r.num_live + (r.batch_end - r.batch_start)) - (long)(r.end - r.start);
+    }
+    auto new_build_size = this->build_size + growth;
+    if (new_build_size > this->max_size) return false;
+    plan.push_back({0,
+                    nullptr,
+                    false,
+                    0,
+                    this->build_size,
+                    this->build_size,
+                    routed.size(),
+                    routed.size(),
+                    new_build_size});
+    auto num_live = [&](size_t k) { return plan[k].num_live; };
+
+    // pack the live items of each rebuilt range to its front
+    auto pack = [&](size_t k) {
+      auto in = this->items.begin();
+      this->present.packInto(in, plan[k].start, plan[k].end, in + plan[k].start, false);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, plan.size() - 1, pack);
+    } else {
+      for (size_t k = 0; k + 1 < plan.size(); k++)
+        pack(k);
+    }
+
+    // segment k, the items after rebuilt range k - 1 and the packed ones of range k, moves by
+    // new_start - start (with its present bits). The segments keep their order, so those moving
+    // left can go first, front to back, and then those moving right, back to front.
+    auto move_segment = [&](size_t k) {
+      auto s = (k == 0) ? 0 : plan[k - 1].end, e = plan[k].start + num_live(k);
+      auto dst = s + plan[k].new_start - plan[k].start;
+      auto in = this->items.begin();
+      if (dst < s) {
+        std::copy(in + s, in + e, in + dst);
+      } else {
+        std::copy_backward(in + s, in + e, in + dst + (e - s));
+      }
+      this->present.moveBits(s, e, dst);
+    };
+    for (size_t k = 0; k < plan.size(); k++) {
+      if (plan[k].new_start < plan[k].start) move_segment(k);
+    }
+    for (size_t k = plan.size(); k-- > 0;) {
+      if (plan[k].new_start > plan[k].start) move_segment(k);
+    }
+
+    // the new points follow the packed ones, and all of a rebuilt range is live
+    auto fill = [&](size_t k) {
+      auto out = plan[k].new_start + num_live(k);
+      std::copy(routed.begin() + plan[k].batch_start,
+                routed.begin() + plan[k].batch_end,
+                this->items.begin() + out);
+      this->present.setRange(plan[k].new_start, out + (plan[k].batch_end - plan[k].batch_start));
+    };
+    if (parallel) {
+      parlay::parallel_for(0, plan.size() - 1, fill);
+    } else {
+      for (size_t k = 0; k + 1 < plan.size(); k++)
+        fill(k);
+    }
+
+    if (plan[0].parent == nullptr) {
+      rebuildSubtree(plan[0]);  // the whole tree
+    } else {
+      applyInsertPlan(this->nodes, plan);
+    }
+    this->cur_size += points.size();
+    this->build_size = new_build_size;
+    this->buildLeafSoA(plan[0].start);  // the items before the first rebuilt range stay put
+#ifdef ALL_USE_BLOOM
+    this->bloom_filter.insert(points);
+#endif
+    return true;
+  }
+#endif
+
  public:
   BHL_KdTree(int log2size, bool initialize = true) : BaseTree(log2size) {
     if (initialize) this->items = parlay::sequence<objT>(this->max_size);
@@ -152,6 +453,7 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     build(points);
   }
   BHL_KdTree(const parlay::sequence<objT> &points) : BHL_KdTree(points.cut(0, points.size())) {}
+  BHL_KdTree(const BHL_KdTree &other, typename BaseTree::ForkTag tag) : BaseTree(other, tag) {}
 
   // MODIFY --------------------------------------------
   /*!
@@ -163,8 +465,10 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     assert(this->cur_size == 0);
     size_t n = points.size();
 
-    // save the input points into [items]
+    // save the input points into [items]; a build from a moved-in sequence may have left a shorter
+    // array there
     // TODO: does this parallelize? items.assign(points.begin(), points.end());
+    if (this->items.size() < n) this->items = parlay::sequence<objT>(this->max_size);
     this->cur_size = n;
     this->build_size = n;
     parlay::parallel_for(0, n, [&](size_t i) { this->items[i] = points[i]; });
@@ -182,18 +486,21 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #endif
   }
 
-  // should somehow indicate that inserts aren't allowed
+  /*!
+   * Build a new kd-tree in this tree over the input points, without copying them.
+   * This function should only be called on an empty tree.
+   * @param points the list of points to build the tree over. Is moved into the tree.
+   */
   void build(parlay::sequence<objT> &&points) {
     assert(this->cur_size == 0);
     size_t n = points.size();
     this->cur_size = n;
     this->build_size = n;
-    this->items = points;
-#ifdef ALL_USE_BLOOM
-    auto points_copy = this->items;
-    parlay::par_do([&]() { this->bloom_filter.build(points_copy); }, [&]() { build(); });
-#else
+    this->items = std::move(points);
     build();
+#ifdef ALL_USE_BLOOM
+    // the build permutes [items] in place, so the filter reads them afterwards
+    this->bloom_filter.build(this->items.cut(0, n));
 #endif
   }
 
@@ -209,34 +516,23 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     }
 #endif
 
-    auto insert_no_bloom = [&]() {
-      if (this->cur_size == 0) {
-        build_no_bloom(points);
-      } else {
-        // gather points from tree
-        parlay::sequence<objT> gather(this->cur_size);
-        [[maybe_unused]] auto num_moved = this->moveElementsTo(gather.cut(0, this->cur_size));
-        assert(num_moved == gather.size());
-
-        parlay::parallel_for(0, gather.size() + points.size(), [&](size_t i) {
-          if (i < gather.size())
-            this->items[i] = gather[i];  // reinsert old items
-          else
-            this->items[i] = points[i - gather.size()];  // insert new items
-        });
-
-        // set sizes
-        this->cur_size = gather.size() + points.size();
-        this->build_size = this->cur_size;
-        build();
-      }
-    };
-
-#ifdef ALL_USE_BLOOM
-    parlay::par_do([&]() { this->bloom_filter.insert(points); }, [&]() { insert_no_bloom(); });
-#else
-    insert_no_bloom();
+    if (this->cur_size == 0) {
+      this->clear();  // reset the slots an erase emptied; a fork gets storage of its own
+      build(points);
+#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
+    } else if (points.size() <= this->cur_size && this->ownsNodes() &&
+               insertIncremental(points)) {
+      // only the subtrees the new points unbalanced were rebuilt; a larger batch would unbalance
+      // the root anyway, and a fork rebuilds into storage of its own
 #endif
+    } else {
+      // gather points from tree, add the new points and rebuild over the gathered array
+      parlay::sequence<objT> gather(this->cur_size);
+      [[maybe_unused]] auto num_moved = this->moveElementsTo(gather.cut(0, this->cur_size));
+      assert(num_moved == gather.size());
+      gather.append(points);
+      build(std::move(gather));
+    }
   }
 
   template <bool rebuild = true>
@@ -261,8 +557,7 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
       auto cursize = this->cur_size;
       parlay::sequence<objT> elements(cursize);
       this->moveElementsTo(elements.cut(0, cursize));
-      const auto &const_elements = elements;
-      build(const_elements.cut(0, cursize));
+      build(std::move(elements));
     }
   }
 };
@@ -26,6 +26,23 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
   using typename BaseTree::nodeT;
 
   static const auto leaf_size = (coarsen ? CLUSTER_SIZE : 1);
+
+  /*!
+   * Link the subtree built over [subtree_items] as child [right] of [parent]: [subtree] is its
+   * root, or nullptr if it is a leaf.
+   */
+  void linkSubtree(nodeT &parent,
+                   bool right,
+                   nodeT *subtree,
+                   [[maybe_unused]] parlay::slice<objT *, objT *> subtree_items) {
+    // the median split puts the subtree exactly on its side of [parent]
+    assert(parent.getChildStartIdx(right) == (size_t)(subtree_items.begin() - this->items.begin()));
+    assert(parent.getChildEndIdx(right) == (size_t)(subtree_items.end() - this->items.begin()));
+    if (subtree == nullptr)
+      parent.setLeafChild(right);
+    else
+      parent.setChild(right, subtree);
+  }
   // Recursive Build --------------------------------------------------------------------------
   // PARALLEL
   template <bool top>
@@ -52,9 +69,10 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
         t.start();
 #endif
         assert(items.size() > 1);
+        split_dim = splitDimension<dim, objT>(items, split_dim, true);
         auto median = parallelMedianPartition<objT>(items, split_dim);
         assert(node_array[0].isEmpty());
-        new (&node_array[0]) nodeT(split_dim, median, items);
+        new (&node_array[0]) nodeT(split_dim, median, split_n(items), items, this->items.begin());
 #ifdef PRINT_COKDTREE_TIMINGS
         if (print_timer) {
           std::stringstream ss;
@@ -126,22 +144,20 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 
           auto cur_node_array =
               node_array + (top ? (i * numNodesTop(bottom_num_levels)) : (nodeOffset[i]));
-          // assign pointers to this node
-          if (i % 2 == 0)
-            originalNodeArray[parent_idx].setLeft(cur_node_array);
-          else
-            originalNodeArray[parent_idx].setRight(cur_node_array);
-          // this->parents[cur_node_array - this->nodes] = &originalNodeArray[parent_idx];
+          // assign pointers to this node (a leaf takes no record)
+          auto subtree_items = items.cut(left_endpoint, right_endpoint);
+          bool leaf = !top && numLevels<coarsen>(subtree_items.size()) == 1;
+          linkSubtree(originalNodeArray[parent_idx], i % 2, leaf ? nullptr : cur_node_array,
+                      subtree_items);
 
           if (top) {
-            buildKdtTopParallel(items.cut(left_endpoint, right_endpoint),
+            buildKdtTopParallel(subtree_items,
                                 cur_node_array,
                                 (split_dim + top_num_levels) % dim,
                                 bottom_num_levels);
-          } else {
-            buildKdtBottomParallel(items.cut(left_endpoint, right_endpoint),
-                                   cur_node_array,
-                                   (split_dim + top_num_levels) % dim);
+          } else if (!leaf) {
+            buildKdtBottomParallel(
+                subtree_items, cur_node_array, (split_dim + top_num_levels) % dim);
           }
         },
         1);
@@ -159,8 +175,8 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     for (int i = 0; i < num_subtrees / 2; i++) {
       auto parent_idx = child_indices[top_num_levels][i];
       auto &parent = originalNodeArray[parent_idx];
-      auto left_points = parent.getLeft()->countPoints();
-      auto right_points = parent.getRight()->countPoints();
+      auto left_points = parent.getSplitOffset();
+      auto right_points = parent.getNumItems() - parent.getSplitOffset();
       if (!((left_points == right_points) || (left_points + 1 == right_points))) {
         std::cerr << "ERROR: buildKdt" << (top ? "Top" : "Bottom")
                   << "(items.size() = " << items.size() << ", split_dim = " << split_dim
@@ -221,22 +237,19 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
       // Base case: perform a split
       if (num_levels == 1) {
         assert(items.size() > 1);
+        split_dim = splitDimension<dim, objT>(items, split_dim, false);
         auto median = serialMedianPartition<objT>(items, split_dim);
         assert(node_array[0].isEmpty());
-        new (&node_array[0]) nodeT(split_dim, median, items);
+        new (&node_array[0]) nodeT(split_dim, median, split_n(items), items, this->items.begin());
         return 1;
       }
     } else {
-      // Base case: insert the leaves
+      // Base case: a leaf, which takes no node record (its parent links to it)
       if (num_levels == 1) {
         // DEBUG_MSG("CO Leaf: " << items.size() << " points");
         assert(items.size() <= leaf_size);
         assert(items.size() > 0);
-        assert(node_array[0].isEmpty());
-        // DEBUG_MSG("Placing (" << items[0].coordinate(0) << ", " << items[0].coordinate(1) <<
-        // ")");
-        new (&node_array[0]) nodeT(items);
-        return 1;
+        return 0;
       } /*else if (num_levels == 2) {  // coarser base case
         assert(items.size() == 2);
         assert(items[0].coordinate(split_dim) != items[1].coordinate(split_dim));
@@ -281,31 +294,30 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     size_t size_per_leaf = items.size() / num_subtrees;
     size_t remainder = items.size() % num_subtrees;
     for (int i = 0; i < num_subtrees; i++) {
-      // assign pointers to this node
       auto p = i / 2;
       auto parent_idx = child_indices[top_num_levels][p];
 
-      if (i % 2 == 0)
-        originalNodeArray[parent_idx].setLeft(node_array);
-      else
-        originalNodeArray[parent_idx].setRight(node_array);
-      // this->parents[node_array - this->nodes] = &originalNodeArray[parent_idx];
-
       // construct this subtree
       // DEBUG_MSG("size_per_leaf, remainder : " << size_per_leaf << ", " << remainder);
       auto num_in_bucket = size_per_leaf + ((split_points[top_num_levels][i] <= remainder) ? 1 : 0);
       auto right_endpoint = left_endpoint + num_in_bucket;  // exclusive
       // DEBUG_MSG("interval: [" << left_endpoint << ", " << right_endpoint << ")");
+      size_t num_used;
       if (top) {
-        node_array += buildKdtTop(items.cut(left_endpoint, right_endpoint),
-                                  node_array,
-                                  (split_dim + top_num_levels) % dim,
-                                  bottom_num_levels);
+        num_used = buildKdtTop(items.cut(left_endpoint, right_endpoint),
+                               node_array,
+                               (split_dim + top_num_levels) % dim,
+                               bottom_num_levels);
       } else {
-        node_array += buildKdtBottom(items.cut(left_endpoint, right_endpoint),
-                                     node_array,
-                                     (split_dim + top_num_levels) % dim);
+        num_used = buildKdtBottom(items.cut(left_endpoint, right_endpoint),
+                                  node_array,
+                                  (split_dim + top_num_levels) % dim);
       }
+
+      // assign pointers to this node (a leaf took no record)
+      linkSubtree(originalNodeArray[parent_idx], i % 2, num_used == 0 ? nullptr : node_array,
+                  items.cut(left_endpoint, right_endpoint));
+      node_array += num_used;
       left_endpoint = right_endpoint;
     }
 
@@ -313,8 +325,8 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     for (int i = 0; i < num_subtrees / 2; i++) {
       auto parent_idx = child_indices[top_num_levels][i];
       auto &parent = originalNodeArray[parent_idx];
-      auto left_points = parent.getLeft()->countPoints();
-      auto right_points = parent.getRight()->countPoints();
+      auto left_points = parent.getSplitOffset();
+      auto right_points = parent.getNumItems() - parent.getSplitOffset();
       if (!((left_points == right_points) || (left_points + 1 == right_points))) {
         std::cerr << "ERROR: buildKdt" << (top ? "Top" : "Bottom")
                   << "(items.size() = " << items.size() << ", split_dim = " << split_dim
@@ -348,11 +360,13 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 
   // Base Building Functions
   void buildKdt() {
-    // check that it's not degenerate -> at least one split node w/ 2 leaves
     // DEBUG_MSG("buildKdtBottom: items.size() = " << this->items.size()
     //<< ", .size() = " << this->size());
-    assert(this->size() > leaf_size);
-    assert(numLevels<coarsen>(this->size()) > 1);
+    // degenerate -> a single leaf, under a root of its own
+    if (numLevels<coarsen>(this->size()) == 1) {
+      this->buildLeafRoot(this->size());
+      return;
+    }
     // initialize(numLevels(this->size()));
     if (parallel) {
       buildKdtBottomParallel(this->items.cut(0, this->size()), this->nodes, 0);
@@ -369,6 +383,7 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 
  public:
   CO_KdTree(int log2size) : BaseTree(log2size) { initialize(0); }
+  CO_KdTree(const CO_KdTree &other, typename BaseTree::ForkTag tag) : BaseTree(other, tag) {}
 
   // Just a convenience wrapper for tests
   template <class R>
@@ -402,35 +417,37 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     this->mark_time("Build Called");
 #endif
     assert(this->cur_size == 0);
-    this->items = points;
-    auto build_tree = [&]() {
-      auto n = points.size();
-      // this assertion holds for build, but not inserts
-      // assert(n > this->capacity() / 2);
-
-      // save the input points into [items]
-      this->cur_size = n;
-      this->build_size = n;
+    // save the input points into [items]
+    this->items = std::move(points);
+    auto n = this->items.size();
+    // this assertion holds for build, but not inserts
+    // assert(n > this->capacity() / 2);
+    this->cur_size = n;
+    this->build_size = n;
 #ifdef PRINT_COKDTREE_TIMINGS
-      this->mark_time("Setup");
+    this->mark_time("Setup");
 #endif
 
-      if (n == 0) return;
-      buildKdt();
+    if (n == 0) return;
+    buildKdt();
 #ifdef PRINT_COKDTREE_TIMINGS
-      this->mark_time("Build");
+    this->mark_time("Build");
 #endif
-      this->nodes[0].recomputeBoundingBoxSubtree();  // have to do this afterwards
+
+    // the points are in place: the bounding boxes, the leaf SoA and the filter only read [items]
+    auto finish_tree = [&]() {
+      // have to do this afterwards
+      this->nodes[0].recomputeBoundingBoxSubtree(this->items.begin(), this->present);
 #ifdef PRINT_COKDTREE_TIMINGS
       this->mark_time("Bounding");
 #endif
+      this->resetLiveCounts(this->nodes);
+      this->buildLeafSoA();
     };
-
 #ifdef ALL_USE_BLOOM
-    auto points_copy = this->items;
-    parlay::par_do([&]() { this->bloom_filter.build(points_copy); }, build_tree);
+    parlay::par_do([&]() { this->bloom_filter.build(this->items.cut(0, n)); }, finish_tree);
 #else
-    build_tree();
+    finish_tree();
 #endif
     // if (parallel) {
     // auto flags = parlay::sequence<bool>(n);
@@ -455,7 +472,7 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #endif
 
     if (this->cur_size == 0) {
-      // could be move if points is a sequence
+      this->clear();  // reset the slots an erase emptied; a fork gets storage of its own
       parlay::sequence<objT> to_insert;
       to_insert.assign(points);
       build(std::move(to_insert));
@@ -471,6 +488,19 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     }
   }
 
+  /*!
+   * Insert [points], moving them into the tree: an empty tree is built over them without a copy.
+   */
+  void insert(parlay::sequence<objT> &&points) {
+    if (points.size() == 0) return;
+    if (this->cur_size == 0) {
+      this->clear();
+      build(std::move(points));
+    } else {
+      insert(points);
+    }
+  }
+
   template <bool rebuild = true>
 #ifdef ALL_USE_BLOOM
   void bulk_erase(const parlay::sequence<objT> &points)
@@ -17,7 +17,8 @@ inline int numLevels(int num_leaves) {
   return 1 + (int)std::ceil(std::log2(num_leaves));  // number of levels
 }
 inline int numNodesTop(int num_levels) { return (1 << num_levels) - 1; }
-inline int numNodesBottom(size_t num_points) { return 2 * num_points - 1; }
+// (at most) the interior nodes of a bottom tree over [num_points] points; leaves take no record
+inline int numNodesBottom(size_t num_points) { return num_points - 1; }
 
 inline bool buildTopInParallel(__attribute__((unused)) int num_levels, size_t num_points) {
   if (num_points < CO_TOP_BUILD_BASE_CASE) return false;
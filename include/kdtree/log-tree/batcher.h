@@ -0,0 +1,245 @@
+#ifndef LOGTREE_BATCHER_H
+#define LOGTREE_BATCHER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <parlay/sequence.h>
+
+/*!
+ * Front-end that coalesces the small updates of many producer threads into large batches for
+ * [tree] (a LogTree, or a ConcurrentLogTree to keep it readable meanwhile). Updates are appended
+ * to a lock-free staging buffer, and applied when [flush_size] of them are staged, every
+ * [max_delay] (if non-zero), on [flush] and on destruction. Within a flush, an insert followed by
+ * an erase of an equal point cancels out and never reaches the tree; the remaining erases only
+ * match points inserted before the flush, so they are applied first, then the inserts. Updates
+ * staged by one thread are applied in order.
+ * Every flush runs on the batcher's own applier thread, the only one that updates [tree], so no two
+ * flushes run at once. That thread is not a parlay worker: [tree] must be serial, and a flush
+ * does its own work serially too.
+ */
+template <int dim, class objT, class Tree>
+class UpdateBatcher {
+  static_assert(!Tree::parallel_, "flushes run off parlay's scheduler; use a serial LogTree");
+
+  enum Op : uint8_t { NOOP, INSERT, ERASE };
+  struct Update {
+    objT p;
+    Op op;
+  };
+
+  // Staging buffer: producers claim ranges of [slots] through [reserved] and count the slots they
+  // filled in [written]. Only the active stage is open: a flush closes it by pushing [reserved]
+  // past the capacity, so later claims fail and retry on the other stage, which it then opens.
+  struct Stage {
+    parlay::sequence<Update> slots;
+    std::atomic<size_t> reserved{0};
+    std::atomic<size_t> written{0};
+  };
+
+  Tree& tree;
+  const size_t flush_size;
+  const size_t capacity;  // of a stage: room for claims while a full stage waits for its flush
+  Stage stages[2];
+  std::atomic<Stage*> active;
+  std::atomic<size_t> unapplied;  // staged updates not applied yet
+
+  // The applier thread flushes when asked to, every [max_delay] (if non-zero) and once more
+  // before it stops. The fields below are guarded by [applier_mutex].
+  const std::chrono::milliseconds max_delay;
+  std::thread applier;
+  std::mutex applier_mutex;
+  std::condition_variable applier_cv;  // wakes the applier
+  std::condition_variable flushed_cv;  // wakes [flush] callers
+  bool flush_requested;
+  size_t flushes_started, flushes_done;
+  bool stopping;
+
+  void requestFlush() {
+    {
+      std::lock_guard<std::mutex> lock(applier_mutex);
+      flush_requested = true;
+    }
+    applier_cv.notify_one();
+  }
+
+  void applierLoop() {
+    std::unique_lock<std::mutex> lock(applier_mutex);
+    while (true) {
+      auto woken = [&] { return flush_requested || stopping; };
+      if (max_delay.count() > 0) {
+        applier_cv.wait_for(lock, max_delay, woken);
+      } else {
+        applier_cv.wait(lock, woken);
+      }
+      bool stop = stopping;
+      if (!flush_requested && !stop && unapplied == 0) continue;  // an idle tick of the timer
+      flush_requested = false;
+      flushes_started++;
+      lock.unlock();
+      flushStaged();
+      lock.lock();
+      flushes_done++;
+      flushed_cv.notify_all();
+      if (stop) return;
+    }
+  }
+
+  // Apply the active stage, after switching producers to the other one; only run by the applier.
+  // The old stage is closed before the new one opens, so the updates of a producer never reach
+  // a later stage before an earlier one.
+  void flushStaged() {
+    do {
+      auto stage = active.load();
+      auto next = (stage == &stages[0]) ? &stages[1] : &stages[0];
+      auto n = std::min(stage->reserved.fetch_add(capacity), capacity);
+      next->reserved = 0;
+      active = next;
+      while (stage->written < n)
+        std::this_thread::yield();
+
+      unapplied -= applyUpdates(stage->slots.cut(0, n));
+      stage->written = 0;
+    } while (active.load()->written >= flush_size);
+  }
+
+  // Cancel insert/erase pairs of equal points, then apply the rest to [tree]; returns the number
+  // of updates (not no-ops) in [updates]
+  template <class Slice>
+  size_t applyUpdates(const Slice& updates) {
+    std::vector<size_t> idx;
+    for (size_t i = 0; i < updates.size(); i++)
+      if (updates[i].op != NOOP) idx.push_back(i);
+    if (idx.empty()) return 0;
+
+    // group equal points, in staging order
+    std::sort(idx.begin(), idx.end(), [&](size_t a, size_t b) {
+      auto ca = updates[a].p.coordinate(), cb = updates[b].p.coordinate();
+      if (std::lexicographical_compare(ca, ca + dim, cb, cb + dim)) return true;
+      if (std::lexicographical_compare(cb, cb + dim, ca, ca + dim)) return false;
+      return a < b;
+    });
+
+    // within a group, an erase cancels the latest uncancelled insert before it
+    std::vector<bool> keep(idx.size(), true);
+    std::vector<size_t> inserts;  // uncancelled, of the current group
+    for (size_t i = 0; i < idx.size(); i++) {
+      if (i > 0 && !(updates[idx[i - 1]].p == updates[idx[i]].p)) inserts.clear();
+      if (updates[idx[i]].op == INSERT) {
+        inserts.push_back(i);
+      } else if (!inserts.empty()) {
+        keep[inserts.back()] = keep[i] = false;
+        inserts.pop_back();
+      }
+    }
+
+    parlay::sequence<objT> erase_points, insert_points;
+    for (size_t i = 0; i < idx.size(); i++) {
+      if (!keep[i]) continue;
+      const auto& u = updates[idx[i]];
+      (u.op == ERASE ? erase_points : insert_points).push_back(u.p);
+    }
+    if (erase_points.size() > 0) tree.template erase<true>(erase_points);
+    if (insert_points.size() > 0) tree.insert(insert_points);
+    return idx.size();
+  }
+
+  // Stage points[lo, hi), at most [flush_size] of them
+  template <class R>
+  void stageRange(const R& points, size_t lo, size_t hi, Op op) {
+    size_t m = hi - lo;
+    while (true) {
+      auto stage = active.load();
+      auto start = stage->reserved.fetch_add(m);
+      if (start + m <= capacity) {
+        for (size_t i = 0; i < m; i++)
+          stage->slots[start + i] = Update{points[lo + i], op};
+        unapplied += m;
+        stage->written += m;
+        if (start < flush_size && start + m >= flush_size) requestFlush();
+        return;
+      }
+      if (start < capacity) {  // the claim straddles the end: fill its part with no-ops
+        for (auto i = start; i < capacity; i++)
+          stage->slots[i].op = NOOP;
+        stage->written += capacity - start;
+      }
+      requestFlush();  // the stage is full: wait for the applier to switch stages
+      std::this_thread::yield();
+    }
+  }
+
+  // A batch larger than [flush_size] is staged in pieces of [flush_size], each filling a stage
+  template <class R>
+  void stage(const R& points, Op op) {
+    for (size_t lo = 0; lo < points.size(); lo += flush_size)
+      stageRange(points, lo, std::min(points.size(), lo + flush_size), op);
+  }
+
+ public:
+  UpdateBatcher(Tree& tree_,
+                size_t flush_size_ = 1 << 14,
+                std::chrono::milliseconds max_delay_ = std::chrono::milliseconds(0))
+      : tree(tree_),
+        flush_size(flush_size_),
+        capacity(2 * flush_size_),
+        active(&stages[0]),
+        unapplied(0),
+        max_delay(max_delay_),
+        flush_requested(false),
+        flushes_started(0),
+        flushes_done(0),
+        stopping(false) {
+    for (auto& s : stages)
+      s.slots = parlay::sequence<Update>(capacity);
+    stages[1].reserved = capacity;  // closed
+    applier = std::thread([this]() { applierLoop(); });
+  }
+  ~UpdateBatcher() {  // applies the rest
+    {
+      std::lock_guard<std::mutex> lock(applier_mutex);
+      stopping = true;
+    }
+    applier_cv.notify_one();
+    applier.join();
+  }
+
+  /*!
+   * <Thread-safe> Stage the insertion of [points].
+   */
+  template <class R>
+  void insert(const R& points) {
+    stage(points, INSERT);
+  }
+
+  /*!
+   * <Thread-safe> Stage the erasure of [points].
+   */
+  template <class R>
+  void erase(const R& points) {
+    stage(points, ERASE);
+  }
+
+  /*!
+   * <Thread-safe> Apply every update staged so far, and wait until they are applied.
+   */
+  void flush() {
+    std::unique_lock<std::mutex> lock(applier_mutex);
+    auto target = flushes_started + 1;  // a flush in progress may miss the latest updates
+    flush_requested = true;
+    applier_cv.notify_one();
+    flushed_cv.wait(lock, [&] { return flushes_done >= target; });
+  }
+
+  /*!
+   * Number of staged updates not applied to the tree yet.
+   */
+  size_t staged() const { return unapplied; }
+};
+
+#endif  // LOGTREE_BATCHER_H
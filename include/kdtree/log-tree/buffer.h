@@ -1,37 +1,130 @@
 #ifndef LOGTREE_BUFFER_H
 #define LOGTREE_BUFFER_H
 
+#define XXH_PRIVATE_API
+#include <atomic>
+#include <memory>
 #include <parlay/parallel.h>
 #include <parlay/sequence.h>
+#include <xxHash/xxhash.h>
 
+#include "../shared/cow.h"
 #include "../shared/macro.h"
 
+template <int dim, class objT, bool parallel, bool coarsen>
+class LogTree;
+
 template <int dim, class objT, bool parallel = false>
 class alignas(64) LogTreeBuffer {
+  template <int _dim, class _objT, bool _parallel, bool _coarsen>
+  friend class LogTree;
+
   typedef point<dim> pointT;
-  // simple wrapper around parlay::sequence
-  parlay::sequence<objT> items;
+  // simple wrapper around parlay::sequence; shared with the forks of this buffer (see [ForkTag])
+  SharedSequence<objT> items;
   parlay::sequence<bool> present;
   size_t cur_size;
   size_t insert_size;
 
+  // Hash index from coordinates to the slots of [items]: open addressing with linear probing over
+  // twice the capacity, so the load factor stays at most 1/2. Erasing tombstones an entry (with a
+  // CAS, so concurrent erasures of equal points each claim a different slot); the index is reset
+  // whenever the slots are compacted.
+  static constexpr int32_t INDEX_EMPTY = -1;
+  static constexpr int32_t INDEX_ERASED = -2;
+  size_t index_mask;
+  std::unique_ptr<std::atomic<int32_t>[]> index;
+
+  size_t indexHash(const objT &p) const {
+    double x[dim];  // adding 0.0 turns -0.0 into 0.0, which compares equal to it
+    for (int d = 0; d < dim; d++)
+      x[d] = p.coordinate()[d] + 0.0;
+    return (size_t)XXH64(x, dim * sizeof(double), 0) & index_mask;
+  }
+
+  void indexInsert(int32_t slot) {
+    for (auto h = indexHash(items[slot]);; h = (h + 1) & index_mask) {
+      int32_t expected = INDEX_EMPTY;
+      if (index[h].compare_exchange_strong(expected, slot)) return;
+    }
+  }
+
+  // claim the index entry of a live item equal to [p] and return its slot, or -1 if there is none
+  int32_t indexErase(const objT &p) {
+    for (auto h = indexHash(p);; h = (h + 1) & index_mask) {
+      auto slot = index[h].load();
+      if (slot == INDEX_EMPTY) return -1;
+      if (slot >= 0 && items[slot] == p && index[h].compare_exchange_strong(slot, INDEX_ERASED))
+        return slot;
+    }
+  }
+
+  // index the slots [start, end) after placing their items
+  void indexSlots(size_t start, size_t end) {
+    if (parallel) {
+      parlay::parallel_for(start, end, [&](size_t i) { indexInsert(i); });
+    } else {
+      for (size_t i = start; i < end; i++)
+        indexInsert(i);
+    }
+  }
+
  public:
   LogTreeBuffer() = delete;
   LogTreeBuffer(int log2size)
-      : items(1 << log2size),
+      : items(parlay::sequence<objT>(1 << log2size)),
         present(1 << log2size, false),
         cur_size(0),
-        insert_size(1 << log2size) {}
+        insert_size(1 << log2size),
+        index_mask((2UL << log2size) - 1),
+        index(new std::atomic<int32_t>[2UL << log2size]) {
+    clear();
+  }
+  // same signature as the BHL buffer tree's constructor
+  LogTreeBuffer(int log2size, [[maybe_unused]] bool initialize) : LogTreeBuffer(log2size) {}
+  LogTreeBuffer(const LogTreeBuffer &other) : LogTreeBuffer(other, ForkTag{}) {
+    items = other.items;  // a copy of its own
+  }
+
+  struct ForkTag {};
+  /*!
+   * Fork of [other], for a writer that erases from it while [other] stays readable (e.g. by a
+   * LogTree snapshot): shares [items] and copies only the flags and the index. The fork copies
+   * [items] before it inserts.
+   */
+  LogTreeBuffer(const LogTreeBuffer &other, ForkTag)
+      : items(other.items.share()),
+        present(other.present),
+        cur_size(other.cur_size),
+        insert_size(other.insert_size),
+        index_mask(other.index_mask),
+        index(new std::atomic<int32_t>[index_mask + 1]) {
+    auto copy_entry = [&](size_t h) { index[h] = other.index[h].load(); };
+    if (parallel) {
+      parlay::parallel_for(0, index_mask + 1, copy_entry);
+    } else {
+      for (size_t h = 0; h <= index_mask; h++)
+        copy_entry(h);
+    }
+  }
 
   size_t size() const { return cur_size; }
   bool empty() const { return cur_size == 0; }
+  size_t get_build_size() const { return items.size() - insert_size; }
   void clear() {
     insert_size = items.size();
     cur_size = 0;
     present.assign(items.size(), false);
+    auto reset_entry = [&](size_t h) { index[h] = INDEX_EMPTY; };
+    if (parallel) {
+      parlay::parallel_for(0, index_mask + 1, reset_entry);
+    } else {
+      for (size_t h = 0; h <= index_mask; h++)
+        reset_entry(h);
+    }
   }
 
-  size_t moveElementsTo(parlay::slice<objT *, objT *> dest) {
+  size_t copyElementsTo(parlay::slice<objT *, objT *> dest) const {
     auto cur_end = items.size() - insert_size;
     size_t ret;
     assert(dest.size() >= size());
@@ -47,6 +140,11 @@ class alignas(64) LogTreeBuffer {
         }
       }
     }
+    return ret;
+  }
+
+  size_t moveElementsTo(parlay::slice<objT *, objT *> dest) {
+    auto ret = copyElementsTo(dest);
     clear();
     return ret;
   }
@@ -58,6 +156,7 @@ class alignas(64) LogTreeBuffer {
     if (points.size() + cur_size > items.size())
       throw std::runtime_error("invalid insertion into logtree buffer!");
 #endif
+    if (items.shared()) items = parlay::sequence<objT>(*items);  // a fork (see [ForkTag])
 
     if (points.size() <= insert_size) {
       // place items
@@ -66,6 +165,7 @@ class alignas(64) LogTreeBuffer {
         items[cur_start + i] = points[i];
         present[cur_start + i] = true;
       });
+      indexSlots(cur_start, cur_start + points.size());
       // update size fields
       this->cur_size += points.size();
       this->insert_size -= points.size();
@@ -80,21 +180,52 @@ class alignas(64) LogTreeBuffer {
           this->items[i] = gather[i];
         else
           this->items[i] = points[i - gather.size()];
+        this->present[i] = true;
       });
+      indexSlots(0, new_size);
       // update size fields
       this->cur_size = new_size;
       insert_size -= new_size;
     }
   }
 
+  // erase one live copy of each of [points], through the hash index: O(1) expected per point
+  template <bool _rebuild = false>
   void bulk_erase(const parlay::sequence<objT> &points) {
-    parlay::parallel_for(0, points.size(), [&](size_t i) {
-      parlay::parallel_for(0, items.size() - insert_size, [&](size_t j) {
-        if (present[j] && (points[i] == items[j])) {
-          present[j] = false;
+    auto erase_point = [&](size_t i) -> size_t {
+      auto slot = indexErase(points[i]);
+      if (slot < 0) return 0;
+      present[slot] = false;
+      return 1;
+    };
+    size_t num_removed = 0;
+    if (parallel) {
+      parlay::sequence<size_t> removed(points.size());
+      parlay::parallel_for(0, points.size(), [&](size_t i) { removed[i] = erase_point(i); });
+      num_removed = parlay::reduce(removed);
+    } else {
+      for (size_t i = 0; i < points.size(); i++)
+        num_removed += erase_point(i);
+    }
+    cur_size -= num_removed;
+  }
+
+  // erase the items at positions [slots] (sorted), e.g. from an ID locator
+  void bulk_erase_slots(parlay::slice<uint32_t *, uint32_t *> slots) {
+    for (auto slot : slots) {
+      if (!present[slot]) continue;
+      [[maybe_unused]] auto claimed = indexErase(items[slot]);
+      assert(claimed >= 0);
+      // equal points are interchangeable: keep the entry of [slot] and drop the claimed one's
+      if (claimed != (int32_t)slot) {
+        for (auto h = indexHash(items[slot]);; h = (h + 1) & index_mask) {
+          int32_t expected = slot;
+          if (index[h].compare_exchange_strong(expected, claimed)) break;
         }
-      });
-    });
+      }
+      present[slot] = false;
+      cur_size--;
+    }
   }
 
   template <bool _unused>
@@ -104,12 +235,11 @@ class alignas(64) LogTreeBuffer {
 
   // queries
   bool contains(const objT &p) const {
-    // TODO: not great, has a data race
-    bool ret = false;
-    parlay::parallel_for(0, items.size() - insert_size, [&](size_t i) {
-      if (present[i] && (p == items[i])) ret = true;
-    });
-    return ret;
+    for (auto h = indexHash(p);; h = (h + 1) & index_mask) {
+      auto slot = index[h].load();
+      if (slot == INDEX_EMPTY) return false;
+      if (slot >= 0 && items[slot] == p) return true;
+    }
   }
 
   parlay::sequence<objT> orthogonalQuery(const objT &qMin, const objT &qMax) const {
@@ -136,13 +266,79 @@ class alignas(64) LogTreeBuffer {
     return ret;
   }
 
+  size_t orthogonalCount(const objT &qMin, const objT &qMax) const {
+    auto cur_end = items.size() - insert_size;
+    auto in_box = parlay::delayed_seq<size_t>(
+        cur_end, [&](size_t i) { return present[i] && itemInBox(qMin, qMax, &items[i]); });
+    return parlay::reduce(in_box);
+  }
+
+  template <class F, class M>
+  auto orthogonalReduce(const objT &qMin, const objT &qMax, F f, M m) const {
+    using T = decltype(m.identity);
+    auto cur_end = items.size() - insert_size;
+    auto vals = parlay::delayed_seq<T>(cur_end, [&](size_t i) {
+      return (present[i] && itemInBox(qMin, qMax, &items[i])) ? f(items[i]) : m.identity;
+    });
+    return parlay::reduce(vals, m);
+  }
+
+  // two-pass interface (see [KdTree::orthogonalQuerySegments]): the buffer is a single segment
+  parlay::sequence<RangeSegment> orthogonalQuerySegments(const objT &qMin, const objT &qMax) const {
+    auto cur_end = items.size() - insert_size;
+    auto in_box = parlay::delayed_seq<size_t>(
+        cur_end, [&](size_t i) { return present[i] && itemInBox(qMin, qMax, &items[i]); });
+    parlay::sequence<RangeSegment> segs(1);
+    segs[0] = {0, (uint32_t)cur_end, true, (size_t)parlay::reduce(in_box), 0};
+    return segs;
+  }
+
+  void orthogonalQueryWrite(const objT &qMin,
+                            const objT &qMax,
+                            const parlay::sequence<RangeSegment> &segs,
+                            parlay::slice<objT *, objT *> out) const {
+    auto cur_end = items.size() - insert_size;
+    auto in_box = parlay::delayed_seq<bool>(
+        cur_end, [&](size_t i) { return present[i] && itemInBox(qMin, qMax, &items[i]); });
+    [[maybe_unused]] auto num_written =
+        parlay::pack_into(parlay::slice(items.begin(), items.begin() + cur_end),
+                          in_box,
+                          out.cut(segs[0].offset, segs[0].offset + segs[0].count));
+    assert(num_written == segs[0].count);
+  }
+
+  parlay::sequence<RangeSegment> radiusQuerySegments(const objT &center, double r) const {
+    auto cur_end = items.size() - insert_size;
+    auto in_ball = parlay::delayed_seq<size_t>(cur_end, [&](size_t i) {
+      return present[i] && pointDistanceSqr(center, items[i]) <= r * r;
+    });
+    parlay::sequence<RangeSegment> segs(1);
+    segs[0] = {0, (uint32_t)cur_end, true, (size_t)parlay::reduce(in_ball), 0};
+    return segs;
+  }
+
+  void radiusQueryWrite(const objT &center,
+                        double r,
+                        const parlay::sequence<RangeSegment> &segs,
+                        parlay::slice<objT *, objT *> out) const {
+    auto cur_end = items.size() - insert_size;
+    auto in_ball = parlay::delayed_seq<bool>(cur_end, [&](size_t i) {
+      return present[i] && pointDistanceSqr(center, items[i]) <= r * r;
+    });
+    [[maybe_unused]] auto num_written =
+        parlay::pack_into(parlay::slice(items.begin(), items.begin() + cur_end),
+                          in_ball,
+                          out.cut(segs[0].offset, segs[0].offset + segs[0].count));
+    assert(num_written == segs[0].count);
+  }
+
   void knnSinglePoint(const objT &p, knnBuf::buffer<const pointT *> &buf) const {
     auto cur_end = items.size() - insert_size;
     for (size_t i = 0; i < cur_end; i++) {
       if (present[i]) {
-        auto dist = p.dist(items[i]);
+        auto dist = pointDistanceSqr(p, items[i]);
         // if (dist <= radius) {
-        const objT *item_ptr = items.begin() + i;
+        const pointT *item_ptr = items.begin() + i;
         buf.insert(knnBuf::elem(dist, item_ptr));
         //}
       }
@@ -158,7 +354,7 @@ class alignas(64) LogTreeBuffer {
       int k,
       bool preload) const {
     auto buf = knnBuf::buffer<const pointT *>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
-    if (preload) buf.ptr = k;
+    if (preload) buf.preload();
 
     knnSinglePoint(p, buf);
 
@@ -186,7 +382,11 @@ class alignas(64) LogTreeBuffer {
            parlay::slice<knnBuf::elem<const pointT *> *, knnBuf::elem<const pointT *> *> &out,
            parlay::slice<const pointT **, const pointT **> &res,
            int k,
-           bool preload = false) const {
+           bool preload = false,
+           // every query scans the whole buffer, so neither the visiting order nor approximation
+           // apply
+           [[maybe_unused]] const parlay::sequence<uint32_t> &order = {},
+           [[maybe_unused]] const knnBuf::approx &approx = {}) const {
     assert(res.size() == k * queries.size());
     assert(out.size() == 2 * k * queries.size());
 
@@ -0,0 +1,127 @@
+#ifndef LOGTREE_CONCURRENT_H
+#define LOGTREE_CONCURRENT_H
+
+#include <atomic>
+
+#include "../shared/epoch.h"
+#include "./logtree.h"
+
+/*!
+ * A LogTree that query threads read while one writer thread updates it, without locks. The writer
+ * updates its own LogTree, whose trees are forked before an erase (copying only the pages of state
+ * it touches) or copied before an insert whenever a snapshot shares them, and then publishes a new
+ * [LogTree::snapshot]. Readers pin an epoch and query the latest published snapshot; a replaced
+ * snapshot is freed once the readers that may hold it are gone, and the trees only it still uses
+ * with it.
+ * Serial trees only: readers are arbitrary threads, not parlay workers, so the queries they run
+ * must not fork parlay work (like the rebuild of [LogTree::insertAsync]).
+ */
+template <int dim, class objT, bool parallel, bool coarsen>
+class ConcurrentLogTree {
+  static_assert(!parallel, "readers query off parlay's scheduler; use a serial LogTree");
+  typedef LogTree<dim, objT, parallel, coarsen> logTree;
+
+  logTree tree;  // the writer's
+  std::atomic<const logTree*> published;
+  mutable EpochManager epochs;
+
+  void publish() {
+    auto old = published.exchange(new logTree(tree.snapshot()));
+    epochs.retire([old]() { delete old; });
+    epochs.reclaim();
+  }
+
+ public:
+  static constexpr bool parallel_ = parallel;
+
+  /*!
+   * [config] sets the geometry of the writer's LogTree. [max_readers] bounds the number of readers
+   * inside [read] at a time; more wait for a slot.
+   */
+  explicit ConcurrentLogTree(const LogTreeConfig& config = {}, size_t max_readers = 64)
+      : tree(config), published(new logTree(tree.snapshot())), epochs(max_readers) {}
+  ~ConcurrentLogTree() { delete published.load(); }
+
+  // WRITER (one thread) ----------------------------
+  template <class R>
+  void insert(const R& points) {
+    tree.insert(points);
+    publish();
+  }
+
+  /*!
+   * Start an [LogTree::insertAsync]: readers keep seeing the current version until
+   * [finishRebuild] publishes the rebuilt trees. A rebuild still pending is finished (and
+   * published) first.
+   */
+  template <class R>
+  void insertAsync(const R& points) {
+    finishRebuild();
+    tree.insertAsync(points);
+    if (!tree.rebuildPending()) publish();
+  }
+
+  /*!
+   * [LogTree::insertAsync] with [during]: readers keep seeing the current version while the trees
+   * are rebuilt next to [during](version), then the rebuilt trees are published.
+   */
+  template <class R, class F>
+  void insertAsync(const R& points, F during) {
+    finishRebuild();
+    tree.insertAsync(points, during);
+    publish();
+  }
+
+  void finishRebuild() {
+    if (!tree.rebuildPending()) return;
+    tree.finishRebuild();
+    publish();
+  }
+
+  template <bool bulk, class R>
+  void erase(const R& points) {
+    tree.template erase<bulk>(points);
+    publish();
+  }
+
+  template <class R>
+  void bulk_erase(const R& points) {
+    erase<true>(points);
+  }
+
+  template <class R>
+  void eraseById(const R& ids) {
+    tree.eraseById(ids);
+    publish();
+  }
+
+  // READERS (any thread) ---------------------------
+  /*!
+   * <Thread-safe> Return [f](version), for the latest published version (a const LogTree&),
+   * which stays valid until [f] returns: results pointing into it, like those of [knn], must be
+   * used inside [f].
+   */
+  template <class F>
+  auto read(F f) const {
+    auto guard = epochs.pin();
+    return f(*published.load());
+  }
+
+  bool contains(const objT& p) const {
+    return read([&](const logTree& t) { return t.contains(p); });
+  }
+  size_t size() const {
+    return read([](const logTree& t) { return t.size(); });
+  }
+  parlay::sequence<objT> orthogonalQuery(const objT& qMin, const objT& qMax) const {
+    return read([&](const logTree& t) { return t.orthogonalQuery(qMin, qMax); });
+  }
+  size_t orthogonalCount(const objT& qMin, const objT& qMax) const {
+    return read([&](const logTree& t) { return t.orthogonalCount(qMin, qMax); });
+  }
+  parlay::sequence<objT> radiusQuery(const objT& center, double r) const {
+    return read([&](const logTree& t) { return t.radiusQuery(center, r); });
+  }
+};
+
+#endif  // LOGTREE_CONCURRENT_H
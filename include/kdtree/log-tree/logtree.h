@@ -4,8 +4,14 @@
 #include "../cache-oblivious/cokdtree.h"
 #include "../binary-heap-layout/bhlkdtree.h"
 #include "../shared/macro.h"
+#include "../shared/idpoint.h"
 #include "./buffer.h"
 
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #ifdef PRINT_LOGTREE_TIMINGS
 #include "common/get_time.h"
 #endif
@@ -20,10 +26,9 @@
   } while (false)*/
 
 #ifndef NDEBUG
-template <int NUM_TREES>
-static std::string treeMaskToString(int tree_mask) {
+static std::string treeMaskToString(uint64_t tree_mask, int num_trees) {
   std::stringstream ss;
-  for (int i = NUM_TREES - 1; i >= 0; i--) {
+  for (int i = num_trees - 1; i >= 0; i--) {
     ss << ((tree_mask >> i) & 1);
   }
   return ss.str();
@@ -40,9 +45,13 @@ static std::string seq_to_str(const parlay::sequence<int>& s) {
 }
 #endif
 
-template <int NUM_TREES,         // the number of static trees
-          int BUFFER_LOG2_SIZE,  // the size of the (dynamic) buffer tree
-          int dim,
+// Geometry of a LogTree, chosen at construction: static tree i holds 2^(buffer_log2_size + i)
+// points, and levels are added as the tree grows
+struct LogTreeConfig {
+  int buffer_log2_size = LOGTREE_BUFFER_LOG2_SIZE;  // log2 size of the (dynamic) buffer tree
+};
+
+template <int dim,
           class objT,
           bool parallel,  // defaults in kdtree.h forward decl
           bool coarsen>
@@ -61,29 +70,47 @@ class LogTree {
 #ifdef LOGTREE_USE_BLOOM
   typedef BloomFilter<dim> BloomFilterT;
 #endif
-  static const size_t BUFFER_SIZE = (1 << BUFFER_LOG2_SIZE);
+  const int buffer_log2_size;
+  const size_t buffer_size;
+
+  uint64_t tree_mask;  // represent whether the static trees are full or not
 
-  int tree_mask;  // represent whether the static trees are full or not
-  dynamicTree buffer_tree;
+  // The trees (and their filters) are held through shared pointers, so that [snapshot]s can share
+  // them. A tree is never modified while it is shared: the writer takes its own copy (or fork)
+  // first (see [ownTree]), and the snapshot keeps the old version alive until it is destroyed.
+  std::shared_ptr<dynamicTree> buffer_tree;
 #ifdef LOGTREE_USE_BLOOM
-  BloomFilterT buffer_bloom_filter;
+  std::shared_ptr<BloomFilterT> buffer_bloom_filter;
 #endif
 
   // TODO: make sure this is on individual cache lines
-  staticTree* static_trees;  // TODO: maybe use a vector?
+  // One entry per level reached so far; a static tree (and its filter) is only allocated while its
+  // bit in [tree_mask] is set, and is null otherwise.
+  parlay::sequence<std::shared_ptr<staticTree>> static_trees;
 #ifdef LOGTREE_USE_BLOOM
-  BloomFilterT* static_bloom_filters;
+  parlay::sequence<std::shared_ptr<BloomFilterT>> static_bloom_filters;
 #endif
 
-  static inline int nth_tree_log2size(int n) {
-    assert(n < NUM_TREES);
-    return (n + BUFFER_LOG2_SIZE);
-  }
-  // TODO: make this size_t
-  static inline size_t nth_tree_size(int n) { return 1 << nth_tree_log2size(n); }
-  static inline bool nth_bit_set(int x, int n) { return (x >> n) % 2; }
-  static inline void set_nth_bit(int& x, int n) { x |= (1 << n); }
-  static inline void unset_nth_bit(int& x, int n) { x &= ~(1 << n); }
+  // ID -> where the point lives, for objT with an [id] (see shared/idpoint.h). Indexed by ID, so
+  // IDs should be dense (e.g. indices into the caller's records). Entries are refreshed whenever a
+  // tree is (re)built and may go stale after erasing; [eraseById] validates them against the tree.
+  struct IdLocation {
+    int32_t tree;   // static tree index, or BUFFER_TREE_IDX (-1)
+    uint32_t slot;  // position in the tree's [items]
+  };
+  static constexpr int32_t NO_TREE = -2;
+  parlay::sequence<IdLocation> id_locator;
+
+  // node records address children and items with 32-bit offsets (see KdTree)
+  static constexpr int MAX_TREE_LOG2_SIZE = 30;
+
+  inline int nth_tree_log2size(int n) const { return (n + buffer_log2_size); }
+  inline size_t nth_tree_size(int n) const { return (size_t)1 << nth_tree_log2size(n); }
+  static inline bool nth_bit_set(uint64_t x, int n) { return (x >> n) % 2; }
+  static inline void set_nth_bit(uint64_t& x, int n) { x |= (uint64_t(1) << n); }
+  static inline void unset_nth_bit(uint64_t& x, int n) { x &= ~(uint64_t(1) << n); }
+  // the number of levels up to the highest set bit of [x]
+  static inline int num_levels(uint64_t x) { return x ? 64 - __builtin_clzll(x) : 0; }
 
  public:
 #ifdef ERASE_SEARCH_TIMES
@@ -92,50 +119,39 @@ class LogTree {
   double total_leaf_time = 0;
 #endif
   static constexpr bool coarsen_ = coarsen;
-  LogTree()
-      : tree_mask(0),
-        buffer_tree(BUFFER_LOG2_SIZE, true)
+  static constexpr bool parallel_ = parallel;
+  explicit LogTree(const LogTreeConfig& config = {})
+      : buffer_log2_size(config.buffer_log2_size),
+        buffer_size((size_t)1 << config.buffer_log2_size),
+        tree_mask(0),
+        buffer_tree(std::make_shared<dynamicTree>(buffer_log2_size, true))
 #ifdef LOGTREE_USE_BLOOM
         ,
-        buffer_bloom_filter(1 << BUFFER_LOG2_SIZE)
+        buffer_bloom_filter(std::make_shared<BloomFilterT>(buffer_size))
 #endif
   {
-    static_trees = (staticTree*)malloc(NUM_TREES * sizeof(staticTree));
-#ifdef LOGTREE_USE_BLOOM
-    static_bloom_filters = (BloomFilterT*)malloc(NUM_TREES * sizeof(BloomFilterT));
-#endif
-    for (int i = 0; i < NUM_TREES; i++) {
-      auto curlog2size = nth_tree_log2size(i);
-#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
-      new (&static_trees[i]) staticTree(curlog2size);
-#elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
-      new (&static_trees[i]) staticTree(curlog2size, false);
-#endif
-#ifdef LOGTREE_USE_BLOOM
-      new (&static_bloom_filters[i]) BloomFilterT(1 << curlog2size);
-#endif
-    }
+    assert(buffer_log2_size <= MAX_TREE_LOG2_SIZE);
   }
 
-  // hack to get treeTime to work
+  // hack to get treeTime to work: no capacity is needed up front, levels are added on demand
   LogTree(__attribute__((unused)) int x) : LogTree() {}
   template <class R>
-  LogTree(const R& points) : LogTree() {
+  LogTree(const R& points, const LogTreeConfig& config = {}) : LogTree(config) {
     insert(points);
   }
 
   ~LogTree() {
-    for (int i = 0; i < NUM_TREES; i++) {
-      static_trees[i].~staticTree();  // destroy placement-new objects
+    if (rebuild_task.valid()) rebuild_task.wait();  // it reads the trees
+  }
 
-#ifdef LOGTREE_USE_BLOOM
-      static_bloom_filters[i].~BloomFilterT();
-#endif
-    }
-    free(static_trees);
-#ifdef LOGTREE_USE_BLOOM
-    free(static_bloom_filters);
-#endif
+  /*!
+   * A read-only copy of this LogTree as it is now, in O(levels): it shares the trees, and later
+   * updates of this LogTree copy a tree before changing it, so the snapshot never sees them. The
+   * snapshot has no ID locator (see [eraseById]) and must not be updated.
+   */
+  LogTree snapshot() const {
+    assert(!pending_insert);  // its trees are not published yet
+    return LogTree(*this, SnapshotTag{});
   }
 
   // MODIFY -----------------------------------------
@@ -145,192 +161,46 @@ class LogTree {
   // TODO: think about coarsening parallel base cases
   template <class R>  // TODO: use [parlay::Range] concept later
   void insert(const R& points) {
+    finishRebuild();
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
     timer t("[Insert]");
 #endif
-    // compute number of moving elements in terms of buffers
-    int full_buffers = (int)(points.size() / BUFFER_SIZE);
-    int remainder = (int)(points.size() % BUFFER_SIZE);
-    bool use_buffer = false;
-
-    // check if buffer is involved
-    if (remainder + buffer_tree.size() > BUFFER_SIZE) {
-      full_buffers++;
-      remainder = (remainder + buffer_tree.size()) - BUFFER_SIZE;
-      use_buffer = true;
-    }
-
-    DEBUG_MSG("Inserting " << points.size() << " points");
-    DEBUG_MSG("full buffers, remainder, use_buffer = " << full_buffers << ", " << remainder << ", "
-                                                       << (use_buffer ? "true" : "false"));
-
-    // simulate which trees to gather
-    // <buffer, points_start, points_end, gather trees, new tree>
-    parlay::sequence<std::tuple<bool, size_t, size_t, parlay::sequence<int>, int>> moves;
-    auto cur_points_end = points.size();
-    bool have_used_buffer = false;
-    auto new_tree_mask = tree_mask + full_buffers;
-    DEBUG_MSG(treeMaskToString<NUM_TREES>(tree_mask) << "\n"
-                                                     << treeMaskToString<NUM_TREES>(new_tree_mask));
-
-    for (int i = NUM_TREES - 1; i >= 0;) {
-      if (nth_bit_set(new_tree_mask, i) && !nth_bit_set(tree_mask, i)) {
-        DEBUG_MSG("New Tree: " << i);
-        // tree [i] was not filled before but is now
-
-        // gather all the smaller trees
-        parlay::sequence<int> to_gather;
-        size_t size_gathered = 0;
-        int j = i - 1;
-        while (j >= 0) {
-          if (nth_bit_set(new_tree_mask, j)) {
-            if (nth_bit_set(tree_mask, j)) {
-              DEBUG_MSG(" - Skipping Tree (11)" << j);
-            } else {
-              break;
-            }
-
-          } else {
-            if (nth_bit_set(tree_mask, j)) {
-              DEBUG_MSG(" - Gathering Tree " << j);
-              to_gather.push_back(j);
-              size_gathered += nth_tree_size(j);
-            } else {
-              DEBUG_MSG(" - Skipping Tree (00)" << j);
-            }
-          }
-          j--;
-        }
+    if constexpr (hasId<objT>::value) growIdLocator(points);
 
-        auto num_from_points = nth_tree_size(i) - size_gathered;
-        full_buffers -= (num_from_points / BUFFER_SIZE);
-        DEBUG_MSG("num_from_points: " << num_from_points);
-
-        bool cur_uses_buffer = false;
-        if (use_buffer && (full_buffers == 0)) {
-          assert(!have_used_buffer);
-          have_used_buffer = true;
-          DEBUG_MSG(" - Gathering Buffer Tree ");
-          cur_uses_buffer = true;
-          num_from_points -= buffer_tree.size();  // we moved buffer tree in
-        }
-
-        auto cur_points_start = cur_points_end - num_from_points;
-        DEBUG_MSG("MOVE: [uses_buffer, point start, point end, trees, new tree] = ["
-                  << (cur_uses_buffer ? "true" : "false") << ", " << cur_points_start << ", "
-                  << cur_points_end << ", " << seq_to_str(to_gather) << ", " << i << "]");
-        moves.push_back(
-            {cur_uses_buffer, cur_points_start, cur_points_end, std::move(to_gather), i});
-
-        // reset counters
-        cur_points_end = cur_points_start;
-        i = j;
-      } else {  // otherwise, should be the same
-        assert(nth_bit_set(new_tree_mask, i) == nth_bit_set(tree_mask, i));
-        i--;
-      }
-    }
-    assert(cur_points_end == (size_t)remainder);
-
-    // safety assertion, should remove later for release
-    if (full_buffers != 0)
-      throw std::runtime_error("Not enough trees! : full_buffers = " +
-                               std::to_string(full_buffers));
+    auto plan = planInsert(points.size());
+    const auto& moves = plan.moves;
+    auto remainder = plan.remainder;
+    auto have_used_buffer = plan.uses_buffer;
+    auto new_tree_mask = plan.new_tree_mask;
 
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
     std::cout << "[Insert] Serial Computation: " << t.get_next() << "\n";
 #endif
     // REBUILD THE TREES -----------------------------
+    growLevels(new_tree_mask);
 
     // need to serially empty buffer if it's used
     parlay::sequence<objT> buffer_points;
-    if (have_used_buffer) {
-      buffer_points.resize(buffer_tree.size());
-      buffer_tree.moveElementsTo(buffer_points.cut(0, buffer_points.size()));
-
-#ifdef LOGTREE_USE_BLOOM
-      buffer_bloom_filter.clear();
-#endif
-    }
+    if (have_used_buffer) buffer_points = takeBuffer();
 
     // insert remainder into buffer
     auto fill_buff_f = [&]() {
+      if (remainder == 0) return;
 #ifdef LOGTREE_USE_BLOOM
-      parlay::par_do([&]() { buffer_tree.insert(points.cut(0, remainder)); },
-                     [&]() { buffer_bloom_filter.insert(points.cut(0, remainder)); });
+      parlay::par_do([&]() { own(buffer_tree).insert(points.cut(0, remainder)); },
+                     [&]() { own(buffer_bloom_filter).insert(points.cut(0, remainder)); });
 #else
-      buffer_tree.insert(points.cut(0, remainder));
+      own(buffer_tree).insert(points.cut(0, remainder));
 #endif
+      if constexpr (hasId<objT>::value) locateTree(-1);  // the buffer tree
     };
     // use the simulated moves above to construct new trees
     auto rebuild_static_f = [&](size_t i) {
-      const auto& [uses_buffer, points_start, points_end, trees, new_tree] = moves[i];
-      auto num_points = points_end - points_start;
+      auto new_tree = std::get<4>(moves[i]);
 
       // gather items
-      parlay::sequence<objT> cur_items;
-
-      // compute where each set of elements goes into [cur_items]
-      parlay::sequence<size_t> gather_endpoints;
-      gather_endpoints.resize(1 + trees.size() + 1 + (uses_buffer ? 1 : 0));
-      int cur_idx = 0;
-      gather_endpoints[cur_idx++] = 0;                          // left endpoint
-      for (int j = 0; j < (int)trees.size(); j++, cur_idx++) {  // tree endpoints
-        gather_endpoints[cur_idx] = static_trees[trees[j]].size() + gather_endpoints[cur_idx - 1];
-      }
-      gather_endpoints[cur_idx] = num_points + gather_endpoints[cur_idx - 1];
-      cur_idx++;
-      if (uses_buffer) {
-        gather_endpoints[cur_idx] = buffer_points.size() + gather_endpoints[cur_idx - 1];
-        cur_idx++;
-      }
-      cur_items.resize(gather_endpoints[cur_idx - 1]);  // the full size
-
-      // construct the elements
-      auto construct_points = [&](size_t idx) {
-        if (idx == trees.size() + 1) {
-          // move buffer
-          assert(gather_endpoints[idx + 1] - gather_endpoints[idx] == buffer_points.size());
-          auto move_buffer_f = [&](size_t j) {
-            cur_items[j + gather_endpoints[idx]] = buffer_points[j];
-          };
-
-          if (parallel) {
-            parlay::parallel_for(0, buffer_points.size(), move_buffer_f);
-          } else {
-            for (size_t j = 0; j < buffer_points.size(); j++)
-              move_buffer_f(j);
-          }
-        } else if (idx == trees.size()) {
-          // move points
-          assert(gather_endpoints[idx + 1] - gather_endpoints[idx] == num_points);
-          auto move_points_f = [&](size_t j) {
-            cur_items[j + gather_endpoints[idx]] = points[j + points_start];
-          };
-
-          if (parallel) {
-            parlay::parallel_for(0, num_points, move_points_f);
-          } else {
-            for (size_t j = 0; j < num_points; j++)
-              move_points_f(j);
-          }
-        } else {
-          // [0, num_trees) -> move a tree
-          auto tree_idx = trees[idx];
-          assert(((int)tree_idx < new_tree));
-          assert(gather_endpoints[idx + 1] - gather_endpoints[idx] ==
-                 static_trees[tree_idx].size());
-          static_trees[tree_idx].moveElementsTo(
-              cur_items.cut(gather_endpoints[idx], gather_endpoints[idx + 1]));
-        }
-      };
+      auto cur_items = gatherMove(moves[i], points, buffer_points, true);
 
-      if (parallel) {
-        parlay::parallel_for(0, gather_endpoints.size() - 1, construct_points);
-      } else {
-        for (size_t idx = 0; idx < gather_endpoints.size() - 1; idx++)
-          construct_points(idx);
-      }
       //#if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
       // if (new_tree == 16) {
       // std::cout << "(16) Point Gather: " << t.get_next() << "\n";
@@ -338,21 +208,24 @@ class LogTree {
       //#endif
 
       // construct the new tree
-      assert(static_trees[new_tree].empty());
+      assert(!static_trees[new_tree]);
+      auto& new_static_tree = ownTree(new_tree);
       DEBUG_MSG("CONSTRUCTING TREE[" << new_tree << "]: " << cur_items.size() << " items");
 
 #ifdef LOGTREE_USE_BLOOM
+      auto& new_bloom_filter = *static_bloom_filters[new_tree];
 #ifdef BLOOM_FILTER_BUILD_COPY
       auto items_copy = cur_items;
-      parlay::par_do([&]() { static_trees[new_tree].build(std::move(cur_items)); },
-                     [&]() { static_bloom_filters[new_tree].build(items_copy); });
+      parlay::par_do([&]() { new_static_tree.build(std::move(cur_items)); },
+                     [&]() { new_bloom_filter.build(items_copy); });
 #else
-      static_trees[new_tree].build(std::move(cur_items));
-      static_bloom_filters[new_tree].build(static_trees[new_tree].items);
+      new_static_tree.build(std::move(cur_items));
+      new_bloom_filter.build(*new_static_tree.items);
 #endif
 #else
-      static_trees[new_tree].build(std::move(cur_items));
+      new_static_tree.build(std::move(cur_items));
 #endif
+      if constexpr (hasId<objT>::value) locateTree(new_tree);
 
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
       std::cout << "[Insert] Tree[" << new_tree << "] Construction Time: " << t.get_next() << "\n";
@@ -395,25 +268,27 @@ class LogTree {
 
   template <bool bulk, class R>
   void erase(const R& points) {
+    finishRebuild();
     constexpr int BUFFER_TREE_IDX = -1;
     auto tree_ids = gatherFullTrees();
     // PHASE 1: Erase points from trees ----------------------
     auto erase_from_tree = [&](size_t tid) {
-      // DEBUG_MSG("Erasing from tree " << i << "/" << NUM_TREES);
+      // DEBUG_MSG("Erasing from tree " << i << "/" << static_trees.size());
       auto i = tree_ids[tid];
 
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_DELETE_TIMINGS)
       timer t("[Delete]");
 #endif
 
-      parlay::sequence<pointT> to_erase;
+      // only the points inside the tree's root bbox can be in it: a localized batch skips most
+      // of the trees, and the Bloom filter only sees the points that survive the bbox
+      auto to_erase = parlay::filter(points, [&](const objT& p) { return inRootBox(i, p); });
+      if (to_erase.size() == 0) return;
 #ifdef LOGTREE_USE_BLOOM
       if (i == BUFFER_TREE_IDX)
-        to_erase = buffer_bloom_filter.filter(points);
+        to_erase = buffer_bloom_filter->filter(to_erase);
       else
-        to_erase = static_bloom_filters[i].filter(points);
-#else
-      to_erase = points;
+        to_erase = static_bloom_filters[i]->filter(to_erase);
 #endif
 
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_DELETE_TIMINGS)
@@ -424,21 +299,21 @@ class LogTree {
 
       if (bulk) {
         if (i == BUFFER_TREE_IDX) {
-          buffer_tree.template bulk_erase<false>(to_erase);
+          forkBuffer().template bulk_erase<false>(to_erase);
 #ifdef ERASE_SEARCH_TIMES
-          total_search_time += buffer_tree.total_search_time;
+          total_search_time += buffer_tree->total_search_time;
 #endif
         } else {
-          static_trees[i].template bulk_erase<false>(to_erase);
+          ownTree(i).template bulk_erase<false>(to_erase);
 #ifdef ERASE_SEARCH_TIMES
-          total_search_time += static_trees[i].total_search_time;
+          total_search_time += static_trees[i]->total_search_time;
 #endif
         }
       } else {
         if (i == BUFFER_TREE_IDX) {
-          buffer_tree.template erase<true>(to_erase);
+          forkBuffer().template erase<true>(to_erase);
         } else {
-          static_trees[i].template erase<true>(to_erase);
+          ownTree(i).template erase<true>(to_erase);
         }
       }
 
@@ -457,28 +332,543 @@ class LogTree {
     }
 
     // PHASE 2: Collect all depleted trees
+    pushDownDepletedTrees();
+  }
+
+  template <class R>
+  void bulk_erase(const R& points) {
+    erase<true, R>(points);
+  }
+
+  /*!
+   * Erase the points with the given IDs (objT with an [id], see shared/idpoint.h). Each ID is
+   * looked up in the ID locator, so only the trees and leaves holding the points are touched, and
+   * their [present] flags are cleared directly, without searching by coordinates. Unknown or
+   * already erased IDs are ignored.
+   */
+  template <class R>
+  void eraseById(const R& ids) {
+    static_assert(hasId<objT>::value, "eraseById needs an objT with an [id] member");
+    finishRebuild();
+    constexpr int BUFFER_TREE_IDX = -1;
+
+    // PHASE 1: locate the live points, as (tree + 1, slot) keys sorted by tree, then slot
+    auto live_id = [&](int tree_id, uint32_t slot) -> uint64_t {  // ID at a live slot
+      auto live = [&](const auto& tree) {
+        return tree.present[slot] ? (uint64_t)tree.items[slot].id : UINT64_MAX;
+      };
+      if (tree_id == BUFFER_TREE_IDX) return live(*buffer_tree);
+      return live(*static_trees[tree_id]);
+    };
+    auto built_size = [&](int tree_id) -> size_t {
+      if (tree_id == BUFFER_TREE_IDX) return buffer_tree->get_build_size();
+      return nth_bit_set(tree_mask, tree_id) ? static_trees[tree_id]->get_build_size() : 0;
+    };
+    auto locate = [&](size_t i) -> uint64_t {
+      auto id = ids[i];
+      if ((size_t)id >= id_locator.size()) return UINT64_MAX;  // never inserted
+      auto loc = id_locator[id];
+      if (loc.tree == NO_TREE || loc.slot >= built_size(loc.tree)) return UINT64_MAX;
+      if (live_id(loc.tree, loc.slot) != (uint64_t)id) return UINT64_MAX;  // stale
+      return ((uint64_t)(loc.tree + 1) << 32) | loc.slot;
+    };
+    auto keys = parlay::filter(parlay::delayed_seq<uint64_t>(ids.size(), locate),
+                               [](uint64_t key) { return key != UINT64_MAX; });
+    if (parallel) {
+      parlay::sort_inplace(keys);
+    } else {
+      std::sort(keys.begin(), keys.end());
+    }
+    auto slots = parlay::map(keys, [](uint64_t key) { return (uint32_t)key; });
+
+    // PHASE 2: erase the slots of each tree
+    int num_trees = (int)static_trees.size();
+    parlay::sequence<size_t> tree_starts(num_trees + 2);
+    for (int t = 0; t <= num_trees + 1; t++) {
+      tree_starts[t] = std::lower_bound(keys.begin(), keys.end(), (uint64_t)t << 32) - keys.begin();
+    }
+    auto erase_from_tree = [&](size_t t) {  // t = tree + 1
+      auto tree_slots = slots.cut(tree_starts[t], tree_starts[t + 1]);
+      if (tree_slots.size() == 0) return;
+      if (t == 0) {
+        forkBuffer().bulk_erase_slots(tree_slots);
+      } else {
+        ownTree(t - 1).bulk_erase_slots(tree_slots);
+      }
+    };
+    if (parallel) {
+      parlay::parallel_for(0, num_trees + 1, erase_from_tree, 1);
+    } else {
+      for (int t = 0; t < num_trees + 1; t++)
+        erase_from_tree(t);
+    }
+
+    // PHASE 3: Collect all depleted trees
+    pushDownDepletedTrees();
+  }
+
+  // <buffer, points_start, points_end, gather trees, new tree>: static tree [new tree] is built
+  // over [points_start, points_end) of the inserted points, the trees [gather trees] and, if
+  // [buffer], the buffer tree
+  typedef std::tuple<bool, size_t, size_t, parlay::sequence<int>, int> moveT;
+  struct InsertPlan {
+    parlay::sequence<moveT> moves;
+    size_t remainder;  // the first [remainder] inserted points go to the buffer
+    bool uses_buffer;  // whether a move takes the buffer's points
+    uint64_t new_tree_mask;
+  };
+
+  // Simulate the insertion of [num_points] points: which static trees get built from what
+  InsertPlan planInsert(size_t num_points) const {
+    // compute number of moving elements in terms of buffers
+    int full_buffers = (int)(num_points / buffer_size);
+    int remainder = (int)(num_points % buffer_size);
+    bool use_buffer = false;
+
+    // check if buffer is involved
+    if (remainder + buffer_tree->size() > buffer_size) {
+      full_buffers++;
+      remainder = (remainder + buffer_tree->size()) - buffer_size;
+      use_buffer = true;
+    }
+
+    DEBUG_MSG("Inserting " << num_points << " points");
+    DEBUG_MSG("full buffers, remainder, use_buffer = " << full_buffers << ", " << remainder << ", "
+                                                       << (use_buffer ? "true" : "false"));
+
+    // simulate which trees to gather
+    parlay::sequence<moveT> moves;
+    auto cur_points_end = num_points;
+    bool have_used_buffer = false;
+    auto new_tree_mask = tree_mask + full_buffers;
+    auto num_trees = num_levels(new_tree_mask);
+    DEBUG_MSG(treeMaskToString(tree_mask, num_trees)
+              << "\n"
+              << treeMaskToString(new_tree_mask, num_trees));
+
+    // the largest new tree must still fit in a KdTree
+    if (num_trees > 0 && nth_tree_log2size(num_trees - 1) > MAX_TREE_LOG2_SIZE)
+      throw std::runtime_error("LogTree is full: static trees are limited to 2^" +
+                               std::to_string(MAX_TREE_LOG2_SIZE) + " points");
+
+    for (int i = num_trees - 1; i >= 0;) {
+      if (nth_bit_set(new_tree_mask, i) && !nth_bit_set(tree_mask, i)) {
+        DEBUG_MSG("New Tree: " << i);
+        // tree [i] was not filled before but is now
+
+        // gather all the smaller trees
+        parlay::sequence<int> to_gather;
+        size_t size_gathered = 0;
+        int j = i - 1;
+        while (j >= 0) {
+          if (nth_bit_set(new_tree_mask, j)) {
+            if (nth_bit_set(tree_mask, j)) {
+              DEBUG_MSG(" - Skipping Tree (11)" << j);
+            } else {
+              break;
+            }
+
+          } else {
+            if (nth_bit_set(tree_mask, j)) {
+              DEBUG_MSG(" - Gathering Tree " << j);
+              to_gather.push_back(j);
+              size_gathered += nth_tree_size(j);
+            } else {
+              DEBUG_MSG(" - Skipping Tree (00)" << j);
+            }
+          }
+          j--;
+        }
+
+        auto num_from_points = nth_tree_size(i) - size_gathered;
+        full_buffers -= (num_from_points / buffer_size);
+        DEBUG_MSG("num_from_points: " << num_from_points);
+
+        bool cur_uses_buffer = false;
+        if (use_buffer && (full_buffers == 0)) {
+          assert(!have_used_buffer);
+          have_used_buffer = true;
+          DEBUG_MSG(" - Gathering Buffer Tree ");
+          cur_uses_buffer = true;
+          num_from_points -= buffer_tree->size();  // we moved buffer tree in
+        }
+
+        auto cur_points_start = cur_points_end - num_from_points;
+        DEBUG_MSG("MOVE: [uses_buffer, point start, point end, trees, new tree] = ["
+                  << (cur_uses_buffer ? "true" : "false") << ", " << cur_points_start << ", "
+                  << cur_points_end << ", " << seq_to_str(to_gather) << ", " << i << "]");
+        moves.push_back(
+            {cur_uses_buffer, cur_points_start, cur_points_end, std::move(to_gather), i});
+
+        // reset counters
+        cur_points_end = cur_points_start;
+        i = j;
+      } else {  // otherwise, should be the same
+        assert(nth_bit_set(new_tree_mask, i) == nth_bit_set(tree_mask, i));
+        i--;
+      }
+    }
+    assert(cur_points_end == (size_t)remainder);
+    assert(full_buffers == 0);
+    return {std::move(moves), (size_t)remainder, have_used_buffer, new_tree_mask};
+  }
+
+  // Gather the points that static tree [new tree] of [move] gets built over: the live points of
+  // its source trees, its range of [points] and, if it uses the buffer, [buffer_points]. The
+  // source trees are emptied if [take], and only read otherwise.
+  template <class R>
+  parlay::sequence<objT> gatherMove(const moveT& move,
+                                    const R& points,
+                                    const parlay::sequence<objT>& buffer_points,
+                                    bool take) {
+    auto uses_buffer = std::get<0>(move);
+    auto points_start = std::get<1>(move);
+    auto num_points = std::get<2>(move) - points_start;
+    const auto& trees = std::get<3>(move);
+    [[maybe_unused]] auto new_tree = std::get<4>(move);
+
+    parlay::sequence<objT> cur_items;
+
+    // compute where each set of elements goes into [cur_items]
+    parlay::sequence<size_t> gather_endpoints;
+    gather_endpoints.resize(1 + trees.size() + 1 + (uses_buffer ? 1 : 0));
+    int cur_idx = 0;
+    gather_endpoints[cur_idx++] = 0;                          // left endpoint
+    for (int j = 0; j < (int)trees.size(); j++, cur_idx++) {  // tree endpoints
+      gather_endpoints[cur_idx] = static_trees[trees[j]]->size() + gather_endpoints[cur_idx - 1];
+    }
+    gather_endpoints[cur_idx] = num_points + gather_endpoints[cur_idx - 1];
+    cur_idx++;
+    if (uses_buffer) {
+      gather_endpoints[cur_idx] = buffer_points.size() + gather_endpoints[cur_idx - 1];
+      cur_idx++;
+    }
+    cur_items.resize(gather_endpoints[cur_idx - 1]);  // the full size
+
+    // construct the elements
+    auto construct_points = [&](size_t idx) {
+      if (idx == trees.size() + 1) {
+        // move buffer
+        assert(gather_endpoints[idx + 1] - gather_endpoints[idx] == buffer_points.size());
+        auto move_buffer_f = [&](size_t j) {
+          cur_items[j + gather_endpoints[idx]] = buffer_points[j];
+        };
+
+        if (parallel) {
+          parlay::parallel_for(0, buffer_points.size(), move_buffer_f);
+        } else {
+          for (size_t j = 0; j < buffer_points.size(); j++)
+            move_buffer_f(j);
+        }
+      } else if (idx == trees.size()) {
+        // move points
+        assert(gather_endpoints[idx + 1] - gather_endpoints[idx] == num_points);
+        auto move_points_f = [&](size_t j) {
+          cur_items[j + gather_endpoints[idx]] = points[j + points_start];
+        };
+
+        if (parallel) {
+          parlay::parallel_for(0, num_points, move_points_f);
+        } else {
+          for (size_t j = 0; j < num_points; j++)
+            move_points_f(j);
+        }
+      } else {
+        // [0, num_trees) -> move (or copy) a tree
+        auto tree_idx = trees[idx];
+        assert(((int)tree_idx < new_tree));
+        assert(gather_endpoints[idx + 1] - gather_endpoints[idx] ==
+               static_trees[tree_idx]->size());
+        auto dest = cur_items.cut(gather_endpoints[idx], gather_endpoints[idx + 1]);
+        static_trees[tree_idx]->copyElementsTo(dest);
+        if (take) clearTree(tree_idx);
+      }
+    };
+
+    if (parallel) {
+      parlay::parallel_for(0, gather_endpoints.size() - 1, construct_points);
+    } else {
+      for (size_t idx = 0; idx < gather_endpoints.size() - 1; idx++)
+        construct_points(idx);
+    }
+    return cur_items;
+  }
+
+ private:
+  // COPY-ON-WRITE ----------------------------------
+  struct SnapshotTag {};
+  LogTree(const LogTree& other, SnapshotTag)
+      : buffer_log2_size(other.buffer_log2_size),
+        buffer_size(other.buffer_size),
+        tree_mask(other.tree_mask),
+        buffer_tree(other.buffer_tree),
+#ifdef LOGTREE_USE_BLOOM
+        buffer_bloom_filter(other.buffer_bloom_filter),
+#endif
+        static_trees(other.static_trees)
+#ifdef LOGTREE_USE_BLOOM
+        ,
+        static_bloom_filters(other.static_bloom_filters)
+#endif
+  {
+  }
+
+  std::shared_ptr<staticTree> newStaticTree(int tree_id) const {
+#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
+    return std::make_shared<staticTree>(nth_tree_log2size(tree_id));
+#elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
+    return std::make_shared<staticTree>(nth_tree_log2size(tree_id), false);
+#endif
+  }
+
+  // [ptr]'s object, for modification: if a snapshot shares it, [ptr] is first pointed at a copy
+  template <class T>
+  static T& own(std::shared_ptr<T>& ptr) {
+    if (ptr.use_count() > 1) ptr = std::make_shared<T>(std::as_const(*ptr));
+    return *ptr;
+  }
+  // The buffer tree, for erasing from: a buffer a snapshot shares is forked, like a static tree
+  // (see [ownTree]), and the fork copies its points only if it is inserted into later
+  dynamicTree& forkBuffer() {
+    if (buffer_tree.use_count() > 1) {
+      buffer_tree = std::make_shared<dynamicTree>(*buffer_tree, typename dynamicTree::ForkTag{});
+    }
+    return *buffer_tree;
+  }
+  // Empty the buffer tree (and its filter): a buffer a snapshot shares is left to it and replaced
+  // by an empty one rather than copied
+  void clearBuffer() {
+    if (buffer_tree.use_count() > 1) {
+      buffer_tree = std::make_shared<dynamicTree>(buffer_log2_size, true);
+    } else {
+      buffer_tree->clear();
+    }
+#ifdef LOGTREE_USE_BLOOM
+    if (buffer_bloom_filter.use_count() > 1) {
+      buffer_bloom_filter = std::make_shared<BloomFilterT>(buffer_size);
+    } else {
+      buffer_bloom_filter->clear();
+    }
+#endif
+  }
+  // Empty the buffer tree, returning its points
+  parlay::sequence<objT> takeBuffer() {
+    parlay::sequence<objT> points(buffer_tree->size());
+    buffer_tree->copyElementsTo(points.cut(0, points.size()));
+    clearBuffer();
+    return points;
+  }
+  // Static tree [i], for modification; a tree (and its filter) is allocated when level [i] fills.
+  // Static trees are only erased from once built, so a tree a snapshot shares is forked rather
+  // than copied: the fork shares its points and nodes and copies only the pages of liveness bits
+  // and live counts that the erase touches (see [KdTree::ForkTag]).
+  staticTree& ownTree(int i) {
+    if (!static_trees[i]) {
+      static_trees[i] = newStaticTree(i);
+#ifdef LOGTREE_USE_BLOOM
+      static_bloom_filters[i] = std::make_shared<BloomFilterT>(nth_tree_size(i));
+#endif
+      return *static_trees[i];
+    }
+    if (static_trees[i].use_count() > 1) {
+      static_trees[i] =
+          std::make_shared<staticTree>(*static_trees[i], typename staticTree::ForkTag{});
+    }
+    return *static_trees[i];
+  }
+  // Empty static tree [i] (after copying its elements out): its storage is released, or left to
+  // the snapshots that share it
+  void clearTree(int i) {
+    static_trees[i].reset();
+#ifdef LOGTREE_USE_BLOOM
+    static_bloom_filters[i].reset();
+#endif
+  }
+  // Add the levels up to the highest set bit of [mask], still empty
+  void growLevels(uint64_t mask) {
+    size_t n = num_levels(mask);
+    if (n <= static_trees.size()) return;
+    static_trees.resize(n);
+#ifdef LOGTREE_USE_BLOOM
+    static_bloom_filters.resize(n);
+#endif
+  }
+
+  // ASYNC REBUILDS ---------------------------------
+  // A static tree built by [insertAsync] off to the side, before it replaces static tree [tree_id]
+  struct StagedTree {
+    int tree_id;
+    std::shared_ptr<staticTree> tree;
+#ifdef LOGTREE_USE_BLOOM
+    std::shared_ptr<BloomFilterT> bloom_filter;
+#endif
+  };
+  struct PendingInsert {
+    parlay::sequence<objT> points;  // a copy of the inserted points
+    InsertPlan plan;
+    std::vector<StagedTree> staged;  // one per move of [plan]
+  };
+  std::unique_ptr<PendingInsert> pending_insert;
+  std::future<void> rebuild_task;  // builds [pending_insert->staged], unless it is built in place
+
+  // Plan an [insertAsync] of [points] into [pending_insert] and return true; an insert that only
+  // fills the buffer is done right away instead, and returns false
+  template <class R>
+  bool stageInsert(const R& points) {
+    finishRebuild();
+    auto plan = planInsert(points.size());
+    if (plan.moves.empty()) {
+      insert(points);
+      return false;
+    }
+    pending_insert = std::make_unique<PendingInsert>();
+    pending_insert->points =
+        parlay::tabulate(points.size(), [&](size_t i) -> objT { return points[i]; });
+    pending_insert->plan = std::move(plan);
+    return true;
+  }
+
+  // Build the trees of [pending]'s moves from copies of their points; the live trees are only read
+  void buildStagedTrees(PendingInsert& pending) {
+    const auto& moves = pending.plan.moves;
+    parlay::sequence<objT> buffer_points;
+    if (pending.plan.uses_buffer) {
+      buffer_points.resize(buffer_tree->size());
+      buffer_tree->copyElementsTo(buffer_points.cut(0, buffer_points.size()));
+    }
+
+    pending.staged.resize(moves.size());
+    auto build_staged_f = [&](size_t i) {
+      auto& staged = pending.staged[i];
+      staged.tree_id = std::get<4>(moves[i]);
+      staged.tree = newStaticTree(staged.tree_id);
+      staged.tree->build(gatherMove(moves[i], pending.points, buffer_points, false));
+#ifdef LOGTREE_USE_BLOOM
+      staged.bloom_filter = std::make_shared<BloomFilterT>(nth_tree_size(staged.tree_id));
+      staged.bloom_filter->build(*staged.tree->items);
+#endif
+    };
+    if (parallel) {
+      parlay::parallel_for(0, moves.size(), build_staged_f, 1);
+    } else {
+      for (size_t i = 0; i < moves.size(); i++)
+        build_staged_f(i);
+    }
+  }
+
+ public:
+  /*!
+   * Insert [points] without stalling on the static-tree rebuilds they trigger: the new trees are
+   * built by a background task from copies of their points, while the LogTree keeps answering
+   * queries with the trees as they were before this call. The points become visible when
+   * [finishRebuild] swaps the new trees in. Every update calls it first, so at most one rebuild is
+   * in flight; updates and [finishRebuild] must not run concurrently with queries (a
+   * ConcurrentLogTree, see concurrent.h, publishes each version as an atomically swapped snapshot
+   * and reclaims the old trees once no reader holds them). Inserts that only fill the buffer are
+   * done right away.
+   * Serial trees only: the build runs on a std::async thread, which is not a parlay worker, so it
+   * must not fork parlay work. Parallel trees use the overload below.
+   */
+  template <class R>
+  void insertAsync(const R& points) {
+    static_assert(!parallel, "insertAsync builds off parlay's scheduler; use a serial LogTree");
+    if (stageInsert(points)) {
+      rebuild_task =
+          std::async(std::launch::async, [this]() { buildStagedTrees(*pending_insert); });
+    }
+  }
+
+  /*!
+   * Insert [points], running [during](version) while the static-tree rebuilds they trigger are
+   * built: [version] is this LogTree as it was before the call (a const LogTree&), which [during]
+   * keeps querying, e.g. to bound query latency while a large batch is ingested. The build and
+   * [during] are forked with parlay::par_do, so this works for parallel trees too; the new trees
+   * are published by [finishRebuild] once both are done, before this returns. [during] must not
+   * update the LogTree or take a [snapshot] of it. Inserts that only fill the buffer are done right
+   * away, and [during] then sees them.
+   */
+  template <class R, class F>
+  void insertAsync(const R& points, F during) {
+    if (stageInsert(points)) {
+      parlay::par_do([&]() { buildStagedTrees(*pending_insert); },
+                     [&]() { during(std::as_const(*this)); });
+    } else {
+      during(std::as_const(*this));
+    }
+    finishRebuild();
+  }
+
+  /*!
+   * Whether an [insertAsync] is waiting for [finishRebuild].
+   */
+  bool rebuildPending() const { return pending_insert != nullptr; }
+
+  /*!
+   * Wait for the rebuild started by [insertAsync], if any, and publish it: the new static trees
+   * replace the trees they were gathered from, and the remaining points go to the buffer. The old
+   * trees are freed here, or once the last snapshot sharing them is gone.
+   */
+  void finishRebuild() {
+    if (!pending_insert) return;
+    if (rebuild_task.valid()) rebuild_task.get();
+    auto pending = std::move(pending_insert);
+    const auto& points = pending->points;
+    const auto& plan = pending->plan;
+    if constexpr (hasId<objT>::value) growIdLocator(points);
+    growLevels(plan.new_tree_mask);
+
+    for (const auto& move : plan.moves) {
+      for (auto tree_id : std::get<3>(move))
+        clearTree(tree_id);
+    }
+    for (auto& staged : pending->staged) {
+      assert(!static_trees[staged.tree_id]);
+      static_trees[staged.tree_id] = std::move(staged.tree);
+#ifdef LOGTREE_USE_BLOOM
+      static_bloom_filters[staged.tree_id] = std::move(staged.bloom_filter);
+#endif
+      if constexpr (hasId<objT>::value) locateTree(staged.tree_id);
+    }
+    if (plan.uses_buffer) clearBuffer();  // the staged trees hold copies of its points
+    if (plan.remainder > 0) {
+      own(buffer_tree).insert(points.cut(0, plan.remainder));
+#ifdef LOGTREE_USE_BLOOM
+      own(buffer_bloom_filter).insert(points.cut(0, plan.remainder));
+#endif
+      if constexpr (hasId<objT>::value) locateTree(-1);  // the buffer tree
+    }
+    tree_mask = plan.new_tree_mask;
+
+    pushDownDepletedTrees();
+  }
+
+  // Move the points of static trees that are at most half full back through [insert]
+  void pushDownDepletedTrees() {
     // compute depleted trees
     parlay::sequence<size_t> gather_points;
     parlay::sequence<int> depleted_trees;
     auto new_tree_mask = tree_mask;
     gather_points.push_back(0);  // initialize
-    for (int i = 0; i < NUM_TREES; i++) {
-      if (static_trees[i].size() <= nth_tree_size(i) / 2) {
+    for (int i = 0; i < (int)static_trees.size(); i++) {
+      if (!nth_bit_set(tree_mask, i)) continue;
+      if (static_trees[i]->size() <= nth_tree_size(i) / 2) {
         // need to push down
         depleted_trees.push_back(i);
-        gather_points.push_back(gather_points.back() + static_trees[i].size());
+        gather_points.push_back(gather_points.back() + static_trees[i]->size());
         unset_nth_bit(new_tree_mask, i);
       }
     }
+    if (depleted_trees.empty()) return;
     tree_mask = new_tree_mask;
 
     // gather depleted trees
     parlay::sequence<objT> points_to_move(gather_points.back());
     auto gather_tree = [&](size_t i) {
       auto tree_idx = depleted_trees[i];
-      assert(static_trees[tree_idx].size() == gather_points[i + 1] - gather_points[i]);
-      static_trees[tree_idx].moveElementsTo(
+      assert(static_trees[tree_idx]->size() == gather_points[i + 1] - gather_points[i]);
+      static_trees[tree_idx]->copyElementsTo(
           points_to_move.cut(gather_points[i], gather_points[i + 1]));
+      clearTree(tree_idx);
     };
     if (parallel) {
       parlay::parallel_for(0, depleted_trees.size(), gather_tree);
@@ -491,11 +881,6 @@ class LogTree {
     insert(points_to_move);
   }
 
-  template <class R>
-  void bulk_erase(const R& points) {
-    erase<true, R>(points);
-  }
-
   /*
   // TODO: deduplicate points in bulk erase
   template <bool bulk>
@@ -504,21 +889,21 @@ class LogTree {
     parlay::sequence<int> delete_counts(NUM_TREES + 1);
 
     auto erase_from_tree = [&](size_t i) {
-      auto orig_size = (i == NUM_TREES) ? buffer_tree.size() : static_trees[i].size();
+      auto orig_size = (i == NUM_TREES) ? buffer_tree->size() : static_trees[i]->size();
       if (bulk) {
         if (i == NUM_TREES) {
-          buffer_tree.template bulk_erase<false>(points);
+          buffer_tree->template bulk_erase<false>(points);
         } else {
-          static_trees[i].template bulk_erase<false>(points);
+          static_trees[i]->template bulk_erase<false>(points);
         }
       } else {
         if (i == NUM_TREES) {
-          buffer_tree.template erase<true>(points);
+          buffer_tree->template erase<true>(points);
         } else {
-          static_trees[i].template erase<true>(points);
+          static_trees[i]->template erase<true>(points);
         }
       }
-      auto new_size = (i == NUM_TREES) ? buffer_tree.size() : static_trees[i].size();
+      auto new_size = (i == NUM_TREES) ? buffer_tree->size() : static_trees[i]->size();
       delete_counts[i] = orig_size - new_size;
     };
 
@@ -551,7 +936,7 @@ class LogTree {
       if (!nth_bit_set(new_tree_mask, i)) continue;
       if (delete_counts[i] == 0) continue;
 
-      auto new_size = static_trees[i].size();
+      auto new_size = static_trees[i]->size();
       if (new_size > nth_tree_size(i) / 2) {
 #ifndef NDEBUG
         changes.emplace_back(NORMAL_ERASE, i);  // only record a normal erase for debugging
@@ -559,7 +944,7 @@ class LogTree {
       } else {
         if (i == 0) {                               // special case: have to think about buffer tree
           auto cutoff = BUFFER_SIZE - new_size;     // how much tree 0 needs to be full
-          if ((int)buffer_tree.size() <= cutoff) {  // buffer doesn't have enough -> move 0 down
+          if ((int)buffer_tree->size() <= cutoff) {  // buffer doesn't have enough -> move 0 down
             changes.emplace_back(MOVE_DOWN, i);
             unset_nth_bit(new_tree_mask, i);
           } else {  // buffer has enough -> move enough up to fill 0
@@ -598,7 +983,7 @@ class LogTree {
                   << ((p.second >= 0) ? nth_tree_size(p.second) : BUFFER_SIZE) << " points"
                   << std::endl;
       } else if (p.first == MOVE_DOWN) {
-        auto new_size = static_trees[p.second].size();
+        auto new_size = static_trees[p.second]->size();
         auto cur_size = new_size + delete_counts[p.second];
         auto full_size = nth_tree_size(p.second);
         std::cout << "MOVE_DOWN[" << p.second << " -> " << p.second - 1 << "]: " << cur_size
@@ -618,17 +1003,17 @@ class LogTree {
       } else if (p.first == MOVE_DOWN) {
         assert((p.second >= 0) && (p.second < NUM_TREES));
         // pull the elements out
-        parlay::sequence<objT> items_to_move(static_trees[p.second].size());
+        parlay::sequence<objT> items_to_move(static_trees[p.second]->size());
         [[maybe_unused]] auto num_moved =
-            static_trees[p.second].moveElementsTo(items_to_move.cut(0, items_to_move.size()));
+            static_trees[p.second]->moveElementsTo(items_to_move.cut(0, items_to_move.size()));
         assert(num_moved == items_to_move.size());
         if (p.second == 0) {
-          assert(buffer_tree.size() + items_to_move.size() <= BUFFER_SIZE);
+          assert(buffer_tree->size() + items_to_move.size() <= BUFFER_SIZE);
           const auto& const_items = items_to_move;
-          buffer_tree.insert(const_items.cut(0, const_items.size()));
+          buffer_tree->insert(const_items.cut(0, const_items.size()));
         } else {
-          assert(static_trees[p.second - 1].empty());
-          static_trees[p.second - 1].build(std::move(items_to_move));
+          assert(static_trees[p.second - 1]->empty());
+          static_trees[p.second - 1]->build(std::move(items_to_move));
         }
       } else {  // need to gather all the points
         // PHASE 1: compute size to move (serial because <= NUM_TREES trees total) -------
@@ -640,7 +1025,7 @@ class LogTree {
           if (idx == DYNAMIC_BUFFER) {
             to_add = move_from_buffer;
           } else {
-            to_add = static_trees[idx].size();
+            to_add = static_trees[idx]->size();
           }
           move_offsets[idx - p.first + 1] = move_offsets[idx - p.first] + to_add;
         }
@@ -653,13 +1038,13 @@ class LogTree {
           int idx = (int)i - 1;
           if (idx == DYNAMIC_BUFFER) {
             // get buffer elements
-            parlay::sequence<objT> buffer_items(buffer_tree.size());
-            buffer_tree.moveElementsTo(buffer_items.cut(0, buffer_items.size()));
+            parlay::sequence<objT> buffer_items(buffer_tree->size());
+            buffer_tree->moveElementsTo(buffer_items.cut(0, buffer_items.size()));
 
             auto leave_behind = [&]() {
               // leave behind the extra elements
               const auto& const_buffer_items = buffer_items;
-              buffer_tree.insert(const_buffer_items.cut(move_from_buffer, buffer_items.size()));
+              buffer_tree->insert(const_buffer_items.cut(move_from_buffer, buffer_items.size()));
             };
 
             auto keep = [&]() {
@@ -680,8 +1065,8 @@ class LogTree {
           } else {
             // gather the points
             assert(move_offsets[idx - p.first + 1] ==
-                   move_offsets[idx - p.first] + static_trees[idx].size());
-            static_trees[idx].moveElementsTo(
+                   move_offsets[idx - p.first] + static_trees[idx]->size());
+            static_trees[idx]->moveElementsTo(
                 items_to_move.cut(move_offsets[idx - p.first], move_offsets[idx - p.first + 1]));
           }
         };
@@ -695,7 +1080,7 @@ class LogTree {
         }
 
         // move the elements
-        static_trees[p.second].build(std::move(items_to_move));
+        static_trees[p.second]->build(std::move(items_to_move));
       }
     };
 
@@ -713,78 +1098,323 @@ class LogTree {
 
   // QUERY -----------------------------------------
   bool contains(const objT& p) const {
+    constexpr int BUFFER_TREE_IDX = -1;
+    // only the non-empty trees whose root bbox holds [p]
+    auto tree_contains = [&](int tree_id) {
+      if (!inRootBox(tree_id, p)) return false;
+      if (tree_id == BUFFER_TREE_IDX) return buffer_tree->contains(p);
+      return static_trees[tree_id]->contains(p);
+    };
+    auto tree_ids = gatherFullTrees();
     if (parallel) {
-      parlay::sequence<bool> res(NUM_TREES + 1);
-      parlay::parallel_for(0, NUM_TREES + 1, [&](size_t i) {
-        if (i == NUM_TREES) {
-          res[i] = buffer_tree.contains(p);
-        } else {
-          res[i] = static_trees[i].contains(p);
-        }
-      });
+      parlay::sequence<bool> res(tree_ids.size());
+      parlay::parallel_for(
+          0, tree_ids.size(), [&](size_t t) { res[t] = tree_contains(tree_ids[t]); });
 
       // extract the result
       for (const auto& b : res)
         if (b) return true;
       return false;
     } else {
-      if (buffer_tree.contains(p)) return true;
-      for (int i = 0; i < NUM_TREES; i++)
-        if (static_trees[i].contains(p)) return true;
+      for (auto tree_id : tree_ids)
+        if (tree_contains(tree_id)) return true;
       return false;
     }
   }
 
   parlay::sequence<objT> orthogonalQuery(const objT& qMin, const objT& qMax) const {
-    if (parallel) {
-      parlay::sequence<parlay::sequence<objT>> res(NUM_TREES + 1);
-      parlay::parallel_for(0, NUM_TREES + 1, [&](size_t i) {
-        if (i == NUM_TREES) {
-          res[i] = buffer_tree.orthogonalQuery(qMin, qMax);
-        } else {
-          res[i] = static_trees[i].orthogonalQuery(qMin, qMax);
-        }
-      });
+    return twoPassQuery(
+        [&](const auto& tree) { return tree.orthogonalQuerySegments(qMin, qMax); },
+        [&](const auto& tree, const auto& segs, auto out) {
+          tree.orthogonalQueryWrite(qMin, qMax, segs, out);
+        });
+  }
 
-      // result size
-      std::vector<size_t> offsets(NUM_TREES + 2);
-      offsets[0] = 0;
-      for (int i = 1; i < NUM_TREES + 2; i++) {
-        offsets[i] = offsets[i - 1] + res[i - 1].size();
-      }
+  /*!
+   * Points within distance [r] of [center], over all the trees; see [KdTree::radiusQuery].
+   */
+  parlay::sequence<objT> radiusQuery(const objT& center, double r) const {
+    return twoPassQuery(
+        [&](const auto& tree) { return tree.radiusQuerySegments(center, r); },
+        [&](const auto& tree, const auto& segs, auto out) {
+          tree.radiusQueryWrite(center, r, segs, out);
+        });
+  }
 
-      // reduce the result
-      parlay::sequence<objT> ret(offsets[NUM_TREES + 1]);
-      parlay::parallel_for(0, res.size(), [&](size_t i) {
-        assert(offsets[i + 1] - offsets[i] == res[i].size());
-        parlay::parallel_for(0, res[i].size(), [&](size_t j) { ret[j + offsets[i]] = res[i][j]; });
-      });
+  /*!
+   * Number of points inside the box [qMin, qMax], summed over the trees; see
+   * [KdTree::orthogonalCount].
+   */
+  size_t orthogonalCount(const objT& qMin, const objT& qMax) const {
+    constexpr int BUFFER_TREE_IDX = -1;
+    auto tree_ids = gatherFullTrees();
+    auto tree_count = [&](size_t t) {
+      auto i = tree_ids[t];
+      return (i == BUFFER_TREE_IDX) ? buffer_tree->orthogonalCount(qMin, qMax)
+                                    : static_trees[i]->orthogonalCount(qMin, qMax);
+    };
+    if (parallel) {
+      return parlay::reduce(parlay::delayed_seq<size_t>(tree_ids.size(), tree_count));
+    } else {
+      size_t ret = 0;
+      for (size_t t = 0; t < tree_ids.size(); t++)
+        ret += tree_count(t);
       return ret;
+    }
+  }
+
+  /*!
+   * Reduce [f](point) over the points inside the box [qMin, qMax] with the monoid [m], combined
+   * over the trees; see [KdTree::orthogonalReduce].
+   */
+  template <class F, class M>
+  auto orthogonalReduce(const objT& qMin, const objT& qMax, F f, M m) const {
+    using T = decltype(m.identity);
+    constexpr int BUFFER_TREE_IDX = -1;
+    auto tree_ids = gatherFullTrees();
+    auto tree_reduce = [&](size_t t) -> T {
+      auto i = tree_ids[t];
+      return (i == BUFFER_TREE_IDX) ? buffer_tree->orthogonalReduce(qMin, qMax, f, m)
+                                    : static_trees[i]->orthogonalReduce(qMin, qMax, f, m);
+    };
+    if (parallel) {
+      return parlay::reduce(parlay::delayed_seq<T>(tree_ids.size(), tree_reduce), m);
     } else {
-      parlay::sequence<objT> ret;
-      auto r = buffer_tree.orthogonalQuery(qMin, qMax);
-      ret.insert(ret.begin(), r.begin(), r.end());
-      for (int i = 0; i < NUM_TREES; i++) {
-        r = static_trees[i].orthogonalQuery(qMin, qMax);
-        ret.insert(ret.begin() + ret.size(), r.begin(), r.end());
-      }
+      T ret = m.identity;
+      for (size_t t = 0; t < tree_ids.size(); t++)
+        ret = m.f(ret, tree_reduce(t));
       return ret;
     }
   }
 
+  /*!
+   * Orthogonal range query over a batch of boxes ({qMin, qMax}); see
+   * [KdTree::orthogonalQueryBatch]. The full trees are gathered once for the whole batch, and every
+   * (box, tree) pair is counted and written in parallel.
+   * @return CSR result {offsets, items}: box i's points are items[offsets[i], offsets[i + 1]).
+   */
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> orthogonalQueryBatch(
+      const parlay::sequence<std::pair<objT, objT>>& boxes) const {
+    return twoPassQueryBatch(
+        boxes.size(),
+        [&](size_t i, const auto& tree) {
+          return tree.orthogonalQuerySegments(boxes[i].first, boxes[i].second);
+        },
+        [&](size_t i, const auto& tree, const auto& segs, auto out) {
+          tree.orthogonalQueryWrite(boxes[i].first, boxes[i].second, segs, out);
+        });
+  }
+
+  /*!
+   * Radius query around each of [centers], all with radius [r]; see [orthogonalQueryBatch].
+   * @return CSR result {offsets, items}: center i's points are items[offsets[i], offsets[i + 1]).
+   */
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> radiusQueryBatch(
+      const parlay::sequence<objT>& centers, double r) const {
+    return twoPassQueryBatch(
+        centers.size(),
+        [&](size_t i, const auto& tree) { return tree.radiusQuerySegments(centers[i], r); },
+        [&](size_t i, const auto& tree, const auto& segs, auto out) {
+          tree.radiusQueryWrite(centers[i], r, segs, out);
+        });
+  }
+
+  // Grow the ID locator to cover the IDs of [points]
+  template <class R>
+  void growIdLocator(const R& points) {
+    if (points.size() == 0) return;
+    auto ids = parlay::delayed_seq<size_t>(points.size(), [&](size_t i) { return points[i].id; });
+    auto max_id = parlay::reduce(ids, parlay::maxm<size_t>());
+    if (max_id >= id_locator.size()) {
+      id_locator.resize(std::max(max_id + 1, 2 * id_locator.size()), IdLocation{NO_TREE, 0});
+    }
+  }
+
+  // Point the ID locator at the current positions of [tree_id]'s points, after it was (re)built
+  void locateTree(int tree_id) {
+    constexpr int BUFFER_TREE_IDX = -1;
+    auto locate_tree = [&](const auto& tree) {
+      auto locate_item = [&](size_t j) {
+        if (tree.present[j]) id_locator[tree.items[j].id] = IdLocation{tree_id, (uint32_t)j};
+      };
+      if (parallel) {
+        parlay::parallel_for(0, tree.get_build_size(), locate_item);
+      } else {
+        for (size_t j = 0; j < tree.get_build_size(); j++)
+          locate_item(j);
+      }
+    };
+    if (tree_id == BUFFER_TREE_IDX) {
+      locate_tree(*buffer_tree);
+    } else {
+      locate_tree(*static_trees[tree_id]);
+    }
+  }
+
+  // Whether [p] lies in the root bbox of [tree_id]; points outside it cannot be in the tree. The
+  // array buffer keeps no bbox, so every point may be in it.
+  bool inRootBox(int tree_id, const objT& p) const {
+    constexpr int BUFFER_TREE_IDX = -1;
+    const kdNode<dim, objT, parallel>* root;
+    if (tree_id == BUFFER_TREE_IDX) {
+#if (LOGTREE_BUFFER == BHL_BUFFER)
+      root = buffer_tree->root();
+#else
+      return true;
+#endif
+    } else {
+      root = static_trees[tree_id]->root();
+    }
+    return itemInBox<dim, objT>(root->getMin(), root->getMax(), &p);
+  }
+
   parlay::sequence<int> gatherFullTrees() const {
     constexpr int BUFFER_TREE_IDX = -1;
     // gather full trees
     parlay::sequence<int> tree_ids;
-    if (!buffer_tree.empty()) {
+    if (!buffer_tree->empty()) {
       tree_ids.push_back(BUFFER_TREE_IDX);
     }
-    for (int i = 0; i < NUM_TREES; i++) {
+    for (int i = 0; i < (int)static_trees.size(); i++) {
       if (nth_bit_set(tree_mask, i)) tree_ids.push_back(i);
     }
     return tree_ids;
   }
 
+  // Range query in two passes over all the trees: [segments](tree) counts the matches in each
+  // tree, then one allocation that [write](tree, segs, out) fills; see [KdTree::orthogonalQuery].
+  template <class Segments, class Write>
+  parlay::sequence<objT> twoPassQuery(const Segments& segments, const Write& write) const {
+    constexpr int BUFFER_TREE_IDX = -1;
+    auto tree_ids = gatherFullTrees();
+    auto num_trees = tree_ids.size();
+    parlay::sequence<parlay::sequence<RangeSegment>> segs(num_trees);
+    auto tree_segments = [&](size_t t) {
+      auto i = tree_ids[t];
+      segs[t] = (i == BUFFER_TREE_IDX) ? segments(*buffer_tree) : segments(*static_trees[i]);
+    };
+    auto tree_write = [&](size_t t, parlay::slice<objT*, objT*> out) {
+      auto i = tree_ids[t];
+      if (i == BUFFER_TREE_IDX) {
+        write(*buffer_tree, segs[t], out);
+      } else {
+        write(*static_trees[i], segs[t], out);
+      }
+    };
+
+    if (parallel) {
+      parlay::parallel_for(0, num_trees, tree_segments);
+    } else {
+      for (size_t t = 0; t < num_trees; t++)
+        tree_segments(t);
+    }
+
+    // result offsets
+    size_t total = 0;
+    for (auto& tree_segs : segs) {
+      total += rangeSegmentOffsets(tree_segs, total);
+    }
+
+    parlay::sequence<objT> ret(total);
+    auto ret_slice = ret.cut(0, total);
+    if (parallel) {
+      parlay::parallel_for(0, num_trees, [&](size_t t) { tree_write(t, ret_slice); });
+    } else {
+      for (size_t t = 0; t < num_trees; t++)
+        tree_write(t, ret_slice);
+    }
+    return ret;
+  }
+
+  // Batch of [n] two-pass queries: the full trees are gathered once for the whole batch, and every
+  // (query, tree) pair is counted by [segments](i, tree) and written by [write](i, tree, segs, out)
+  // in parallel. Returns the CSR result {offsets, items}.
+  template <class Segments, class Write>
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> twoPassQueryBatch(
+      size_t n, const Segments& segments, const Write& write) const {
+    constexpr int BUFFER_TREE_IDX = -1;
+    auto tree_ids = gatherFullTrees();
+    auto num_trees = tree_ids.size();
+
+    // one entry per (query, tree) pair, query-major so that each query's results are contiguous
+    parlay::sequence<parlay::sequence<RangeSegment>> segs(n * num_trees);
+    parlay::sequence<size_t> pair_offsets(n * num_trees + 1);
+
+    // count
+    auto count_pair = [&](size_t i) {
+      auto q = i / num_trees;
+      auto tree_id = tree_ids[i % num_trees];
+      segs[i] = (tree_id == BUFFER_TREE_IDX) ? segments(q, *buffer_tree)
+                                             : segments(q, *static_trees[tree_id]);
+      pair_offsets[i] = rangeSegmentOffsets(segs[i]);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, n * num_trees, count_pair);
+    } else {
+      for (size_t i = 0; i < n * num_trees; i++)
+        count_pair(i);
+    }
+    pair_offsets[n * num_trees] = 0;
+    auto total = parlay::scan_inplace(pair_offsets);
+
+    // write
+    parlay::sequence<objT> out(total);
+    auto write_pair = [&](size_t i) {
+      auto q = i / num_trees;
+      auto tree_id = tree_ids[i % num_trees];
+      auto out_slice = out.cut(pair_offsets[i], pair_offsets[i + 1]);
+      if (tree_id == BUFFER_TREE_IDX) {
+        write(q, *buffer_tree, segs[i], out_slice);
+      } else {
+        write(q, *static_trees[tree_id], segs[i], out_slice);
+      }
+    };
+    if (parallel) {
+      parlay::parallel_for(0, n * num_trees, write_pair);
+    } else {
+      for (size_t i = 0; i < n * num_trees; i++)
+        write_pair(i);
+    }
+
+    // per-query offsets
+    parlay::sequence<size_t> offsets(n + 1);
+    if (parallel) {
+      parlay::parallel_for(0, n + 1, [&](size_t i) { offsets[i] = pair_offsets[i * num_trees]; });
+    } else {
+      for (size_t i = 0; i < n + 1; i++)
+        offsets[i] = pair_offsets[i * num_trees];
+    }
+    return {std::move(offsets), std::move(out)};
+  }
+
+  /*!
+   * Order in which batch kNN visits [queries], shared by all the trees: Morton order over the union
+   * of the static trees' root boxes with KNN_MORTON_ORDER, otherwise empty (the caller's order).
+   */
+  parlay::sequence<uint32_t> knnQueryOrder([[maybe_unused]] const parlay::sequence<objT>& queries,
+                                           [[maybe_unused]] const parlay::sequence<int>& tree_ids)
+      const {
+#ifdef KNN_MORTON_ORDER
+    constexpr int BUFFER_TREE_IDX = -1;
+    bool found = false;
+    pointT pMin, pMax;
+    for (auto tree_id : tree_ids) {
+      if (tree_id == BUFFER_TREE_IDX) continue;  // small, doesn't change the box much
+      const auto root = static_trees[tree_id]->root();
+      if (!found) {
+        pMin = root->getMin();
+        pMax = root->getMax();
+        found = true;
+      } else {
+        pMin.minCoords(root->getMin());
+        pMax.maxCoords(root->getMax());
+      }
+    }
+    if (found) return mortonOrder<dim>(queries, pMin, pMax, parallel);
+#endif
+    return {};
+  }
+
   template <bool update = false, bool recurse_sibling = false>
   parlay::sequence<const pointT*> knn3(const parlay::sequence<objT>& queries, int k) const {
 #ifdef PRINT_LOGTREE_TIMINGS
@@ -792,6 +1422,7 @@ class LogTree {
 #endif
     constexpr int BUFFER_TREE_IDX = -1;
     auto tree_ids = gatherFullTrees();
+    auto order = knnQueryOrder(queries, tree_ids);
 
     // result buffer
     parlay::sequence<const pointT*> res(k * queries.size());
@@ -814,11 +1445,11 @@ class LogTree {
 
       // call knn on this tree
       if (tree_id == BUFFER_TREE_IDX) {
-        buffer_tree.template knn<false, update, recurse_sibling>(
-            queries, out_slice, res_slice, k, preload);
+        buffer_tree->template knn<false, update, recurse_sibling>(
+            queries, out_slice, res_slice, k, preload, order);
       } else {
-        static_trees[tree_id].template knn<false, update, recurse_sibling>(
-            queries, out_slice, res_slice, k, preload);
+        static_trees[tree_id]->template knn<false, update, recurse_sibling>(
+            queries, out_slice, res_slice, k, preload, order);
       }
 #ifdef PRINT_LOGTREE_TIMINGS
       std::cout << "[KNN3] Tree " << tree_id << " Query Time: " << t1.get_next() << "\n";
@@ -847,6 +1478,111 @@ class LogTree {
     return res;
   }
 
+  /*!
+   * kNN with a single best-first traversal per query over the nodes of all the trees, ordered by
+   * bounding box distance: the radius found in one tree prunes every other tree from the start,
+   * and each query needs a single 2k buffer. [update] and [recurse_sibling] are accepted for
+   * symmetry with [knn] and unused.
+   */
+  template <bool update = false, bool recurse_sibling = false>
+  parlay::sequence<const pointT*> knn4(const parlay::sequence<objT>& queries, int k) const {
+    typedef kdNode<dim, objT, parallel> nodeT;
+    typedef std::tuple<double, int, const nodeT*> entryT;  // (bbox distance, tree, node)
+    constexpr int BUFFER_TREE_IDX = -1;
+    constexpr size_t QUERY_BLOCK_SIZE = 64;
+    auto tree_ids = gatherFullTrees();
+    auto order = knnQueryOrder(queries, tree_ids);
+
+    // roots, leaf scans, present flags and live counts of the trees
+    parlay::sequence<const nodeT*> roots;
+    parlay::sequence<LeafScan<dim, objT>> scans;
+    parlay::sequence<const LiveBitmap*> presents;
+    parlay::sequence<const CowPages<uint32_t>*> live_counts;
+    [[maybe_unused]] bool scan_buffer = false;  // the array buffer has no nodes: scan it first
+    for (auto tree_id : tree_ids) {
+      if (tree_id == BUFFER_TREE_IDX) {
+#if (LOGTREE_BUFFER == BHL_BUFFER)
+        roots.push_back(buffer_tree->root());
+        scans.push_back(buffer_tree->leafScan());
+        presents.push_back(&buffer_tree->present);
+        live_counts.push_back(&buffer_tree->live_counts);
+#else
+        scan_buffer = true;
+#endif
+      } else {
+        roots.push_back(static_trees[tree_id]->root());
+        scans.push_back(static_trees[tree_id]->leafScan());
+        presents.push_back(&static_trees[tree_id]->present);
+        live_counts.push_back(&static_trees[tree_id]->live_counts);
+      }
+    }
+
+    parlay::sequence<const pointT*> res(k * queries.size());
+    parlay::sequence<knnBuf::elem<const pointT*>> out(2 * k * queries.size());
+
+    auto run_block = [&](size_t b) {
+      std::vector<entryT> heap;  // min-heap on bbox distance, reused across the block
+      auto heap_cmp = [](const entryT& l, const entryT& r) {
+        return std::get<0>(l) > std::get<0>(r);
+      };
+      for (size_t j = b * QUERY_BLOCK_SIZE;
+           j < std::min((b + 1) * QUERY_BLOCK_SIZE, queries.size());
+           j++) {
+        auto i = order.empty() ? j : order[j];
+        pointT q(queries[i].coordinate());
+        auto buf = knnBuf::buffer<const pointT*>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
+        double radius_sqr = std::numeric_limits<double>::max();
+#if (LOGTREE_BUFFER != BHL_BUFFER)
+        if (scan_buffer) {
+          buffer_tree->knnSinglePoint(q, buf);
+          if (buf.hasK()) radius_sqr = buf.keepK().cost;
+        }
+#endif
+
+        auto push = [&](int t, const nodeT* n) {
+          if (n == nullptr || (*live_counts[t])[n - roots[t]] == 0) return;
+          auto dist = BoundingBoxDistanceSqr(q, q, n->getMin(), n->getMax());
+          if (dist > radius_sqr) return;
+          heap.emplace_back(dist, t, n);
+          std::push_heap(heap.begin(), heap.end(), heap_cmp);
+        };
+        heap.clear();
+        for (size_t t = 0; t < roots.size(); t++)
+          push(t, roots[t]);
+
+        while (!heap.empty()) {
+          std::pop_heap(heap.begin(), heap.end(), heap_cmp);
+          auto [dist, t, n] = heap.back();
+          heap.pop_back();
+          if (dist > radius_sqr) break;  // every remaining node is at least as far
+          for (bool right : {false, true}) {
+            if (n->isLeafChild(right)) {  // a leaf has no node (or box) of its own: scan it now
+              nodeT::knnAddToBuffer(n->getChildStartIdx(right), n->getChildEndIdx(right), q,
+                                    scans[t], *presents[t], buf, radius_sqr);
+              if (buf.hasK()) radius_sqr = buf.keepK().cost;
+            } else {
+              push(t, n->getChild(right));
+            }
+          }
+        }
+
+        if (buf.hasK()) buf.keepK();
+        for (int g = 0; g < k; g++) {
+          res[i * k + g] = buf[g].entry;
+        }
+      }
+    };
+
+    auto num_blocks = (queries.size() + QUERY_BLOCK_SIZE - 1) / QUERY_BLOCK_SIZE;
+    if (parallel) {
+      parlay::parallel_for(0, num_blocks, run_block, 1);
+    } else {
+      for (size_t b = 0; b < num_blocks; b++)
+        run_block(b);
+    }
+    return res;
+  }
+
   template <bool update = false, bool recurse_sibling = false>
   parlay::sequence<const pointT*> knn2(const parlay::sequence<objT>& queries, int k) const {
     constexpr int BUFFER_TREE_IDX = -1;
@@ -860,23 +1596,25 @@ class LogTree {
     auto out_size = (2 * k * queries.size());
     parlay::sequence<knnBuf::elem<const pointT*>> out(out_size);
     auto out_slice = out.head(out.size());
+    auto order = knnQueryOrder(queries, tree_ids);
 
-    auto run_on_point = [&](size_t i) {
+    auto run_on_point = [&](size_t j) {
+      auto i = order.empty() ? j : order[j];
       // knn point i through all the trees
-      for (size_t j = 0; j < tree_ids.size(); j++) {
-        auto tree_id = tree_ids[j];
-        auto preload = j > 0;  // buffer is full after first tree
+      for (size_t t = 0; t < tree_ids.size(); t++) {
+        auto tree_id = tree_ids[t];
+        auto preload = t > 0;  // buffer is full after first tree
         if (tree_id == BUFFER_TREE_IDX) {
-          buffer_tree.template knnSinglePoint<false, update, recurse_sibling>(
+          buffer_tree->template knnSinglePoint<false, update, recurse_sibling>(
               queries[i], i, out_slice, res_slice, k, preload);
         } else {
-          static_trees[tree_id].template knnSinglePoint<false, update, recurse_sibling>(
+          static_trees[tree_id]->template knnSinglePoint<false, update, recurse_sibling>(
               queries[i], i, out_slice, res_slice, k, preload);
         }
       }
       // gather results
-      for (int j = 0; j < k; j++) {
-        res[i * k + j] = out_slice[(i * 2 * k) + j].entry;
+      for (int g = 0; g < k; g++) {
+        res[i * k + g] = out_slice[(i * 2 * k) + g].entry;
       }
     };
 
@@ -891,13 +1629,20 @@ class LogTree {
     return res;
   }
 
+  /*!
+   * k nearest neighbors of each of [queries] over all the trees; see [KdTree::knn]. With [approx],
+   * the leaf cap applies to each tree separately.
+   */
   template <bool update = false, bool recurse_sibling = false>
-  parlay::sequence<const pointT*> knn(const parlay::sequence<objT>& queries, int k) const {
+  parlay::sequence<const pointT*> knn(const parlay::sequence<objT>& queries,
+                                      int k,
+                                      const knnBuf::approx& approx = {}) const {
 #ifdef PRINT_LOGTREE_TIMINGS
     timer t;
 #endif
     constexpr int BUFFER_TREE_IDX = -1;
     auto tree_ids = gatherFullTrees();
+    auto order = knnQueryOrder(queries, tree_ids);
 
     // result buffer
     parlay::sequence<const pointT*> res(k * queries.size());
@@ -920,11 +1665,11 @@ class LogTree {
 
       // call knn on this tree
       if (tree_id == BUFFER_TREE_IDX) {
-        buffer_tree.template knn<false, update, recurse_sibling>(
-            queries, out_slice, res_slice, k, preload);
+        buffer_tree->template knn<false, update, recurse_sibling>(
+            queries, out_slice, res_slice, k, preload, order, approx);
       } else {
-        static_trees[tree_id].template knn<false, update, recurse_sibling>(
-            queries, out_slice, res_slice, k, preload);
+        static_trees[tree_id]->template knn<false, update, recurse_sibling>(
+            queries, out_slice, res_slice, k, preload, order, approx);
       }
 #ifdef PRINT_LOGTREE_TIMINGS
       std::cout << "[KNN] Tree " << tree_id << " Query Time: " << t1.get_next() << "\n";
@@ -949,7 +1694,7 @@ class LogTree {
     if (parallel) {
       parlay::parallel_for(0, queries.size(), [&](size_t i) {
         auto buf = knnBuf::buffer<const pointT*>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
-        buf.ptr = k;
+        buf.preload();
         for (size_t j = 1; j < tree_ids.size(); j++) {
           auto start_elem = out.begin() + (j * out_size + i * 2 * k);
           for (int g = 0; g < k; g++) {
@@ -976,6 +1721,16 @@ class LogTree {
     return res;
   }
 
+  /*!
+   * [knn] returning copies of the neighbors; see [KdTree::knnItems].
+   */
+  template <bool update = false, bool recurse_sibling = false>
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> knnItems(
+      const parlay::sequence<objT>& queries, int k, const knnBuf::approx& approx = {}) const {
+    auto res = knn<update, recurse_sibling>(queries, k, approx);
+    return knnBuf::gatherItems<objT>(res, queries.size(), k, parallel);
+  }
+
   parlay::sequence<const pointT*> dualKnnBase(const KdTree<dim, objT, parallel, coarsen>& queryTree,
                                               int k) const {
 #ifdef PRINT_LOGTREE_TIMINGS
@@ -1055,9 +1810,9 @@ class LogTree {
         //#else
         timer t;
 #if (LOGTREE_BUFFER == ARR_BUFFER)
-        buffer_tree.knn(queryTree.items, buf_slice);
+        buffer_tree->knn(*queryTree.items, buf_slice);
 #else
-        buffer_tree.template knn<false, false>(queryTree.items, buf_slice);
+        buffer_tree->template knn<false, false>(*queryTree.items, buf_slice);
 #endif
 #ifdef PRINT_LOGTREE_TIMINGS
         std::cout << "[DKNN] SMALL KNN: " << t.get_next() << "\n";
@@ -1073,19 +1828,13 @@ class LogTree {
 #endif
         //#endif
       } else {
+        typedef kdNode<dim, objT, parallel> nodeT;
+        auto q_root = DualKnnNode<dim, nodeT>::of(queryTree.unsafe_root());
+        auto r_root = DualKnnNode<dim, const nodeT>::of(static_trees[tree_id]->root());
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
-        DualKnnHelper(queryTree.unsafe_root(),
-                      static_trees[tree_id].root(),
-                      queryTree,
-                      dualKnnDists,
-                      static_trees[tree_id],
-                      buf_slice);
+        DualKnnHelper(q_root, r_root, queryTree, dualKnnDists, *static_trees[tree_id], buf_slice);
 #else
-        DualKnnHelper(queryTree.unsafe_root(),
-                      static_trees[tree_id].root(),
-                      queryTree,
-                      static_trees[tree_id],
-                      buf_slice);
+        DualKnnHelper(q_root, r_root, queryTree, *static_trees[tree_id], buf_slice);
 #endif
       }
     };
@@ -1107,11 +1856,11 @@ class LogTree {
 #ifdef PRINT_LOGTREE_TIMINGS
         auto nth_tree_cur_size = [&](int id) {
           if (id == BUFFER_TREE_IDX) {
-            return buffer_tree.size();
+            return buffer_tree->size();
           } else {
-            assert(id < NUM_TREES);
+            assert(id < (int)static_trees.size());
             assert(id >= 0);
-            return static_trees[id].size();
+            return static_trees[id]->size();
           }
         };
         auto tree_id = tree_ids[i];
@@ -1134,7 +1883,7 @@ class LogTree {
             buf.insert(*(start_elem + g));
           }
         }
-        buf.keepK();
+        if (buf.hasK()) buf.keepK();
         for (int g = 0; g < k; g++) {
           res[i * k + g] = buf[g].entry;
         }
@@ -1158,20 +1907,32 @@ class LogTree {
   }
 
   // DEBUG
-  int getTreeMask() const { return tree_mask; }
+  int getTreeMask() const { return (int)tree_mask; }  // levels stop below MAX_TREE_LOG2_SIZE
+  // the number of static trees that hold storage
+  int numAllocatedTrees() const {
+    int res = 0;
+    for (const auto& tree : static_trees)
+      res += (tree != nullptr);
+    return res;
+  }
+  int getBufferLog2Size() const { return buffer_log2_size; }
+  // static tree [i], or null if level [i] is empty
+  const staticTree* getStaticTree(int i) const { return static_trees[i].get(); }
+  const dynamicTree* getBufferTree() const { return buffer_tree.get(); }
 
   // TODO: can make this better by tracking as inserts/deletes are done
   size_t size() const {
-    size_t res = buffer_tree.size();
-    for (int i = 0; i < NUM_TREES; i++) {
-      if (nth_bit_set(tree_mask, i)) res += static_trees[i].size();
+    size_t res = buffer_tree->size();
+    for (int i = 0; i < (int)static_trees.size(); i++) {
+      if (nth_bit_set(tree_mask, i)) res += static_trees[i]->size();
     }
     return res;
   }
 
   void print(int tree_idx) const {
-    if (tree_idx < 0 || tree_idx >= NUM_TREES) throw std::runtime_error("tree_idx out of bounds!");
-    static_trees[tree_idx].print();
+    if (tree_idx < 0 || tree_idx >= (int)static_trees.size() || !static_trees[tree_idx])
+      throw std::runtime_error("tree_idx out of bounds!");
+    static_trees[tree_idx]->print();
   }
 };
 
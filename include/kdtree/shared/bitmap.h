@@ -0,0 +1,167 @@
+#ifndef KDTREE_SHARED_BITMAP_H
+#define KDTREE_SHARED_BITMAP_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/sequence.h"
+
+#include "cow.h"
+
+/*!
+ * Liveness flags of a tree's [items]: one bit per slot, packed in 64-bit words. Counting and
+ * packing the live items work a word at a time (popcount, then the set bits of the word), so they
+ * cost 1/64 of a per-item pass over flags. Bits are only cleared while the tree is in use, and
+ * leaves are not word-aligned, so [reset] is atomic: erasures on different leaves may share a word.
+ * The words are paged copy-on-write (see [CowPages]): a copy shares them until it writes them.
+ */
+class LiveBitmap {
+ public:
+  static constexpr size_t WORD_BITS = 64;
+
+ private:
+  size_t n;
+  CowPages<uint64_t> words;
+
+  static size_t numWords(size_t num_bits) { return (num_bits + WORD_BITS - 1) / WORD_BITS; }
+
+ public:
+  LiveBitmap() : n(0) {}
+  explicit LiveBitmap(size_t num_bits, bool value = true)
+      : n(num_bits), words(numWords(num_bits), value ? ~uint64_t(0) : 0) {}
+
+  size_t size() const { return n; }
+  const CowPages<uint64_t> &wordPages() const { return words; }
+
+  bool operator[](size_t i) const { return (words[i / WORD_BITS] >> (i % WORD_BITS)) & 1; }
+
+  /*!
+   * <Thread-safe> Clear bit [i]. Returns whether it was set.
+   */
+  bool reset(size_t i) {
+    auto bit = uint64_t(1) << (i % WORD_BITS);
+    return __atomic_fetch_and(&words.own(i / WORD_BITS), ~bit, __ATOMIC_RELAXED) & bit;
+  }
+
+  /*!
+   * Set bits [0, num_bits) (rounded up to whole words), e.g. the slots used by the last build.
+   */
+  void setPrefix(size_t num_bits, bool parallel) {
+    auto e = std::min(numWords(num_bits), words.size());
+    if (parallel) {
+      parlay::parallel_for(0, e, [&](size_t w) { words.own(w) = ~uint64_t(0); });
+    } else {
+      for (size_t w = 0; w < e; w++)
+        words.own(w) = ~uint64_t(0);
+    }
+  }
+
+  /*!
+   * Bits [s, s + count) as a mask, bit j for slot s + j (count <= 64).
+   */
+  uint64_t bits(size_t s, size_t count) const {
+    assert(count <= WORD_BITS && s + count <= n);
+    auto w = s / WORD_BITS, off = s % WORD_BITS;
+    uint64_t b = words[w] >> off;
+    if (off != 0 && off + count > WORD_BITS) b |= words[w + 1] << (WORD_BITS - off);
+    return count < WORD_BITS ? b & ((uint64_t(1) << count) - 1) : b;
+  }
+
+  /*!
+   * <Thread-safe> Set bits [s, e).
+   */
+  void setRange(size_t s, size_t e) {
+    for (auto c = s; c < e;) {
+      auto off = c % WORD_BITS, count = std::min(WORD_BITS - off, e - c);
+      auto mask = count < WORD_BITS ? (uint64_t(1) << count) - 1 : ~uint64_t(0);
+      __atomic_fetch_or(&words.own(c / WORD_BITS), mask << off, __ATOMIC_RELAXED);
+      c += count;
+    }
+  }
+
+  /*!
+   * Copy bits [s, e) to [dst, dst + (e - s)); the two ranges may overlap, as with memmove.
+   */
+  void moveBits(size_t s, size_t e, size_t dst) {
+    if (dst == s) return;
+    auto move_chunk = [&](size_t c) {
+      auto cs = s + c * WORD_BITS;
+      auto count = std::min(WORD_BITS, e - cs);
+      auto b = bits(cs, count);
+      auto w = (dst + c * WORD_BITS) / WORD_BITS, off = (dst + c * WORD_BITS) % WORD_BITS;
+      auto mask = count < WORD_BITS ? (uint64_t(1) << count) - 1 : ~uint64_t(0);
+      words.own(w) = (words[w] & ~(mask << off)) | (b << off);
+      if (off != 0 && off + count > WORD_BITS) {
+        words.own(w + 1) =
+            (words[w + 1] & ~(mask >> (WORD_BITS - off))) | (b >> (WORD_BITS - off));
+      }
+    };
+    auto chunks = numWords(e - s);
+    if (dst < s) {  // front to back, so no chunk overwrites a source chunk still to be read
+      for (size_t c = 0; c < chunks; c++)
+        move_chunk(c);
+    } else {
+      for (size_t c = chunks; c-- > 0;)
+        move_chunk(c);
+    }
+  }
+
+  /*!
+   * Number of set bits in [s, e).
+   */
+  size_t count(size_t s, size_t e, bool parallel) const {
+    auto chunk_count = [&](size_t c) -> size_t {
+      auto cs = s + c * WORD_BITS;
+      return __builtin_popcountll(bits(cs, std::min(WORD_BITS, e - cs)));
+    };
+    auto chunks = numWords(e - s);
+    if (parallel) return parlay::reduce(parlay::delayed_seq<size_t>(chunks, chunk_count));
+    size_t ret = 0;
+    for (size_t c = 0; c < chunks; c++)
+      ret += chunk_count(c);
+    return ret;
+  }
+
+  /*!
+   * Copy in[j] for the set bits j in [s, e), in order, to [out]. Fully live chunks of 64 are copied
+   * in one go. Returns the number of items copied. Serially, [out] may be in + s (packing in
+   * place).
+   */
+  template <class T>
+  size_t packInto(const T *in, size_t s, size_t e, T *out, bool parallel) const {
+    auto chunk_bits = [&](size_t c) {
+      auto cs = s + c * WORD_BITS;
+      return bits(cs, std::min(WORD_BITS, e - cs));
+    };
+    auto write_chunk = [&](size_t c, uint64_t b, T *dst) {
+      auto src = in + s + c * WORD_BITS;
+      if (b == ~uint64_t(0)) {
+        if (dst != src) std::copy(src, src + WORD_BITS, dst);
+      } else {
+        for (; b; b &= b - 1)
+          *dst++ = src[__builtin_ctzll(b)];
+      }
+    };
+
+    auto chunks = numWords(e - s);
+    if (!parallel) {
+      size_t ret = 0;
+      for (size_t c = 0; c < chunks; c++) {
+        auto b = chunk_bits(c);
+        write_chunk(c, b, out + ret);
+        ret += __builtin_popcountll(b);
+      }
+      return ret;
+    }
+    auto offsets = parlay::tabulate(
+        chunks, [&](size_t c) -> size_t { return __builtin_popcountll(chunk_bits(c)); });
+    auto total = parlay::scan_inplace(offsets);
+    parlay::parallel_for(
+        0, chunks, [&](size_t c) { write_chunk(c, chunk_bits(c), out + offsets[c]); });
+    return total;
+  }
+};
+
+#endif  // KDTREE_SHARED_BITMAP_H
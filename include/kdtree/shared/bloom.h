@@ -2,120 +2,115 @@
 #define KDTREE_SHARED_BLOOM_H
 
 #define XXH_PRIVATE_API
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <memory>
 #include <common/geometry.h>
 #include <parlay/parallel.h>
 #include <parlay/sequence.h>
+#include <parlay/primitives.h>
 #include <xxHash/xxhash.h>
 
-#define ATOMIC_BUCKETS
-//#define BIT_VECTOR
+#include "macro.h"
 
+/*!
+ * Blocked Bloom filter over points: all the bits of a point live in one 64-byte block (a cache
+ * line), chosen by its hash, so a probe costs one cache miss and a block-wide AND that the compiler
+ * vectorizes. Bits are packed, and the filter is sized for a target false-positive rate, by
+ * default BLOOM_FP_RATE: 1.2 * ln(1/p) / ln^2(2) bits per point, about 11.5 bits (1.44 bytes) at
+ * 1%.
+ */
 template <int dim>
 class BloomFilter {
-  static constexpr int NUM_ARRAYS = 4;
-  static constexpr int EMPTY_BUCKETS_GRANULARITY = 1024;
+  static constexpr int BLOCK_BITS = 512;
+  static constexpr int BLOCK_WORDS = BLOCK_BITS / 64;
+  static constexpr int MAX_HASHES = 16;
+  static constexpr int EMPTY_BUCKETS_GRANULARITY = 64;
   static constexpr int FILL_BUCKETS_GRANULARITY = 1024;
 
-#ifdef ATOMIC_BUCKETS
-#ifdef BIT_VECTOR
-  typedef char bucketT;
-#else
-  typedef bool bucketT;
-#endif
-  std::atomic<bucketT> *buckets[NUM_ARRAYS];
-#else
-  std::vector<char> buckets[NUM_ARRAYS];
-#endif
+  struct alignas(64) block {
+    uint64_t words[BLOCK_WORDS];
+  };
 
   typedef point<dim> pointT;
 
-  const size_t num_buckets;
-  const size_t buckets_size;
+  size_t num_blocks;
+  int num_hashes;  // bits set per point, all in its block
+  std::unique_ptr<block[]> blocks;
 
-  size_t hash(const pointT &p, int bucket_num) {
-    auto h = (uint64_t)XXH64(p.x, dim * sizeof(double), bucket_num);
-    return h % num_buckets;
+  // bits per point and number of hashes for [fp_rate]; blocking costs about 20% more bits than a
+  // classic filter for the same rate
+  static double bitsPerPoint(double fp_rate) {
+    return 1.2 * -std::log(fp_rate) / (std::log(2.0) * std::log(2.0));
   }
-
-  static inline bool bit_set(char val, int bit) { return ((val) & (1 << bit)) != 0; }
-  static inline char set_bit(char val, int bit) { return ((val) | (1 << bit)); }
-
-  bool get(int j, size_t idx) {
-#ifdef ATOMIC_BUCKETS
-#ifdef BIT_VECTOR
-    return bit_set(buckets[j][idx / 8], idx % 8);
-#else
-    return buckets[j][idx];
-#endif
-#else
-    return buckets[j][idx];
-#endif
+  static int numHashes(double fp_rate) {
+    return std::clamp((int)std::lround(-std::log2(fp_rate)), 1, MAX_HASHES);
   }
 
-  void set(int j, size_t idx) {
-    if (!get(j, idx)) {
-#ifdef ATOMIC_BUCKETS
-#ifdef BIT_VECTOR
-      bucketT exp = buckets[j][idx / 8];
-      while (!buckets[j][idx / 8].compare_exchange_weak(exp, set_bit(exp, idx % 8)) &&
-             !bit_set(exp, idx % 8))
-        ;
-#else
-      bucketT exp = 0;
-      buckets[j][idx].compare_exchange_strong(exp, 1);
-#endif
-#else
-      buckets[j][idx] = 1;
-#endif
+  // the block of [p], and the mask of its bits in that block
+  size_t probe(const pointT &p, uint64_t (&mask)[BLOCK_WORDS]) const {
+    double x0[dim];  // adding 0.0 turns -0.0 into 0.0, which compares equal to it
+    for (int d = 0; d < dim; d++)
+      x0[d] = p.x[d] + 0.0;
+    auto h = (uint64_t)XXH64(x0, dim * sizeof(double), 0);
+    std::fill(mask, mask + BLOCK_WORDS, 0);
+    auto x = h;
+    for (int i = 0; i < num_hashes; i++) {
+      x *= 0x9E3779B97F4A7C15ULL;  // the top 9 bits pick the next bit of the block
+      auto bit = x >> (64 - 9);
+      mask[bit / 64] |= uint64_t(1) << (bit % 64);
     }
+    return (size_t)(((h >> 32) * (uint64_t)num_blocks) >> 32);  // in [0, num_blocks)
   }
 
  public:
-  BloomFilter(size_t num_points)
-      : num_buckets(num_points * 2),
-        buckets_size(
-#ifdef BIT_VECTOR
-            (num_points * 2 + 7) / 8
-#else
-            num_points * 2
-#endif
-        ) {
-    // TODO: compute better bound for [num_buckets]
-    for (int i = 0; i < NUM_ARRAYS; i++) {
-#ifdef ATOMIC_BUCKETS
-      buckets[i] = new std::atomic<bucketT>[buckets_size];
-#else
-      buckets[i].resize(buckets_size, 0);
-#endif
-    }
+  BloomFilter(size_t num_points, double fp_rate = BLOOM_FP_RATE)
+      : num_blocks(std::max<size_t>(
+            1, (size_t)std::ceil(num_points * bitsPerPoint(fp_rate) / BLOCK_BITS))),
+        num_hashes(numHashes(fp_rate)),
+        blocks(new block[num_blocks]) {
+    assert(0 < fp_rate && fp_rate < 1);
+    assert(num_blocks < (uint64_t(1) << 32));
+    clear();
+  }
+  BloomFilter(const BloomFilter &other)
+      : num_blocks(other.num_blocks),
+        num_hashes(other.num_hashes),
+        blocks(new block[num_blocks]) {
+    std::copy(other.blocks.get(), other.blocks.get() + num_blocks, blocks.get());
   }
 
-#ifdef ATOMIC_BUCKETS
-  ~BloomFilter() {
-    for (int i = 0; i < NUM_ARRAYS; i++) {
-      delete[] buckets[i];
-    }
+  void swap(BloomFilter &other) {
+    std::swap(num_blocks, other.num_blocks);
+    std::swap(num_hashes, other.num_hashes);
+    std::swap(blocks, other.blocks);
   }
-#endif
+
+  size_t memoryBytes() const { return num_blocks * sizeof(block); }
 
   void clear() {
-    // empty buckets
-    parlay::parallel_for(0, NUM_ARRAYS, [&](size_t i) {
-      parlay::parallel_for(
-          0, buckets_size, [&](size_t j) { buckets[i][j] = 0; }, EMPTY_BUCKETS_GRANULARITY);
-    });
+    parlay::parallel_for(
+        0,
+        num_blocks,
+        [&](size_t i) { std::fill(blocks[i].words, blocks[i].words + BLOCK_WORDS, 0); },
+        EMPTY_BUCKETS_GRANULARITY);
   }
 
   template <class R>
   void insert(const R &points) {
-    // set buckets
+    // set bits: points landing in the same block may be inserted concurrently
     parlay::parallel_for(
         0,
         points.size(),
         [&](size_t i) {
-          for (int j = 0; j < NUM_ARRAYS; j++) {
-            auto idx = hash(points[i], j);
-            set(j, idx);
+          uint64_t mask[BLOCK_WORDS];
+          auto &b = blocks[probe(points[i], mask)];
+          for (int w = 0; w < BLOCK_WORDS; w++) {
+            if (mask[w] != 0 && (b.words[w] & mask[w]) != mask[w]) {
+              __atomic_fetch_or(&b.words[w], mask[w], __ATOMIC_RELAXED);
+            }
           }
         },
         FILL_BUCKETS_GRANULARITY);
@@ -127,16 +122,18 @@ class BloomFilter {
     insert(points);
   }
 
-  bool might_contain(const point<dim> &p) {
-    for (int i = 0; i < NUM_ARRAYS; i++) {
-      auto idx = hash(p, i);
-      if (!get(i, idx)) return false;
-    }
-    return true;
+  bool might_contain(const point<dim> &p) const {
+    uint64_t mask[BLOCK_WORDS];
+    const auto &b = blocks[probe(p, mask)];
+    uint64_t missing = 0;
+    for (int w = 0; w < BLOCK_WORDS; w++)
+      missing |= mask[w] & ~b.words[w];
+    return missing == 0;
   }
 
+  // the points of [points] that might be in the set, keeping their type (e.g. payloads)
   template <class R>
-  parlay::sequence<point<dim>> filter(const R &points) {
+  auto filter(const R &points) const {
     return parlay::filter(points, [this](const point<dim> &p) { return this->might_contain(p); });
   }
 };
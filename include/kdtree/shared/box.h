@@ -49,13 +49,54 @@ inline BoxComparison boxCompare(const point<dim> &pMin1,
     return BOX_OVERLAP;
 }
 
+/*!
+ * <Serial> Compare the ball of squared radius [r_sqr] around [q] to the box [pMin, pMax], using the
+ * box's nearest point (min-distance) and farthest corner (max-distance) from [q].
+ * @return BOX_INCLUDE if the ball contains the box, BOX_EXCLUDE if they don't intersect
+ */
+template <int dim>
+inline BoxComparison ballCompare(const point<dim> &q,
+                                 double r_sqr,
+                                 const point<dim> &pMin,
+                                 const point<dim> &pMax) {
+  double min_dist = 0, max_dist = 0;
+  for (int i = 0; i < dim; ++i) {
+    double below = pMin.coordinate(i) - q.coordinate(i);  // > 0 if q is below the box
+    double above = q.coordinate(i) - pMax.coordinate(i);  // > 0 if q is above the box
+    double near = std::max(0.0, std::max(below, above));
+    double far = std::max(std::abs(below), std::abs(above));
+    min_dist += near * near;
+    max_dist += far * far;
+  }
+  if (min_dist > r_sqr)
+    return BOX_EXCLUDE;
+  else if (max_dist <= r_sqr)
+    return BOX_INCLUDE;
+  else
+    return BOX_OVERLAP;
+}
+
+/*!
+ * <Serial> Squared euclidean distance between [p1] and [p2].
+ */
+template <int dim>
+inline double pointDistanceSqr(const point<dim> &p1, const point<dim> &p2) {
+  double dist = 0;
+  for (int i = 0; i < dim; ++i) {
+    double dim_val = p1.coordinate(i) - p2.coordinate(i);
+    dist += dim_val * dim_val;
+  }
+  return dist;
+}
+
 // Assumes the nodes have up-to-date bounding boxes!
 // Taken from: https://github.com/scipy/scipy/blob/v1.6.3/scipy/spatial/kdtree.py#L153-L165
+// Returns the squared distance; the knn pipeline compares squared distances throughout.
 template <int dim>
-double BoundingBoxDistance(const point<dim> &pMin1,
-                           const point<dim> &pMax1,
-                           const point<dim> &pMin2,
-                           const point<dim> &pMax2) {
+double BoundingBoxDistanceSqr(const point<dim> &pMin1,
+                              const point<dim> &pMax1,
+                              const point<dim> &pMin2,
+                              const point<dim> &pMax2) {
   double dist = 0;
   for (int i = 0; i < dim; ++i) {
     // compute the shortest distance in this dimension
@@ -64,7 +105,15 @@ double BoundingBoxDistance(const point<dim> &pMin1,
     dim_val = std::max(dim_val, pMin2.coordinate(i) - pMax1.coordinate(i));
     dist += dim_val * dim_val;
   }
-  return std::sqrt(dist);
+  return dist;
+}
+
+template <int dim>
+double BoundingBoxDistance(const point<dim> &pMin1,
+                           const point<dim> &pMax1,
+                           const point<dim> &pMin2,
+                           const point<dim> &pMax2) {
+  return std::sqrt(BoundingBoxDistanceSqr(pMin1, pMax1, pMin2, pMax2));
 }
 
 /*!
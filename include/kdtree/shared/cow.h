@@ -0,0 +1,143 @@
+#ifndef KDTREE_SHARED_COW_H
+#define KDTREE_SHARED_COW_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include "parlay/parallel.h"
+#include "parlay/sequence.h"
+
+#include "macro.h"
+
+/*!
+ * Fixed-size array stored in pages of COW_PAGE_BYTES, for the state a tree updates in place after
+ * it is built (liveness bits, live counts). A copy shares the pages of the original, so it costs
+ * O(size / page size); writing through [own] first gives the writer a private copy of that page
+ * only. Reads are plain loads.
+ * [own] is thread-safe: writers racing on a shared page agree on one copy, and the page copied
+ * away from stays allocated until this array is destroyed, for readers that already loaded it.
+ * The array must not be copied while it is being written.
+ */
+template <class T>
+class CowPages {
+ public:
+  static constexpr size_t PAGE_SIZE = std::max<size_t>(COW_PAGE_BYTES / sizeof(T), 1);
+
+ private:
+  enum : uint8_t { OWNED, SHARED, COPYING };
+
+  size_t n;
+  parlay::sequence<T *> data;                       // data[p] = owners[p].get()
+  parlay::sequence<std::shared_ptr<T[]>> owners;    // shared with the copies of this array
+  parlay::sequence<std::shared_ptr<T[]>> replaced;  // the pages [own] copied away from
+  std::unique_ptr<std::atomic<uint8_t>[]> states;
+
+  static size_t pagesFor(size_t size) { return (size + PAGE_SIZE - 1) / PAGE_SIZE; }
+
+ public:
+  CowPages() : n(0) {}
+  explicit CowPages(size_t size, const T &value = T())
+      : n(size),
+        data(pagesFor(size)),
+        owners(pagesFor(size)),
+        replaced(pagesFor(size)),
+        states(new std::atomic<uint8_t>[pagesFor(size)]) {
+    parlay::parallel_for(0, owners.size(), [&](size_t p) {
+      owners[p] = std::shared_ptr<T[]>(new T[PAGE_SIZE]);
+      std::fill(owners[p].get(), owners[p].get() + PAGE_SIZE, value);
+      data[p] = owners[p].get();
+      states[p].store(OWNED, std::memory_order_relaxed);
+    });
+  }
+
+  CowPages(const CowPages &other)
+      : n(other.n),
+        data(other.data),
+        owners(other.owners),
+        replaced(other.owners.size()),
+        states(new std::atomic<uint8_t>[other.owners.size()]) {
+    for (size_t p = 0; p < owners.size(); p++) {
+      states[p].store(SHARED, std::memory_order_relaxed);
+      other.states[p].store(SHARED, std::memory_order_relaxed);
+    }
+  }
+  CowPages(CowPages &&other) = default;
+  CowPages &operator=(const CowPages &other) { return *this = CowPages(other); }
+  CowPages &operator=(CowPages &&other) = default;
+
+  size_t size() const { return n; }
+  size_t numPages() const { return owners.size(); }
+
+  // the storage of page [p], e.g. to check whether two arrays still share it
+  const T *page(size_t p) const { return __atomic_load_n(&data[p], __ATOMIC_ACQUIRE); }
+
+  const T &operator[](size_t i) const { return page(i / PAGE_SIZE)[i % PAGE_SIZE]; }
+
+  /*!
+   * <Thread-safe> Page [p], for modification: copied first if another array shares it.
+   */
+  T *ownPage(size_t p) {
+    for (auto s = states[p].load(std::memory_order_acquire); s != OWNED;) {
+      if (s == COPYING) {  // another writer is copying it
+        s = states[p].load(std::memory_order_acquire);
+      } else if (states[p].compare_exchange_weak(s, COPYING, std::memory_order_acquire)) {
+        if (owners[p].use_count() > 1) {
+          std::shared_ptr<T[]> copy(new T[PAGE_SIZE]);
+          std::copy(data[p], data[p] + PAGE_SIZE, copy.get());
+          replaced[p] = std::move(owners[p]);
+          owners[p] = std::move(copy);
+          __atomic_store_n(&data[p], owners[p].get(), __ATOMIC_RELEASE);
+        }
+        states[p].store(OWNED, std::memory_order_release);
+        break;
+      }
+    }
+    return data[p];
+  }
+
+  /*!
+   * <Thread-safe> Element [i], for modification (see [ownPage]).
+   */
+  T &own(size_t i) { return ownPage(i / PAGE_SIZE)[i % PAGE_SIZE]; }
+};
+
+/*!
+ * A parlay::sequence held through a shared pointer. Copies are deep, like the sequence's own, but
+ * [share] returns another handle on the same elements, e.g. for a tree and its forks; elements
+ * that are shared must not be modified.
+ */
+template <class T>
+class SharedSequence {
+  std::shared_ptr<parlay::sequence<T>> seq;
+
+  explicit SharedSequence(std::shared_ptr<parlay::sequence<T>> s) : seq(std::move(s)) {}
+
+ public:
+  SharedSequence() : seq(std::make_shared<parlay::sequence<T>>()) {}
+  SharedSequence(parlay::sequence<T> &&s)
+      : seq(std::make_shared<parlay::sequence<T>>(std::move(s))) {}
+  SharedSequence(const SharedSequence &other) : SharedSequence(parlay::sequence<T>(*other.seq)) {}
+  SharedSequence(SharedSequence &&other) = default;
+  SharedSequence &operator=(const SharedSequence &other) { return *this = SharedSequence(other); }
+  SharedSequence &operator=(SharedSequence &&other) = default;
+
+  SharedSequence share() const { return SharedSequence(seq); }
+  bool shared() const { return seq.use_count() > 1; }
+
+  parlay::sequence<T> &operator*() { return *seq; }
+  const parlay::sequence<T> &operator*() const { return *seq; }
+
+  size_t size() const { return seq->size(); }
+  auto begin() { return seq->begin(); }
+  auto end() { return seq->end(); }
+  auto begin() const { return std::as_const(*seq).begin(); }
+  auto end() const { return std::as_const(*seq).end(); }
+  T &operator[](size_t i) { return (*seq)[i]; }
+  const T &operator[](size_t i) const { return std::as_const(*seq)[i]; }
+  auto cut(size_t s, size_t e) { return seq->cut(s, e); }
+  auto cut(size_t s, size_t e) const { return std::as_const(*seq).cut(s, e); }
+};
+
+#endif  // KDTREE_SHARED_COW_H
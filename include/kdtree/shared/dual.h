@@ -24,21 +24,15 @@ parlay::sequence<const point<dim> *> dualKnn(parlay::sequence<objT> &queries,
 #endif
 
   auto ret = rTree.dualKnnBase(qTree, k);  // call dual knn
-  queries = std::move(qTree.items);        // move the query points back
+  queries = std::move(*qTree.items);       // move the query points back
 
   return ret;
 }
 
-template <int NUM_TREES,         // the number of static trees
-          int BUFFER_LOG2_SIZE,  // the size of the (dynamic) buffer tree
-          int dim,
-          class objT,
-          bool parallel,
-          bool coarsen>
-parlay::sequence<const point<dim> *> dualKnn(
-    parlay::sequence<objT> &queries,
-    const LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, objT, parallel, coarsen> &rTree,
-    int k) {
+template <int dim, class objT, bool parallel, bool coarsen>
+parlay::sequence<const point<dim> *> dualKnn(parlay::sequence<objT> &queries,
+                                             const LogTree<dim, objT, parallel, coarsen> &rTree,
+                                             int k) {
   // construct query tree
 #ifdef PRINT_DKNN_TIMINGS
   timer t;
@@ -50,33 +44,53 @@ parlay::sequence<const point<dim> *> dualKnn(
 #endif
 
   auto ret = rTree.dualKnnBase(qTree, k);  // call dual knn
-  queries = std::move(qTree.items);        // move the query points back
+  queries = std::move(*qTree.items);       // move the query points back
 
   return ret;
 }
 
+/*!
+ * The children of [n] (a node of [tree]) that have points -> [out]; returns how many there are.
+ */
+template <int dim, class nodeT, class treeT>
+int dualKnnChildren(nodeT *n, const treeT &tree, DualKnnNode<dim, nodeT> out[2]) {
+  auto tree_items = tree.getItems();
+  auto items_start = tree_items.first.begin();
+  int num_children = 0;
+  for (bool r : {false, true}) {
+    auto &child = out[num_children];
+    if (n->childBoundingBox(r, items_start, tree_items.second, child.pMin, child.pMax)) {
+      child.node = n->getChild(r);
+      child.start = n->getChildStartIdx(r);
+      child.end = n->getChildEndIdx(r);
+      num_children++;
+    }
+  }
+  return num_children;
+}
+
 template <int dim, class objT, bool parallel, bool coarsenq, bool coarsenr>
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
-void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
-                   const kdNode<dim, objT, parallel> *R,
+void DualKnnHelper(DualKnnNode<dim, kdNode<dim, objT, parallel>> Q,
+                   DualKnnNode<dim, const kdNode<dim, objT, parallel>> R,
                    const KdTree<dim, objT, parallel, coarsenq> &qTree,
                    parlay::sequence<double> &dualKnnDists,
                    const KdTree<dim, objT, parallel, coarsenr> &rTree,
                    parlay::slice<knnBuf::buffer<const point<dim> *> *,
                                  knnBuf::buffer<const point<dim> *> *> &bufs) {
 #else
-void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
-                   const kdNode<dim, objT, parallel> *R,
+void DualKnnHelper(DualKnnNode<dim, kdNode<dim, objT, parallel>> Q,
+                   DualKnnNode<dim, const kdNode<dim, objT, parallel>> R,
                    const KdTree<dim, objT, parallel, coarsenq> &qTree,
                    const KdTree<dim, objT, parallel, coarsenr> &rTree,
                    parlay::slice<knnBuf::buffer<const point<dim> *> *,
                                  knnBuf::buffer<const point<dim> *> *> &bufs) {
 #endif
   typedef kdNode<dim, objT, parallel> nodeT;
-  // if (!Q || !R) return;
-  assert(Q && R);
+  typedef DualKnnNode<dim, nodeT> qNodeT;
+  typedef DualKnnNode<dim, const nodeT> rNodeT;
 
-  auto recurse = [&](kdNode<dim, objT, parallel> *_Q, const kdNode<dim, objT, parallel> *_R) {
+  auto recurse = [&](const qNodeT &_Q, const rNodeT &_R) {
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
     DualKnnHelper(_Q, _R, qTree, dualKnnDists, rTree, bufs);
 #else
@@ -84,127 +98,89 @@ void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
 #endif
   };
 
-  // if either node has only a single child, just forward the call
-  if (Q->getLeft() && !Q->getRight()) {
-    recurse(Q->getLeft(), R);
-    return;
-  } else if (!Q->getLeft() && Q->getRight()) {
-    recurse(Q->getRight(), R);
-    return;
-  } else if (R->getLeft() && !R->getRight()) {
-    recurse(Q, R->getLeft());
-    return;
-  } else if (!R->getLeft() && R->getRight()) {
-    recurse(Q, R->getRight());
-    return;
-  }
-
-  // either a leaf or a node with 2 children
-  assert(Q->isLeaf() || (Q->getLeft() && Q->getRight()));
-  assert(R->isLeaf() || (R->getLeft() && R->getRight()));
-
-  // order calls based on bbox distance (TODO: does this actually help?)
-  // used below for the one-sided recursion cases
-  auto one_sided_recurse =
-      [&](bool recurseInParallel, nodeT *Q1, const nodeT *R1, nodeT *Q2, const nodeT *R2) {
-        auto dist1 = KdNodeBoundingBoxDistance(Q1, R1);
-        auto dist2 = KdNodeBoundingBoxDistance(Q2, R2);
-        if (dist1 < dist2) {  // 1 before 2
-          if (recurseInParallel) {
-            parlay::par_do([&]() { recurse(Q1, R1); }, [&]() { recurse(Q2, R2); });
-          } else {
-            recurse(Q1, R1);
-            recurse(Q2, R2);
-          }
-        } else {  // 2 before 1
-          if (recurseInParallel) {
-            parlay::par_do([&]() { recurse(Q2, R2); }, [&]() { recurse(Q1, R1); });
-          } else {
-            recurse(Q2, R2);
-            recurse(Q1, R1);
-          }
-        }
-      };
-
+  // the kNN radius of [_Q]: kept by an interior node, found from the buffers for a leaf
+  auto q_dist = [&](const qNodeT &_Q) -> double {
+    if (_Q.node == nullptr) return nodeT::leafDualKnnDist(_Q.start, _Q.end, bufs);
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
-  if (KdNodeBoundingBoxDistance(Q, R) > dualKnnDists[qTree.node_idx(Q)]) {
+    return dualKnnDists[qTree.node_idx(_Q.node)];
 #else
-  if (KdNodeBoundingBoxDistance(Q, R) > Q->dualKnnDist) {
+    return _Q.node->getDualKnnDist();
 #endif
+  };
+
+  auto box_dist = [&](const qNodeT &_Q, const rNodeT &_R) {
+    return BoundingBoxDistanceSqr(_Q.pMin, _Q.pMax, _R.pMin, _R.pMax);
+  };
+
+  if (box_dist(Q, R) > q_dist(Q)) {
     // definitely no updates here
     return;
-  } else if (Q->isLeaf() && R->isLeaf()) {  // reached leaves -> update!
+  } else if (Q.node == nullptr && R.node == nullptr) {  // reached leaves -> update!
     // get the indices of the items in Q
-    const auto &q_items = qTree.items;
-    auto q_start = Q->getStartValue() - q_items.begin();
-    auto q_end = Q->getEndValue() - q_items.begin();
-    assert(q_end > q_start);
-    assert(q_start >= 0);
-    assert(Q->subtree_items.size() == (size_t)(q_end - q_start));
+    auto q_items = qTree.getItems().first;
+    auto r_present = rTree.getItems().second;
+    assert(Q.end > Q.start);
     assert(qTree.size() == q_items.size());
 
     // leaves are small -> don't bother parallelizing
-    double Q_new_radius = 0;
-    for (auto q_idx = (size_t)q_start; q_idx < (size_t)q_end; q_idx++) {
-      assert(q_idx >= 0);
+    for (auto q_idx = Q.start; q_idx < Q.end; q_idx++) {
       assert(q_idx < bufs.size());
       auto &q_out = bufs[q_idx];
       auto q_radius = q_out.hasK() ? q_out.keepK().cost : std::numeric_limits<double>::max();
 
       // relax in all the points in R
-      R->knnAddToBuffer(q_items[q_idx], rTree.items.begin(), rTree.present, q_out, q_radius);
-
-      // update the new radius
-      auto q_new_radius = q_out.hasK() ? q_out.keepK().cost : std::numeric_limits<double>::max();
-      Q_new_radius = std::max(Q_new_radius, q_new_radius);
+      nodeT::knnAddToBuffer(R.start, R.end, q_items[q_idx], rTree.leafScan(), r_present, q_out,
+                            q_radius);
     }
+    // the new radius of the Q leaf is read from the buffers when needed
+    return;
+  }
 
-#if (DUAL_KNN_MODE == DKNN_ARRAY)
-    dualKnnDists[qTree.node_idx(Q)] = Q_new_radius;
-#else
-    Q->update_dual_knn_dist(Q_new_radius);
-#endif
-  } else if (Q->isLeaf()) {
-    // cannot recurse in parallel because Q is the same in both cases
-    one_sided_recurse(false, Q, R->getLeft(), Q, R->getRight());
-  } else if (R->isLeaf()) {
-    one_sided_recurse(parallel && Q->dualKnnRecurseInParallel(), Q->getLeft(), R, Q->getRight(), R);
+  // descend into the children of the interior side(s): every Q part is paired with every R part,
+  // the R parts in order of bbox distance (TODO: does this actually help?)
+  qNodeT q_parts[2];
+  rNodeT r_parts[2];
+  int num_q = 1, num_r = 1;
+  if (Q.node) {
+    num_q = dualKnnChildren(Q.node, qTree, q_parts);
+  } else {
+    q_parts[0] = Q;
+  }
+  if (R.node) {
+    num_r = dualKnnChildren(R.node, rTree, r_parts);
+  } else {
+    r_parts[0] = R;
+  }
 
-#if (DUAL_KNN_MODE == DKNN_ARRAY)
-    dualKnnDists[qTree.node_idx(Q)] =
-        std::max(dualKnnDists[qTree.node_idx(Q->left)], dualKnnDists[qTree.node_idx(Q->right)]);
-#else
-    Q->update_dual_knn_dist(std::max(Q->left->dualKnnDist, Q->right->dualKnnDist));
-#endif
-  } else {  // neither is leaf, all 4 recursive steps
-    auto QlRl_dist = KdNodeBoundingBoxDistance(Q->getLeft(), R->getLeft());
-    auto QlRr_dist = KdNodeBoundingBoxDistance(Q->getLeft(), R->getRight());
-    // closer R child to Q->getLeft()
-    auto Ql_R1 = (QlRl_dist < QlRr_dist) ? R->getLeft() : R->getRight();
-    // further R child to Q->getLeft()
-    auto Ql_R2 = (QlRl_dist < QlRr_dist) ? R->getRight() : R->getLeft();
-
-    auto QrRl_dist = KdNodeBoundingBoxDistance(Q->getRight(), R->getLeft());
-    auto QrRr_dist = KdNodeBoundingBoxDistance(Q->getRight(), R->getRight());
-    auto Qr_R1 = (QrRl_dist < QrRr_dist) ? R->getLeft() : R->getRight();
-    auto Qr_R2 = (QrRl_dist < QrRr_dist) ? R->getRight() : R->getLeft();
-
-    if (parallel && (Q->dualKnnRecurseInParallel() || R->dualKnnRecurseInParallel())) {
-      parlay::par_do([&]() { recurse(Q->getLeft(), Ql_R1); },
-                     [&]() { recurse(Q->getRight(), Qr_R1); });
-      parlay::par_do([&]() { recurse(Q->getLeft(), Ql_R2); },
-                     [&]() { recurse(Q->getRight(), Qr_R2); });
+  auto recurse_part = [&](const qNodeT &_Q) {
+    if (num_r == 2 && box_dist(_Q, r_parts[1]) < box_dist(_Q, r_parts[0])) {
+      recurse(_Q, r_parts[1]);
+      recurse(_Q, r_parts[0]);
     } else {
-      recurse(Q->getLeft(), Ql_R1);
-      recurse(Q->getRight(), Qr_R1);
-      recurse(Q->getLeft(), Ql_R2);
-      recurse(Q->getRight(), Qr_R2);
+      for (int i = 0; i < num_r; i++)
+        recurse(_Q, r_parts[i]);
     }
+  };
+  // the two Q parts are disjoint, so they can go in parallel (a Q leaf is paired serially)
+  auto in_parallel = [&](const auto &n) {
+    return n.node && n.node->hasChild(false) && n.node->hasChild(true) &&
+           n.end - n.start >= DUALKNN_BASE_CASE;
+  };
+  if (parallel && num_q == 2 && (in_parallel(Q) || in_parallel(R))) {
+    parlay::par_do([&]() { recurse_part(q_parts[0]); }, [&]() { recurse_part(q_parts[1]); });
+  } else {
+    for (int i = 0; i < num_q; i++)
+      recurse_part(q_parts[i]);
+  }
+
+  if (Q.node) {
+    double new_dist = 0;
+    for (int i = 0; i < num_q; i++)
+      new_dist = std::max(new_dist, q_dist(q_parts[i]));
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
-    dualKnnDists[qTree.node_idx(Q)] =
-        std::max(dualKnnDists[qTree.node_idx(Q->left)], dualKnnDists[qTree.node_idx(Q->right)]);
+    dualKnnDists[qTree.node_idx(Q.node)] = new_dist;
 #else
-    Q->update_dual_knn_dist(std::max(Q->left->dualKnnDist, Q->right->dualKnnDist));
+    Q.node->update_dual_knn_dist(new_dist);
 #endif
   }
 }
@@ -0,0 +1,103 @@
+#ifndef KDTREE_SHARED_EPOCH_H
+#define KDTREE_SHARED_EPOCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*!
+ * Epoch-based reclamation for one writer and any number of readers. A reader pins the current
+ * epoch (in one of [num_slots] slots) for as long as it uses the shared objects; the writer
+ * [retire]s an object once no new reader can reach it, and [reclaim] frees the objects retired
+ * before the oldest epoch still pinned. Every epoch and slot access is sequentially consistent:
+ * a reader that pins an epoch after an object was retired cannot reach it.
+ */
+class EpochManager {
+  static constexpr uint64_t UNPINNED = 0;
+
+  struct alignas(64) Slot {  // one per cache line: readers pin and unpin them independently
+    std::atomic<uint64_t> epoch{UNPINNED};
+  };
+
+  std::atomic<uint64_t> global_epoch;
+  size_t num_slots;
+  std::unique_ptr<Slot[]> slots;
+  std::vector<std::pair<uint64_t, std::function<void()>>> retired;  // by epoch; writer only
+
+ public:
+  /*!
+   * Keeps an epoch pinned until it is destroyed.
+   */
+  class Guard {
+    Slot* slot;
+
+   public:
+    explicit Guard(Slot* slot_) : slot(slot_) {}
+    Guard(Guard&& other) : slot(std::exchange(other.slot, nullptr)) {}
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    ~Guard() {
+      if (slot) slot->epoch = UNPINNED;
+    }
+  };
+
+  explicit EpochManager(size_t num_slots_ = 64)
+      : global_epoch(UNPINNED + 1), num_slots(num_slots_), slots(new Slot[num_slots_]) {}
+  // No reader may be pinned any more
+  ~EpochManager() {
+    for (auto& r : retired)
+      r.second();
+  }
+
+  /*!
+   * <Thread-safe> Pin the current epoch. Waits while all the slots are pinned.
+   */
+  Guard pin() const {
+    auto start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (size_t i = 0;; i++) {
+      auto& slot = slots[(start + i) % num_slots];
+      uint64_t expected = UNPINNED;
+      if (slot.epoch == UNPINNED && slot.epoch.compare_exchange_strong(expected, global_epoch)) {
+        return Guard(&slot);
+      }
+      if (i % num_slots == num_slots - 1) std::this_thread::yield();
+    }
+  }
+
+  /*!
+   * Run [free_f] once the readers that may still use an object are gone. The object must already
+   * be unreachable for readers that pin an epoch from now on.
+   */
+  void retire(std::function<void()> free_f) {
+    retired.emplace_back(global_epoch++, std::move(free_f));
+  }
+
+  /*!
+   * Free the retired objects that no pinned reader can use. Returns the number freed.
+   */
+  size_t reclaim() {
+    auto oldest = UINT64_MAX;
+    for (size_t i = 0; i < num_slots; i++) {
+      auto e = slots[i].epoch.load();
+      if (e != UNPINNED) oldest = std::min(oldest, e);
+    }
+    size_t num_freed = 0;
+    while (num_freed < retired.size() && retired[num_freed].first < oldest) {
+      retired[num_freed++].second();
+    }
+    retired.erase(retired.begin(), retired.begin() + num_freed);
+    return num_freed;
+  }
+
+  /*!
+   * Number of retired objects not freed yet.
+   */
+  size_t pending() const { return retired.size(); }
+};
+
+#endif  // KDTREE_SHARED_EPOCH_H
@@ -0,0 +1,34 @@
+#ifndef KDTREE_SHARED_IDPOINT_H
+#define KDTREE_SHARED_IDPOINT_H
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include "common/geometry.h"
+
+/*!
+ * A point carrying a user ID (or any small payload), for use as a tree's [objT]. Only the spatial
+ * part takes part in [coordinate()] and [==], so erase/contains match on coordinates alone, while
+ * range queries and [knnItems] return copies that keep the ID and stay valid across rebuilds.
+ */
+template <int dim, class idT = uint32_t>
+class idPoint : public point<dim> {
+ public:
+  typedef idT idType;
+
+  idT id;
+
+  idPoint() : point<dim>(), id() {}
+  idPoint(const point<dim> &p, idT t_id) : point<dim>(p), id(t_id) {}
+  // coordinates only (query boxes, bounding boxes): no ID
+  idPoint(const point<dim> &p) : point<dim>(p), id() {}
+  idPoint(const double *p) : point<dim>(p), id() {}
+};
+
+// Whether [objT] carries an [id] member (e.g. [idPoint]); trees then keep an ID locator
+template <class objT, class = void>
+struct hasId : std::false_type {};
+template <class objT>
+struct hasId<objT, std::void_t<decltype(std::declval<objT>().id)>> : std::true_type {};
+
+#endif  // KDTREE_SHARED_IDPOINT_H
@@ -2,6 +2,8 @@
 #define KDNODE_H
 
 #include <atomic>
+#include <cstdint>
+#include <limits>
 #include "parlay/parallel.h"
 #include "parlay/sequence.h"
 #include "common/geometry.h"
@@ -9,10 +11,36 @@
 #include "macro.h"
 #include "knnbuffer.h"
 #include "box.h"
+#include "leafscan.h"
+#include "bitmap.h"
+#include "cow.h"
 
 template <int dim, class objT, bool parallel, bool coarsen>
 class KdTree;
 
+// A contiguous range of a tree's [items] touched by a range (box or ball) query: either a subtree
+// that is fully inside the query region (take every present point) or an overlapping leaf
+// ([check]: test each present point against the region). [count] and [offset] are filled in by the
+// counting pass and the prefix sum over the counts, respectively.
+struct RangeSegment {
+  uint32_t start, end;
+  bool check;
+  size_t count;
+  size_t offset;
+};
+
+/*!
+ * Set [offset] of each segment to [base] + (prefix sum of the counts). Returns the total count.
+ */
+inline size_t rangeSegmentOffsets(parlay::sequence<RangeSegment> &segs, size_t base = 0) {
+  size_t total = base;
+  for (auto &seg : segs) {
+    seg.offset = total;
+    total += seg.count;
+  }
+  return total - base;
+}
+
 // make dim intrinsic to objt todo
 template <int dim, class objT, bool parallel>
 class kdNode {
@@ -21,67 +49,78 @@ class kdNode {
   typedef point<dim> pointT;
   typedef kdNode<dim, objT, parallel> nodeT;
 
-  // TODO: split leaf/non-leaf node data
-  // leaf nodes
-  int num_points;
-  // non-leaf node
-  int split_dimension;  // TODO: think about making this dynamic, instead of alternating
-  floatT split_value;
-
-  // all nodes
-  parlay::slice<objT *, objT *> subtree_items;  // TODO: make these const pointers
+  // Node record, for interior nodes only: its bounding box, the range of [items] it covers, and
+  // its split. Leaves have no record: a leaf child is a tag in its parent's link, and covers the
+  // parent's range on its side of [split_offset] (the box of its present points is found from the
+  // points when needed), so a tree of n leaves has n - 1 records. Children are 32-bit offsets
+  // relative to this node in the node array, so the record needs neither the tree's node base nor
+  // 64-bit pointers. The number of items not yet deleted is kept by the tree, in a copy-on-write
+  // array indexed like the nodes ([live_counts]), so that erasing from a tree shared with a
+  // snapshot does not have to copy the records. At dim=2 the record is 64 bytes, plus 8 for
+  // [dualKnnDist] unless DUAL_KNN_MODE == DKNN_ARRAY.
   pointT pMin, pMax;
 
-  // Node pointers
-  nodeT *left;
-  nodeT *right;
+  uint32_t items_start;  // subtree covers [items_start, items_start + items_count) of [items]
+  uint32_t items_count;
 
-  // dual knn distances (only used for queries)
+  int32_t left;   // (child - this) for an interior child, LEAF_CHILD for a leaf; 0 => no child
+  int32_t right;  // (child - this) for an interior child, LEAF_CHILD for a leaf; 0 => no child
+
+  int32_t split_dimension;  // EMPTY_DIMENSION for an unused record (debug builds only)
+  uint32_t split_offset;    // the left child covers [items_start, items_start + split_offset)
+  floatT split_value;
+
+  static constexpr int32_t EMPTY_DIMENSION = -2;
+  static constexpr int32_t LEAF_CHILD = std::numeric_limits<int32_t>::min();
+
+  // dual knn distances (only used for queries); squared, like [knnBuf::elem::cost]
 #if (DUAL_KNN_MODE == DKNN_ATOMIC_LEAF)
   std::atomic<double> dualKnnDist;
 #elif (DUAL_KNN_MODE == DKNN_NONATOMIC_LEAF)
   double dualKnnDist;
 #endif
 
+  static inline int32_t childOffset(const nodeT *from, const nodeT *to) {
+    if (to == nullptr) return 0;
+    assert(to != from);
+    return (int32_t)(to - from);
+  }
+  int32_t link(bool right_child) const { return right_child ? right : left; }
+  int32_t &link(bool right_child) { return right_child ? right : left; }
+
   bool computeRangeQueryInParallel() const {
-    return false;
     if (!left || !right) return false;  // only one child
-    return subtree_items.size() >= RANGEQUERY_BASE_CASE;
+    return items_count >= RANGEQUERY_BASE_CASE;
   }
   bool computeBoundingBoxInParallel() const {
     if (!left || !right) return false;  // only one child
-    return subtree_items.size() >= BOUNDINGBOX_BASE_CASE;
-  }
-  bool dualKnnRecurseInParallel() const {
-    if (!left || !right) return false;  // only one child
-    return subtree_items.size() >= DUALKNN_BASE_CASE;
+    return items_count >= BOUNDINGBOX_BASE_CASE;
   }
 
  public:
-  // non-leaf
-  kdNode(int split_dimension_, floatT split_value_, parlay::slice<objT *, objT *> subtree_items_)
-      : num_points(-1),
+  /*!
+   * Node splitting [subtree_items_] at [split_value_] in [split_dimension_]: its first
+   * [split_offset_] items go to the left child. It has no children until they are set.
+   */
+  kdNode(int split_dimension_,
+         floatT split_value_,
+         size_t split_offset_,
+         parlay::slice<objT *, objT *> subtree_items_,
+         const objT *tree_start)
+      : items_start((uint32_t)(subtree_items_.begin() - tree_start)),
+        items_count((uint32_t)subtree_items_.size()),
+        left(0),
+        right(0),
         split_dimension(split_dimension_),
-        split_value(split_value_),
-        subtree_items(std::move(subtree_items_)),
-        left(nullptr),
-        right(nullptr)
+        split_offset((uint32_t)split_offset_),
+        split_value(split_value_)
 #if (DUAL_KNN_MODE != DKNN_ARRAY)
         ,
         dualKnnDist(std::numeric_limits<double>::max())
 #endif
   {
-  }
-  // leaf
-  kdNode(parlay::slice<objT *, objT *> subtree_items_) : kdNode(-1, 0, subtree_items_) {
-    assert(subtree_items.size() > 0);
-    num_points = subtree_items.size();
-    pMin = pointT(subtree_items[0].coordinate());
-    pMax = pointT(subtree_items[0].coordinate());
-    for (const auto &pt : subtree_items) {
-      pMin.minCoords(pt.coordinate());
-      pMax.maxCoords(pt.coordinate());
-    }
+    assert(subtree_items_.begin() >= tree_start);
+    assert(split_offset_ <= subtree_items_.size());
   }
 
   // Modifiers
@@ -96,45 +135,33 @@ class kdNode {
                       const kdNode<dim, objT, parallel> *nodes,
                       parlay::sequence<double> &dualKnnDists) {
 #endif
-    double new_rad = 0;
-    if (isLeaf() && buf_slice[subtree_items.begin() - tree_start].hasK()) {
-      for (auto it = subtree_items.begin(); it != subtree_items.end(); ++it) {
-        auto idx = it - tree_start;
-        new_rad = std::max(new_rad, buf_slice[idx].keepK().cost);
-      }
-    } else {
-      auto update_node = [&](kdNode<dim, objT, parallel> *n) {
+    auto child_dist = [&](bool r) -> double {
+      if (!hasChild(r)) return 0;
+      if (isLeafChild(r)) return leafDualKnnDist(getChildStartIdx(r), getChildEndIdx(r), buf_slice);
+      auto n = getChild(r);
 #if (DUAL_KNN_MODE != DKNN_ARRAY)
-        n->updateDualDist(buf_slice, tree_start);
+      n->updateDualDist(buf_slice, tree_start);
 #else
-        n->updateDualDist(buf_slice, tree_start, nodes, dualKnnDists);
+      n->updateDualDist(buf_slice, tree_start, nodes, dualKnnDists);
 #endif
-      };
-
-      auto node_dist = [&](const kdNode<dim, objT, parallel> *n) {
 #if (DUAL_KNN_MODE == DKNN_ATOMIC_LEAF)
-        return n->dualKnnDist.load();
+      return n->dualKnnDist.load();
 #elif (DUAL_KNN_MODE == DKNN_NONATOMIC_LEAF)
-        return n->dualKnnDist;
+      return n->dualKnnDist;
 #else
       return dualKnnDists[n - nodes];
 #endif
-      };
+    };
 
-      if (parallel && computeBoundingBoxInParallel()) {
-        parlay::par_do([&]() { update_node(left); }, [&]() { update_node(right); });
-        new_rad = std::max(node_dist(left), node_dist(right));
-      } else {
-        if (left) {
-          update_node(left);
-          new_rad = std::max(new_rad, node_dist(left));
-        }
-        if (right) {
-          update_node(right);
-          new_rad = std::max(new_rad, node_dist(right));
-        }
-      }
+    double left_dist, right_dist;
+    if (parallel && computeBoundingBoxInParallel()) {
+      parlay::par_do([&]() { left_dist = child_dist(false); },
+                     [&]() { right_dist = child_dist(true); });
+    } else {
+      left_dist = child_dist(false);
+      right_dist = child_dist(true);
     }
+    auto new_rad = std::max(left_dist, right_dist);
 #if (DUAL_KNN_MODE != DKNN_ARRAY)
     update_dual_knn_dist(new_rad);
 #else
@@ -142,6 +169,22 @@ class kdNode {
 #endif
   }
 
+  /*!
+   * Dual kNN radius of the leaf [start, end): the largest k-th distance in its queries' buffers
+   * (unbounded while one of them has fewer than k candidates).
+   */
+  static double leafDualKnnDist(size_t start,
+                                size_t end,
+                                const parlay::slice<knnBuf::buffer<const pointT *> *,
+                                                    knnBuf::buffer<const pointT *> *> &buf_slice) {
+    double rad = 0;
+    for (auto idx = start; idx < end; idx++) {
+      if (!buf_slice[idx].hasK()) return std::numeric_limits<double>::max();
+      rad = std::max(rad, buf_slice[idx].keepK().cost);
+    }
+    return rad;
+  }
+
 #if (DUAL_KNN_MODE != DKNN_ARRAY)
   inline void update_dual_knn_dist(const double new_val) {
 #if (DUAL_KNN_MODE == DKNN_ATOMIC_LEAF)
@@ -154,206 +197,318 @@ class kdNode {
     dualKnnDist = new_val;
 #endif
   }
+  double getDualKnnDist() const { return dualKnnDist; }
 #endif
 
-  void removePoints(int num) {
-    assert(isLeaf());
-    assert(num >= 0);
-    assert(num <= num_points);
-    num_points -= num;
+  // cover [start, start + count) of [items] instead, e.g. after an insert moved the items
+  void setItemRange(size_t start, size_t count) {
+    items_start = (uint32_t)start;
+    items_count = (uint32_t)count;
   }
-  void setLeft(nodeT *p) { left = p; }
-  void setRight(nodeT *p) { right = p; }
-  void setEmpty() { split_dimension = -2; }
-
-  void recomputeBoundingBox() {
-    // assumes child bounding boxes are computed
-    if (left && right) {
-      pMin = pointT(left->getMin().coordinate());
-      pMax = pointT(left->getMax().coordinate());
-      pMin.minCoords(right->getMin().coordinate());
-      pMax.maxCoords(right->getMax().coordinate());
-    } else if (left) {
-      pMin = pointT(left->getMin().coordinate());
-      pMax = pointT(left->getMax().coordinate());
-    } else if (right) {
-      pMin = pointT(right->getMin().coordinate());
-      pMax = pointT(right->getMax().coordinate());
-    } else {
-      assert(isLeaf());
+  // the left child covers the first [offset] items, e.g. after an insert moved them
+  void setSplitOffset(size_t offset) { split_offset = (uint32_t)offset; }
+  // [p]: an interior child, or nullptr for none
+  void setChild(bool right_child, nodeT *p) { link(right_child) = childOffset(this, p); }
+  void setLeafChild(bool right_child) { link(right_child) = LEAF_CHILD; }
+  void setLeft(nodeT *p) { setChild(false, p); }
+  void setRight(nodeT *p) { setChild(true, p); }
+  void setEmpty() { split_dimension = EMPTY_DIMENSION; }
+
+  /*!
+   * Bounding box of the present points among items [start, end) (a leaf) -> [lo, hi]. Returns
+   * false, leaving [lo, hi] as they are, if there are none.
+   */
+  static bool leafBoundingBox(size_t start,
+                              size_t end,
+                              const objT *tree_start,
+                              const LiveBitmap &present,
+                              pointT &lo,
+                              pointT &hi) {
+    bool first = true;
+    for (auto i = start; i < end; i++) {
+      if (!present[i]) continue;
+      if (first) {
+        lo = pointT(tree_start[i].coordinate());
+        hi = pointT(tree_start[i].coordinate());
+        first = false;
+      } else {
+        lo.minCoords(tree_start[i].coordinate());
+        hi.maxCoords(tree_start[i].coordinate());
+      }
     }
+    return !first;
   }
 
-  void recomputeBoundingBoxLeaf(const objT *tree_start, const parlay::sequence<bool> &present) {
-    assert(isLeaf());
-    bool first = true;
-    for (auto it = subtree_items.begin(); it != subtree_items.end(); ++it) {
-      if (present[it - tree_start]) {
-        if (first) {
-          pMin = pointT(it->coordinate());
-          pMax = pointT(it->coordinate());
-          first = false;
-        } else {
-          pMin.minCoords(it->coordinate());
-          pMax.maxCoords(it->coordinate());
-        }
+  // Bounding box of child [right_child] -> [lo, hi]; false if it is missing or has no points
+  bool childBoundingBox(bool right_child,
+                        const objT *tree_start,
+                        const LiveBitmap &present,
+                        pointT &lo,
+                        pointT &hi) const {
+    if (!hasChild(right_child)) return false;
+    if (isLeafChild(right_child))
+      return leafBoundingBox(getChildStartIdx(right_child), getChildEndIdx(right_child),
+                             tree_start, present, lo, hi);
+    lo = getChild(right_child)->getMin();
+    hi = getChild(right_child)->getMax();
+    return true;
+  }
+
+  void recomputeBoundingBox(const objT *tree_start, const LiveBitmap &present) {
+    // assumes the bounding boxes of interior children are computed
+    pointT lo, hi;
+    bool any = false;
+    for (bool r : {false, true}) {
+      if (!childBoundingBox(r, tree_start, present, lo, hi)) continue;
+      if (!any) {
+        pMin = lo;
+        pMax = hi;
+        any = true;
+      } else {
+        pMin.minCoords(lo);
+        pMax.maxCoords(hi);
       }
     }
   }
 
   // recompute for entire subtree
-  void recomputeBoundingBoxSubtree() {
-    if (parallel && computeBoundingBoxInParallel()) {
-      parlay::par_do([&]() { left->recomputeBoundingBoxSubtree(); },
-                     [&]() { right->recomputeBoundingBoxSubtree(); });
+  void recomputeBoundingBoxSubtree(const objT *tree_start, const LiveBitmap &present) {
+    auto left_child = getLeft(), right_child = getRight();
+    if (parallel && left_child && right_child && computeBoundingBoxInParallel()) {
+      parlay::par_do([&]() { left_child->recomputeBoundingBoxSubtree(tree_start, present); },
+                     [&]() { right_child->recomputeBoundingBoxSubtree(tree_start, present); });
     } else {
-      if (left) left->recomputeBoundingBoxSubtree();
-      if (right) right->recomputeBoundingBoxSubtree();
+      if (left_child) left_child->recomputeBoundingBoxSubtree(tree_start, present);
+      if (right_child) right_child->recomputeBoundingBoxSubtree(tree_start, present);
     }
-    recomputeBoundingBox();
+    recomputeBoundingBox(tree_start, present);
   }
 
   // Getters
   const pointT &getMin() const { return pMin; }
   const pointT &getMax() const { return pMax; }
-  nodeT *getLeft() const { return left; }
-  nodeT *getRight() const { return right; }
-  bool isLeaf() const { return (left == nullptr) && (right == nullptr); }
-  bool isEmpty() const { return split_dimension == -2; }
-
-  int countPoints() const {
-    if (isLeaf()) return num_points;
-    return left->countPoints() + right->countPoints();
+  bool hasChild(bool right_child) const { return link(right_child) != 0; }
+  bool isLeafChild(bool right_child) const { return link(right_child) == LEAF_CHILD; }
+  // the interior child on side [right_child]; nullptr for a leaf or no child
+  nodeT *getChild(bool right_child) const {
+    auto offset = link(right_child);
+    return (offset != 0 && offset != LEAF_CHILD) ? const_cast<nodeT *>(this) + offset : nullptr;
   }
-
-  const auto &getValues() const {
-    assert(isLeaf());
-    return subtree_items;
+  nodeT *getLeft() const { return getChild(false); }
+  nodeT *getRight() const { return getChild(true); }
+  bool isEmpty() const { return split_dimension == EMPTY_DIMENSION; }
+
+  // the range of [items] covered by this subtree
+  size_t getStartIdx() const { return items_start; }
+  size_t getEndIdx() const { return (size_t)items_start + items_count; }
+  size_t getNumItems() const { return items_count; }
+  // the range of [items] on side [right_child] of the split (exactly a leaf child's range)
+  size_t getChildStartIdx(bool right_child) const {
+    return right_child ? (size_t)items_start + split_offset : items_start;
   }
-
-  const objT *getStartValue() const { return subtree_items.begin(); }
-  const objT *getEndValue() const { return subtree_items.end(); }
-
-  int getSplitDimension() const {
-    assert(!isLeaf());
-    return split_dimension;
+  size_t getChildEndIdx(bool right_child) const {
+    return right_child ? getEndIdx() : (size_t)items_start + split_offset;
   }
-  floatT getSplitValue() const {
-    assert(!isLeaf());
-    return split_value;
+
+  parlay::slice<const objT *, const objT *> getValues(const objT *tree_start) const {
+    return parlay::slice(tree_start + getStartIdx(), tree_start + getEndIdx());
   }
 
+  int getSplitDimension() const { return split_dimension; }
+  floatT getSplitValue() const { return split_value; }
+  size_t getSplitOffset() const { return split_offset; }
+
   // Query
   // MOVED - [contains] is performed in [KdTree]
-  // bool contains(const objT &p, const parlay::sequence<bool> &present) const {
-  // if (isLeaf()) {
-  // for (const auto &pt : subtree_items) {
-  // if (pt == p) return true;
-  //}
-  // return false;
-  //}
-
-  //// internal (non-leaf) node
-  // if (p.coordinate(split_dimension) < split_value) return left->contains(p);
-  // return right->contains(p);
-  //}
-
-  // TODO: can probably make this recurse more intelligently if we precompute return sizes
-  void orthogonalQuery(const objT &qMin,
-                       const objT &qMax,
-                       const objT *tree_start,
-                       const parlay::sequence<bool> &present,
-                       parlay::sequence<objT> &ret) const {
+
+  /*!
+   * Collect the [RangeSegment]s of this subtree that intersect the box [qMin, qMax] into [out].
+   */
+  void orthogonalSegments(const objT &qMin,
+                          const objT &qMax,
+                          parlay::sequence<RangeSegment> &out) const {
     auto cmp = boxCompare(qMin, qMax, pMin, pMax);
     if (cmp == BOX_EXCLUDE) {
       return;
     } else if (cmp == BOX_INCLUDE) {  // query box contains node box -> take all the points
-      // allocate space for new points
-      auto orig_ret_size = ret.size();
-      ret.resize(ret.size() + subtree_items.size());  // TODO: precompute the exact size
-
-      // compute [present] subarray
-      auto start = getStartValue() - tree_start;
-      auto end = getEndValue() - tree_start;
-      assert(end > start);
-      assert(subtree_items.size() == (size_t)(end - start));
+      out.push_back({items_start, items_start + items_count, false, 0, 0});
+    } else {
+      assert(cmp == BOX_OVERLAP);
+      auto child_segments = [&](bool r, parlay::sequence<RangeSegment> &child_out) {
+        if (isLeafChild(r))
+          child_out.push_back(
+              {(uint32_t)getChildStartIdx(r), (uint32_t)getChildEndIdx(r), true, 0, 0});
+        else if (hasChild(r))
+          getChild(r)->orthogonalSegments(qMin, qMax, child_out);
+      };
+      if (parallel && computeRangeQueryInParallel()) {
+        parlay::sequence<RangeSegment> right_out;
+        parlay::par_do([&]() { child_segments(false, out); },
+                       [&]() { child_segments(true, right_out); });
+        out.append(right_out);
+      } else {
+        child_segments(false, out);
+        child_segments(true, out);
+      }
+    }
+  }
 
-      auto num_added = parlay::pack_into(
-          subtree_items, present.cut(start, end), ret.cut(orig_ret_size, ret.size()));
+  // Segments of this subtree for the ball of squared radius [r_sqr] around [q] -> [out]; see
+  // [orthogonalSegments]
+  void radiusSegments(const pointT &q, double r_sqr, parlay::sequence<RangeSegment> &out) const {
+    auto cmp = ballCompare(q, r_sqr, pMin, pMax);
+    if (cmp == BOX_EXCLUDE) {
+      return;
+    } else if (cmp == BOX_INCLUDE) {  // ball contains node box -> take all the points
+      out.push_back({items_start, items_start + items_count, false, 0, 0});
+    } else {
+      assert(cmp == BOX_OVERLAP);
+      auto child_segments = [&](bool r, parlay::sequence<RangeSegment> &child_out) {
+        if (isLeafChild(r))
+          child_out.push_back(
+              {(uint32_t)getChildStartIdx(r), (uint32_t)getChildEndIdx(r), true, 0, 0});
+        else if (hasChild(r))
+          getChild(r)->radiusSegments(q, r_sqr, child_out);
+      };
+      if (parallel && computeRangeQueryInParallel()) {
+        parlay::sequence<RangeSegment> right_out;
+        parlay::par_do([&]() { child_segments(false, out); },
+                       [&]() { child_segments(true, right_out); });
+        out.append(right_out);
+      } else {
+        child_segments(false, out);
+        child_segments(true, out);
+      }
+    }
+  }
 
-      // resize
-      ret.resize(orig_ret_size + num_added);
+  /*!
+   * Number of present points of this subtree inside the box [qMin, qMax]. Stops at subtrees fully
+   * inside the box, using their live count ([live_counts] of the tree whose node array starts at
+   * [nodes]).
+   */
+  size_t orthogonalCount(const objT &qMin,
+                         const objT &qMax,
+                         const LeafScan<dim, objT> &scan,
+                         const LiveBitmap &present,
+                         const nodeT *nodes,
+                         const CowPages<uint32_t> &live_counts) const {
+    auto cmp = boxCompare(qMin, qMax, pMin, pMax);
+    if (cmp == BOX_EXCLUDE) {
+      return 0;
+    } else if (cmp == BOX_INCLUDE) {
+      return live_counts[this - nodes];
     } else {
       assert(cmp == BOX_OVERLAP);
-      if (isLeaf()) {
-        // TODO: maybe do this more intelligently? (precompute and/or parallelize)
-        for (auto it = subtree_items.begin(); it != subtree_items.end(); ++it) {
-          if (present[it - tree_start] && itemInBox(qMin, qMax, it)) {
-            ret.push_back(it);
+      auto child_count = [&](bool r) -> size_t {
+        if (isLeafChild(r)) {
+          size_t count = 0, end = getChildEndIdx(r);
+          for (auto s = getChildStartIdx(r); s < end; s += LEAF_SCAN_CHUNK) {
+            auto n = std::min(LEAF_SCAN_CHUNK, end - s);
+            count += __builtin_popcountll(scan.inBox(qMin, qMax, s, n) & present.bits(s, n));
           }
+          return count;
         }
-      } else if (parallel && computeRangeQueryInParallel()) {
-        assert(left);
-        assert(right);
-
-        parlay::sequence<objT> right_ret;
-
-        parlay::par_do(
-            [&]() { left->orthogonalQuery(qMin, qMax, tree_start, present, ret); },
-            [&]() { right->orthogonalQuery(qMin, qMax, tree_start, present, right_ret); });
-
-        // put right_ret into ret
-        ret.insert(ret.begin() + ret.size(), right_ret.begin(), right_ret.end());
+        auto child = getChild(r);
+        return child ? child->orthogonalCount(qMin, qMax, scan, present, nodes, live_counts) : 0;
+      };
+      if (parallel && computeRangeQueryInParallel()) {
+        size_t left_count, right_count;
+        parlay::par_do([&]() { left_count = child_count(false); },
+                       [&]() { right_count = child_count(true); });
+        return left_count + right_count;
       } else {
-        if (left) left->orthogonalQuery(qMin, qMax, tree_start, present, ret);
-        if (right) right->orthogonalQuery(qMin, qMax, tree_start, present, ret);
+        return child_count(false) + child_count(true);
       }
     }
   }
 
-  void knnAddToBuffer(const pointT &q,
-                      const objT *tree_start,
-                      const parlay::sequence<bool> &present,
-                      knnBuf::buffer<const pointT *> &out,
-                      double radius = std::numeric_limits<double>::max()) const {
+  // Add the present points of items [start, end) within squared distance [radius_sqr] of [q]
+  static void knnAddToBuffer(size_t start,
+                             size_t end,
+                             const pointT &q,
+                             const LeafScan<dim, objT> &scan,
+                             const LiveBitmap &present,
+                             knnBuf::buffer<const pointT *> &out,
+                             double radius_sqr = std::numeric_limits<double>::max()) {
     // TODO: maybe parallelize?
-    auto start = getStartValue() - tree_start;
-    [[maybe_unused]] auto end = getEndValue() - tree_start;
-    assert(end > start);
-    assert(subtree_items.size() == (size_t)(end - start));
-
-    for (size_t i = 0; i < subtree_items.size(); i++) {
-      if (present[start + i]) {  // point isn't deleted
-        auto dist = q.dist(subtree_items[i]);
-        if (dist <= radius) {  // point within radius of interest
-          const pointT *item_ptr = subtree_items.begin() + i;
-          out.insert(knnBuf::elem(dist, item_ptr));
+    assert(start < end);
+
+    double dists[LEAF_SCAN_CHUNK];
+    for (auto s = start; s < end; s += LEAF_SCAN_CHUNK) {
+      auto count = std::min(LEAF_SCAN_CHUNK, end - s);
+      auto live = present.bits(s, count);
+      scan.distSqr(q, s, count, dists);
+      for (size_t j = 0; j < count; j++) {
+        // point isn't deleted and is within radius of interest
+        if (((live >> j) & 1) && dists[j] <= radius_sqr) {
+          const pointT *item_ptr = scan.tree_start + s + j;
+          out.insert(knnBuf::elem(dists[j], item_ptr));
         }
       }
     }
   }
 
+  // Query box of [q] for the squared radius [radius_sqr], shrunk by (1 + eps) for approximate
+  // search
+  inline void knnBox(const pointT &q,
+                     double radius_sqr,
+                     pointT &qMin,
+                     pointT &qMax,
+                     const knnBuf::approxQuery *approx) const {
+    auto radius = std::sqrt(radius_sqr);
+    if (approx) radius *= approx->box_scale;
+    for (int i = 0; i < dim; i++) {
+      qMin[i] = q.coordinate(i) - radius;
+      qMax[i] = q.coordinate(i) + radius;
+    }
+  }
+
+  // Scan leaf child [right_child] (see [knnPrune] for the arguments)
+  template <bool update>
+  void knnLeaf(bool right_child,
+               const pointT &q,
+               const LeafScan<dim, objT> &scan,
+               const LiveBitmap &present,
+               double &radius_sqr,
+               pointT &qMin,
+               pointT &qMax,
+               knnBuf::buffer<const pointT *> &out,
+               knnBuf::approxQuery *approx) const {
+    if (approx && approx->outOfLeaves()) return;  // only reachable once [out] has k candidates
+    if (update) {
+      auto new_radius_sqr = out.keepK().cost;
+      if (new_radius_sqr < radius_sqr) {
+        radius_sqr = new_radius_sqr;
+        knnBox(q, radius_sqr, qMin, qMax, approx);
+      }
+    }
+    knnAddToBuffer(getChildStartIdx(right_child), getChildEndIdx(right_child), q, scan, present,
+                   out, radius_sqr);
+    if (approx) approx->visitLeaf();
+  }
+
+  // [approx]: per-query state of an approximate search (nullptr => exact)
   template <bool update>
   void knnPrune(const pointT &q,
-                const objT *tree_start,
-                const parlay::sequence<bool> &present,
-                double &radius,
+                const LeafScan<dim, objT> &scan,
+                const LiveBitmap &present,
+                double &radius_sqr,
                 pointT &qMin,
                 pointT &qMax,
-                knnBuf::buffer<const pointT *> &out) const {
+                knnBuf::buffer<const pointT *> &out,
+                knnBuf::approxQuery *approx = nullptr) const {
+    if (approx && approx->outOfLeaves()) return;  // only reachable once [out] has k candidates
+
     if (update) {
       // compute current radius
       auto tmp = out.keepK();
-      auto new_radius = tmp.cost;
-
-      // update the query box if necessary
-      if (new_radius < radius) {
-        radius = new_radius;
-        // create box based on radius
-        for (int i = 0; i < dim; i++) {
-          qMin[i] = q.coordinate(i) - radius;
-          qMax[i] = q.coordinate(i) + radius;
-        }
+      auto new_radius_sqr = tmp.cost;
+
+      // update the query box if necessary (only takes a sqrt when the radius shrinks)
+      if (new_radius_sqr < radius_sqr) {
+        radius_sqr = new_radius_sqr;
+        knnBox(q, radius_sqr, qMin, qMax, approx);
       }
     }
 
@@ -364,15 +519,17 @@ class kdNode {
         return;
       }
       case BOX_INCLUDE: {
-        knnAddToBuffer(q, tree_start, present, out, radius);
+        knnAddToBuffer(getStartIdx(), getEndIdx(), q, scan, present, out, radius_sqr);
+        if (approx) approx->visitLeaf();
         break;
       }
       case BOX_OVERLAP: {
-        if (isLeaf()) {
-          knnAddToBuffer(q, tree_start, present, out, radius);
-        } else {
-          left->knnPrune<update>(q, tree_start, present, radius, qMin, qMax, out);
-          right->knnPrune<update>(q, tree_start, present, radius, qMin, qMax, out);
+        for (bool r : {false, true}) {
+          if (isLeafChild(r))
+            knnLeaf<update>(r, q, scan, present, radius_sqr, qMin, qMax, out, approx);
+          else if (hasChild(r))
+            getChild(r)->template knnPrune<update>(q, scan, present, radius_sqr, qMin, qMax,
+                                                   out, approx);
         }
         break;
       }
@@ -383,123 +540,125 @@ class kdNode {
   // https://github.mit.edu/yiqiuw/pargeo/blob/master/knnSearch/kdTree/kdtKnn.h#L365
   template <bool update, bool recurse_sibling>
   void knnHelper(const pointT &q,
-                 const objT *tree_start,
-                 const parlay::sequence<bool> &present,
-                 knnBuf::buffer<const pointT *> &out) const {
+                 const LeafScan<dim, objT> &scan,
+                 const LiveBitmap &present,
+                 knnBuf::buffer<const pointT *> &out,
+                 knnBuf::approxQuery *approx = nullptr) const {
     // first, find the leaf
-    nodeT *other_child;
-    if (isLeaf()) {
-      knnAddToBuffer(q, tree_start, present, out);
-      return;  // base case
-    } else {
-      if (q.coordinate(split_dimension) < split_value) {
-        // TODO: hint to compiler that [left] will pretty much never be null
-        if (left) left->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
-        other_child = right;
-      } else {
-        if (right) right->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
-        other_child = left;
-      }
+    bool side = !(q.coordinate(split_dimension) < split_value);
+    if (isLeafChild(side)) {
+      knnAddToBuffer(getChildStartIdx(side), getChildEndIdx(side), q, scan, present, out);
+      if (approx) approx->visitLeaf();
+    } else if (hasChild(side)) {  // only missing after erasing a whole child
+      getChild(side)->template knnHelper<update, recurse_sibling>(q, scan, present, out, approx);
     }
+    bool other = !side;
+    if (!hasChild(other)) return;
 
     // now, check alternate children with aggressive pruning
     if (!out.hasK()) {
       // try finding knn on other child
-      if (recurse_sibling) {
-        other_child->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
+      if (isLeafChild(other) || !recurse_sibling) {
+        knnAddToBuffer(getChildStartIdx(other), getChildEndIdx(other), q, scan, present, out);
+        if (approx) approx->visitLeaf();
       } else {
-        other_child->knnAddToBuffer(q, tree_start, present, out);
+        getChild(other)->template knnHelper<update, recurse_sibling>(q, scan, present, out,
+                                                                     approx);
       }
     } else {
-      double radius = std::numeric_limits<double>::max();
+      double radius_sqr = std::numeric_limits<double>::max();
       pointT qMin, qMax;
 
       if (!update) {
         // compute current radius
         auto tmp = out.keepK();
-        auto new_radius = tmp.cost;
+        auto new_radius_sqr = tmp.cost;
 
         // update the query box if necessary
-        if (new_radius < radius) {
-          radius = new_radius;
-          // create box based on radius
-          for (int i = 0; i < dim; i++) {
-            qMin[i] = q.coordinate(i) - radius;
-            qMax[i] = q.coordinate(i) + radius;
-          }
+        if (new_radius_sqr < radius_sqr) {
+          radius_sqr = new_radius_sqr;
+          knnBox(q, radius_sqr, qMin, qMax, approx);
         } else {
           assert(false);
         }
       }
 
-      other_child->knnPrune<update>(q, tree_start, present, radius, qMin, qMax, out);
+      if (isLeafChild(other))
+        knnLeaf<update>(other, q, scan, present, radius_sqr, qMin, qMax, out, approx);
+      else
+        getChild(other)->template knnPrune<update>(q, scan, present, radius_sqr, qMin, qMax, out,
+                                                   approx);
     }
   }
 
-  // Dual knn stuff
-#if (DUAL_KNN_MODE == DKNN_ARRAY)
-  template <int _dim, class _objT, bool _parallel, bool _coarsenq, bool _coarsenr>
-  friend void DualKnnHelper(kdNode<_dim, _objT, _parallel> *Q,
-                            const kdNode<_dim, _objT, _parallel> *R,
-                            const KdTree<_dim, _objT, _parallel, _coarsenq> &qTree,
-                            parlay::sequence<double> &dualKnnDists,
-                            const KdTree<_dim, _objT, _parallel, _coarsenr> &rTree,
-                            parlay::slice<knnBuf::buffer<const point<_dim> *> *,
-                                          knnBuf::buffer<const point<_dim> *> *> &bufs);
-#else
-  template <int _dim, class _objT, bool _parallel, bool _coarsenq, bool _coarsenr>
-  friend void DualKnnHelper(kdNode<_dim, _objT, _parallel> *Q,
-                            const kdNode<_dim, _objT, _parallel> *R,
-                            const KdTree<_dim, _objT, _parallel, _coarsenq> &qTree,
-                            const KdTree<_dim, _objT, _parallel, _coarsenr> &rTree,
-                            parlay::slice<knnBuf::buffer<const point<_dim> *> *,
-                                          knnBuf::buffer<const point<_dim> *> *> &bufs);
-#endif
-
   // Debug
   // TODO: make this also check that points are on the right side of a split
-  int verify() const {
-    if (isLeaf()) return countPoints();
-
-    auto left_points = left->verify();
-    auto right_points = right->verify();
-    // the children must be equal sized, or right has one more item
-    if (!((left_points == right_points) || (left_points + 1 == right_points)))
+  // [nodes], [live_counts]: see [orthogonalCount]; a leaf's live count is taken from [present]
+  int verify(const nodeT *nodes,
+             const CowPages<uint32_t> &live_counts,
+             const LiveBitmap &present) const {
+    int live_count = live_counts[this - nodes];
+    auto child_points = [&](bool r) -> int {
+      if (isLeafChild(r)) return (int)present.count(getChildStartIdx(r), getChildEndIdx(r), false);
+      return hasChild(r) ? getChild(r)->verify(nodes, live_counts, present) : 0;
+    };
+    auto left_points = child_points(false);
+    auto right_points = child_points(true);
+#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
+    // the children must be equal sized, or right has one more item (a lone leaf root has no right)
+    if (hasChild(true) &&
+        !((left_points == right_points) || (left_points + 1 == right_points)))
       throw std::runtime_error("Invalid tree!: (left#, right#) = (" + std::to_string(left_points) +
                                ", " + std::to_string(right_points) + ")");
+#endif
+    if (live_count != left_points + right_points)
+      throw std::runtime_error("Invalid tree!: live count " + std::to_string(live_count) +
+                               " != " + std::to_string(left_points + right_points));
     return left_points + right_points;
   }
 
   void print(const std::pair<int, int> &idx) const {
-    std::stringstream ss;
-    ss << "idx = [" << idx.first << ", " << idx.second << ")";
-    if (isLeaf()) {
-      std::cout << "leaf: { " << ss.str() << "; ";
-      for (const auto &pt : subtree_items) {
-        std::cout << "(";
-        for (int i = 0; i < dim; i++) {
-          std::cout << pt->coordinate(i);
-          if (i < dim - 1) std::cout << ", ";
-        }
-        std::cout << "), ";
+    std::cout << "split: { idx = [" << idx.first << ", " << idx.second
+              << "); dim = " << split_dimension << "; val = " << split_value << "}" << std::endl;
+  }
+  static void printLeaf(size_t start, size_t end, const objT *tree_start) {
+    std::cout << "leaf: { idx = [" << start << ", " << end << "); ";
+    for (auto it = tree_start + start; it != tree_start + end; ++it) {
+      std::cout << "(";
+      for (int i = 0; i < dim; i++) {
+        std::cout << it->coordinate(i);
+        if (i < dim - 1) std::cout << ", ";
       }
-      std::cout << " }" << std::endl;
-    } else {
-      auto split_dim = getSplitDimension();
-      auto split_val = getSplitValue();
-      std::cout << "split: { " << ss.str() << "; dim = " << split_dim << "; val = " << split_val
-                << "}" << std::endl;
+      std::cout << "), ";
     }
+    std::cout << " }" << std::endl;
   }
 };
 
-// Helper function to find bounding box distances between nodes
+// keep the node record at the size documented in [kdNode]
+static_assert(sizeof(kdNode<2, point<2>, false>) == ((DUAL_KNN_MODE == DKNN_ARRAY) ? 64 : 72),
+              "kdNode<2> record size changed");
+
+// Helper function to find (squared) bounding box distances between nodes
 template <int dim, class objT, bool parallel>
-inline double KdNodeBoundingBoxDistance(const kdNode<dim, objT, parallel> *n1,
-                                        const kdNode<dim, objT, parallel> *n2) {
-  return BoundingBoxDistance(n1->getMin(), n1->getMax(), n2->getMin(), n2->getMax());
+inline double KdNodeBoundingBoxDistanceSqr(const kdNode<dim, objT, parallel> *n1,
+                                           const kdNode<dim, objT, parallel> *n2) {
+  return BoundingBoxDistanceSqr(n1->getMin(), n1->getMax(), n2->getMin(), n2->getMax());
 }
 
+// One side of a dual kNN pair (see shared/dual.h): an interior node, or a leaf, which has no record
+// and is given by the range of its tree's [items] and the bounding box of its present points
+template <int dim, class nodeT>
+struct DualKnnNode {
+  nodeT *node;  // nullptr for a leaf
+  size_t start, end;
+  point<dim> pMin, pMax;
+
+  static DualKnnNode of(nodeT *n) {
+    return {n, n->getStartIdx(), n->getEndIdx(), n->getMin(), n->getMax()};
+  }
+};
+
 // For now, this is not cache-oblivious. Instead, it uses a simple, d-dimension generalizable
 // approach.
 template <int dim, class objT>
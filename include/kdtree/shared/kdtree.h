@@ -1,13 +1,18 @@
 #ifndef KDTREE_H
 #define KDTREE_H
 
+#include <cstring>
 #include <parlay/parallel.h>
 #include <parlay/sequence.h>
 
 #include "kdnode.h"
+#include "bitmap.h"
+#include "cow.h"
 #include "utils.h"
 #include "knnbuffer.h"
 #include "box.h"
+#include "leafscan.h"
+#include "morton.h"
 #include "macro.h"
 
 #ifdef ALL_USE_BLOOM
@@ -25,34 +30,24 @@
 // TODO: refactor this to use pointers, rather than idx
 struct FoundPoint {
   static const long int NOT_FOUND = -1;
-  long int idx;
-  long int parent_idx;
-  long int gparent_idx;
-  int point_idx;  // index of point in [subtree_items]
+  long int idx;         // the node whose leaf child holds the point
+  long int parent_idx;  // its parent; NOT_FOUND for the root
+  bool right;           // which child of [idx] the leaf is
+  int point_idx;        // index of point in the leaf
 };
 [[maybe_unused]] static std::ostream &operator<<(std::ostream &os, const FoundPoint &fp) {
-  os << "{node_idx=" << fp.idx << ", parent_idx=" << fp.parent_idx
-     << ", gparent_idx=" << fp.gparent_idx << ", point_idx=" << fp.point_idx << "}";
+  os << "{node_idx=" << fp.idx << ", parent_idx=" << fp.parent_idx << ", right=" << fp.right
+     << ", point_idx=" << fp.point_idx << "}";
   return os;
 }
 
 // forward declare for dualknn
-template <int NUM_TREES,
-          int BUFFER_LOG2_SIZE,
-          int dim,
-          class objT,
-          bool parallel = false,
-          bool coarsen = false>
+template <int dim, class objT, bool parallel = false, bool coarsen = false>
 class LogTree;
 
 template <int dim, class objT, bool parallel = false, bool coarsen = false>
 class KdTree {
-  template <int _NUM_TREES,
-            int _BUFFER_LOG2_SIZE,
-            int _dim,
-            class _objT,
-            bool _parallel,
-            bool _coarsen>
+  template <int _dim, class _objT, bool _parallel, bool _coarsen>
   friend class LogTree;
 
  protected:
@@ -75,13 +70,18 @@ class KdTree {
   // => probably just want to get rid of it
   // nodeT **parents;
   nodeT *nodes;
+  std::shared_ptr<nodeT> node_storage;  // owns [nodes]; shared with the forks of this tree
 
   size_t cur_size;        // current number of nodes
   size_t build_size;      // the number of nodes it was built with
   const size_t max_size;  // the maximum size for this tree
 
-  parlay::sequence<bool> present;
-  parlay::sequence<objT> items;
+  LiveBitmap present;              // one bit per slot of [items]: not yet deleted
+  CowPages<uint32_t> live_counts;  // per node: the points of its subtree not yet deleted
+  SharedSequence<objT> items;
+#ifdef LEAF_SOA
+  SharedSequence<double> soa_coords;  // structure-of-arrays mirror of [items] for leaf scans
+#endif
 
 #ifdef PRINT_KDTREE_TIMINGS
   timer timer_;
@@ -115,10 +115,17 @@ class KdTree {
     total_bbox_time = 0;
     total_leaf_time = 0;
 #endif
-    present = parlay::sequence<bool>(max_size);
+    present = LiveBitmap(max_size);
+    build_size = 0;  // nothing to reset in [present] yet
+    live_counts = CowPages<uint32_t>(num_nodes());
+#ifdef LEAF_SOA
+    soa_coords = parlay::sequence<double>(dim * max_size);
+#endif
 
-    // TODO: use new[] for type safety
-    nodes = (nodeT *)malloc((2 * max_size - 1) * sizeof(nodeT));
+    // node records address children and items with 32-bit offsets
+    assert(log2size < 31);
+
+    allocateNodes();
 
     // parents = (nodeT **)malloc((2 * max_size - 1) * sizeof(nodeT *));
     // parents[0] = nullptr;  // root
@@ -130,84 +137,239 @@ class KdTree {
   template <class R>
   KdTree(const R &points) : KdTree((int)std::ceil(std::log2(points.size()))) {}
 
-  ~KdTree() { free(nodes); }
+  /*!
+   * Deep copy of [other]. Node records address their children and items by offsets, so the node
+   * array is copied as is; the liveness bits and live counts are copied page by page, when either
+   * tree first writes them (see [CowPages]).
+   */
+  KdTree(const KdTree &other)
+      : cur_size(other.cur_size),
+        build_size(other.build_size),
+        max_size(other.max_size),
+        present(other.present),
+        live_counts(other.live_counts),
+        items(other.items)
+#ifdef LEAF_SOA
+        ,
+        soa_coords(other.soa_coords)
+#endif
+#ifdef PRINT_KDTREE_TIMINGS
+        ,
+        timer_("KdTree")
+#endif
+#ifdef ALL_USE_BLOOM
+        ,
+        bloom_filter(other.bloom_filter)
+#endif
+  {
+#ifdef ERASE_SEARCH_TIMES
+    total_search_time = 0;
+    total_bbox_time = 0;
+    total_leaf_time = 0;
+#endif
+    allocateNodes();
+    std::memcpy((void *)nodes, (const void *)other.nodes, num_nodes() * sizeof(nodeT));
+  }
+
+  struct ForkTag {};
+  /*!
+   * Fork of [other], for a writer that only erases from it while [other] stays readable (e.g. by a
+   * LogTree snapshot): shares the node records, [items] and SoA mirror of [other], and the pages
+   * of its liveness bits and live counts, so it costs O(size / COW_PAGE_BYTES), and an erase then
+   * copies only the pages of bits and counts it touches. The shared node records are left as they
+   * are (see [ownsNodes]); [clear] gives a fork storage of its own to build into.
+   */
+  KdTree(const KdTree &other, ForkTag)
+      : nodes(other.nodes),
+        node_storage(other.node_storage),
+        cur_size(other.cur_size),
+        build_size(other.build_size),
+        max_size(other.max_size),
+        present(other.present),
+        live_counts(other.live_counts),
+        items(other.items.share())
+#ifdef LEAF_SOA
+        ,
+        soa_coords(other.soa_coords.share())
+#endif
+#ifdef PRINT_KDTREE_TIMINGS
+        ,
+        timer_("KdTree")
+#endif
+#ifdef ALL_USE_BLOOM
+        ,
+        bloom_filter(other.bloom_filter)
+#endif
+  {
+#ifdef ERASE_SEARCH_TIMES
+    total_search_time = 0;
+    total_bbox_time = 0;
+    total_leaf_time = 0;
+#endif
+  }
+
+ protected:
+  void allocateNodes() {
+    // TODO: use new[] for type safety
+    nodes = (nodeT *)malloc(num_nodes() * sizeof(nodeT));
+    node_storage = std::shared_ptr<nodeT>(nodes, free);
+  }
+
+  /*!
+   * Whether this tree is the only one using its node records and [items]. Otherwise (a fork, see
+   * [ForkTag]) erasing leaves them as they are: emptied subtrees are not cut out and bounding boxes
+   * are not shrunk, which queries handle, only with less pruning. Only ever turns from false to
+   * true while the tree is in use, when the other trees are destroyed.
+   */
+  bool ownsNodes() const { return node_storage.use_count() == 1; }
 
+  // live counts of the nodes: see [live_counts]
+  void removePoints(const nodeT *n, size_t num) {
+    auto &count = live_counts.own(n - nodes);
+    assert(num <= count);
+    count -= (uint32_t)num;
+  }
+  void addPoints(const nodeT *n, size_t num) { live_counts.own(n - nodes) += (uint32_t)num; }
+
+  /*!
+   * Build the tree over items [0, n) when they fit in a single leaf: the root (which every tree
+   * has, see [num_nodes]) covers them all with its left child, a leaf.
+   */
+  void buildLeafRoot(size_t n) {
+    auto root = new (&nodes[0])
+        nodeT(0, std::numeric_limits<floatT>::infinity(), n, items.cut(0, n), items.begin());
+    root->setLeafChild(false);
+    root->recomputeBoundingBox(items.begin(), present);
+  }
+
+  /*!
+   * Set the live counts of the subtree of [n] to the numbers of items they cover, after building
+   * it.
+   */
+  void resetLiveCounts(const nodeT *n) {
+    live_counts.own(n - nodes) = (uint32_t)n->getNumItems();
+    auto left = n->getLeft(), right = n->getRight();
+    if (parallel && left && right && n->getNumItems() >= BOUNDINGBOX_BASE_CASE) {
+      parlay::par_do([&]() { resetLiveCounts(left); }, [&]() { resetLiveCounts(right); });
+    } else {
+      if (left) resetLiveCounts(left);
+      if (right) resetLiveCounts(right);
+    }
+  }
+
+ public:
   // MODIFY -----------------------------------------
   /*!
    * Clear out the contents of this tree
    */
   void clear() {
     cur_size = 0;
-    build_size = 0;
-    if (parallel) {
-      // TODO: make this [present] reset better?
-      // TODO: this is probably wrong - should reset to false!
-      parlay::parallel_for(0, present.size(), [&](size_t i) { present[i] = true; });
-    } else {
-      for (size_t i = 0; i < present.size(); i++) {
-        present[i] = true;
-      }
+    // a fork gets storage of its own before it is rebuilt (see [ownsNodes])
+    if (!ownsNodes()) {
+      allocateNodes();
+      items = parlay::sequence<objT>(items.size());
+#ifdef LEAF_SOA
+      soa_coords = parlay::sequence<double>(soa_coords.size());
+#endif
     }
+    // only the slots of the last build can have been erased: every other bit is still set
+    present.setPrefix(build_size, parallel);
+    build_size = 0;
 #ifdef ALL_USE_BLOOM
     bloom_filter.clear();
 #endif
 #ifndef NDEBUG
     // mark all the nodes as empty again, only for debugging purposes
-    parlay::parallel_for(0, 2 * max_size - 1, [&](size_t i) { nodes[i].setEmpty(); });
+    parlay::parallel_for(0, num_nodes(), [&](size_t i) { nodes[i].setEmpty(); });
     // parlay::parallel_for(0, 2 * n - 1, [&](size_t i) { parents[i] = nullptr; });
 #endif
   }
 
+  /*!
+   * Pack the elements of the tree into [dest], leaving the tree as it is.
+   */
+  size_t copyElementsTo(parlay::slice<objT *, objT *> dest) const {
+    assert(dest.size() >= size());
+    return present.packInto(items.begin(), 0, build_size, dest.begin(), parallel);
+  }
+
   /*!
    * Move the elements of the tree and pack them into [dest]. Clear the tree.
    */
   size_t moveElementsTo(parlay::slice<objT *, objT *> dest) {
-    size_t ret;
-    assert(dest.size() >= size());
+    auto ret = copyElementsTo(dest);
+    clear();
+    return ret;
+  }
+
+  /*!
+   * Exchange the contents of this tree with [other], a tree of the same capacity (e.g. one that
+   * was built off to the side).
+   */
+  void swap(KdTree &other) {
+    assert(max_size == other.max_size);
+    std::swap(nodes, other.nodes);
+    std::swap(node_storage, other.node_storage);
+    std::swap(cur_size, other.cur_size);
+    std::swap(build_size, other.build_size);
+    std::swap(present, other.present);
+    std::swap(live_counts, other.live_counts);
+    std::swap(items, other.items);
+#ifdef LEAF_SOA
+    std::swap(soa_coords, other.soa_coords);
+#endif
+#ifdef ALL_USE_BLOOM
+    bloom_filter.swap(other.bloom_filter);
+#endif
+  }
+
+  /*!
+   * Rebuild the structure-of-arrays mirror of [items] after a build has placed them, from slot
+   * [start] on (the slots before it are unchanged).
+   */
+  void buildLeafSoA([[maybe_unused]] size_t start = 0) {
+#ifdef LEAF_SOA
+    auto copy_coords = [&](size_t i) {
+      for (int d = 0; d < dim; d++) {
+        soa_coords[d * max_size + i] = items[i].coordinate(d);
+      }
+    };
     if (parallel) {
-      ret = parlay::pack_into(parlay::slice(items.begin(), items.begin() + build_size),
-                              parlay::slice(present.begin(), present.begin() + build_size),
-                              dest);
+      parlay::parallel_for(start, build_size, copy_coords);
     } else {
-      ret = 0;
-      for (size_t i = 0; i < build_size; i++) {
-        if (present[i]) {
-          dest[ret++] = items[i];
-        }
-      }
+      for (size_t i = start; i < build_size; i++)
+        copy_coords(i);
     }
-    clear();
-    return ret;
+#endif
   }
 
   // QUERY --------------------------------------------
+  LeafScan<dim, objT> leafScan() const {
+#ifdef LEAF_SOA
+    return {items.begin(), soa_coords.begin(), max_size};
+#else
+    return {items.begin()};
+#endif
+  }
+
   // return (s,e) where the node represents items [s,e) in the underlying [items] array
   std::pair<int, int> getNodeValueIdx(const nodeT *n) const {
-    return {n->getStartValue() - items.begin(), n->getEndValue() - items.begin()};
+    return {n->getStartIdx(), n->getEndIdx()};
   }
-  // int getLeafValueIdx(const nodeT *n) const {
-  // assert(n->isLeaf());
-  // return getNodeValueIdx(n).first;
-  //}
-
-  bool contains(const objT &p) const {
-    if (empty()) return false;
-
-    auto node = nodes;
-    while (!node->isLeaf()) {  // walk down to leaf
-      if (p.coordinate(node->getSplitDimension()) < node->getSplitValue())
-        node = node->getLeft();
-      else
-        node = node->getRight();
-    }
-
-    assert(node->isLeaf());
-    // check in the leaf for the point
-    for (auto it = node->getStartValue(); it != node->getEndValue(); ++it) {
-      if (present[it - items.begin()] && p == *it) return true;
-    }
-    return false;
+  parlay::slice<const objT *, const objT *> getNodeValues(const nodeT *n) const {
+    return n->getValues(items.begin());
+  }
+  // the same for the leaf child [right] of [n] (leaves have no node record)
+  std::pair<int, int> getLeafValueIdx(const nodeT *n, bool right) const {
+    assert(n->isLeafChild(right));
+    return {n->getChildStartIdx(right), n->getChildEndIdx(right)};
   }
+  parlay::slice<const objT *, const objT *> getLeafValues(const nodeT *n, bool right) const {
+    auto idx = getLeafValueIdx(n, right);
+    return items.cut(idx.first, idx.second);
+  }
+
+  bool contains(const objT &p) const { return find(p).idx != FoundPoint::NOT_FOUND; }
 
   parlay::sequence<bool> contains(const parlay::sequence<objT> &points) const {
     parlay::sequence<bool> ret(points.size(), false);
@@ -220,45 +382,268 @@ class KdTree {
 
   FoundPoint find(const objT &p) const {
     if (!empty()) {
-      auto node = nodes;
-      nodeT *parent = nullptr;
-      nodeT *gparent = nullptr;
-      while (!node->isLeaf()) {
-        gparent = parent;
+      const nodeT *node = nodes;
+      const nodeT *parent = nullptr;
+      while (true) {
+        // move down
+        bool right = !(p.coordinate(node->getSplitDimension()) < node->getSplitValue());
+        if (node->isLeafChild(right)) {
+          // reached the leaf -> check if it contains [p]
+          auto scan = leafScan();
+          auto start = node->getChildStartIdx(right), end = node->getChildEndIdx(right);
+          for (auto s = start; s < end; s += LEAF_SCAN_CHUNK) {
+            auto count = std::min(LEAF_SCAN_CHUNK, end - s);
+            for (auto mask = scan.equal(p, s, count); mask; mask &= mask - 1) {
+              auto i = s + __builtin_ctzll(mask);
+              if (present[i]) {
+                return {node - nodes, parent ? parent - nodes : FoundPoint::NOT_FOUND, right,
+                        (int)(i - start)};
+              }
+            }
+          }
+          break;
+        }
+        if (!node->hasChild(right)) break;  // that side has been erased
         parent = node;
+        node = node->getChild(right);
+      }
+    }
+    return {FoundPoint::NOT_FOUND, FoundPoint::NOT_FOUND, false, -1};
+  }
 
-        // move down
-        auto split_dim = node->getSplitDimension();
-        auto split_val = node->getSplitValue();
-        if (p.coordinate(split_dim) < split_val)
-          node = node->getLeft();
-        else
-          node = node->getRight();
+  // Range queries in two passes: [*Segments] finds the ranges of [items] that intersect the query
+  // region and counts the matches in each, the caller prefix-sums the counts into offsets, and
+  // [*Write] writes every segment directly into its place in the output. [mask](s, n) is the
+  // bitmask of items [s, s + n) inside the region, for segments that need checking.
+ private:
+  template <class Mask>
+  void countSegments(parlay::sequence<RangeSegment> &segs, const Mask &mask) const {
+    auto count_segment = [&](size_t i) {
+      auto &seg = segs[i];
+      size_t count = 0;
+      if (seg.check) {
+        for (size_t s = seg.start; s < seg.end; s += LEAF_SCAN_CHUNK) {
+          auto n = std::min(LEAF_SCAN_CHUNK, seg.end - s);
+          count += __builtin_popcountll(mask(s, n) & present.bits(s, n));
+        }
+      } else {
+        count = present.count(seg.start, seg.end,
+                              parallel && rangeQueryInParallel(seg.end - seg.start));
       }
+      seg.count = count;
+    };
+    if (parallel) {
+      parlay::parallel_for(0, segs.size(), count_segment);
+    } else {
+      for (size_t i = 0; i < segs.size(); i++)
+        count_segment(i);
+    }
+  }
 
-      // DEBUG_MSG(
-      //"Find Checking: " << (FoundPoint){node - nodes, parent - nodes, gparent - nodes, -99});
-      // [node] is a leaf -> check if it contains [p]
-      for (auto it = node->getStartValue(); it != node->getEndValue(); ++it) {
-        auto subtree_idx = (it - node->getStartValue());
-        assert(subtree_idx >= 0);
-        assert((size_t)subtree_idx < node->getValues().size());
-        if (present[it - items.begin()] && p == *it) {
-          return {node - nodes, parent - nodes, gparent - nodes, (int)subtree_idx};
+  template <class Mask>
+  void writeSegments(const parlay::sequence<RangeSegment> &segs,
+                     const Mask &mask,
+                     parlay::slice<objT *, objT *> out) const {
+    auto write_segment = [&](size_t i) {
+      const auto &seg = segs[i];
+      auto offset = seg.offset;
+      if (seg.check) {
+        for (size_t s = seg.start; s < seg.end; s += LEAF_SCAN_CHUNK) {
+          auto n = std::min(LEAF_SCAN_CHUNK, seg.end - s);
+          for (auto m = mask(s, n) & present.bits(s, n); m; m &= m - 1) {
+            out[offset++] = items[s + __builtin_ctzll(m)];
+          }
         }
+      } else if (seg.count == seg.end - seg.start) {
+        // every point of the subtree is live: copy the range as is
+        if (parallel && rangeQueryInParallel(seg.count)) {
+          parlay::parallel_for(
+              0, seg.count, [&](size_t j) { out[offset + j] = items[seg.start + j]; });
+        } else {
+          std::copy(items.begin() + seg.start, items.begin() + seg.end, out.begin() + offset);
+        }
+        offset += seg.count;
+      } else {
+        offset += present.packInto(items.begin(), seg.start, seg.end, out.begin() + offset,
+                                   parallel && rangeQueryInParallel(seg.end - seg.start));
       }
+      assert(offset == seg.offset + seg.count);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, segs.size(), write_segment);
+    } else {
+      for (size_t i = 0; i < segs.size(); i++)
+        write_segment(i);
     }
-    return {FoundPoint::NOT_FOUND, FoundPoint::NOT_FOUND, FoundPoint::NOT_FOUND, -1};
   }
 
-  parlay::sequence<objT> orthogonalQuery(const objT &qMin, const objT &qMax) const {
-    parlay::sequence<objT> ret;
-    if (!empty()) {
-      nodes[0].orthogonalQuery(qMin, qMax, items.begin(), present, ret);
+  // Batch of [n] two-pass queries: [segments](i) and [write](i, segs, out) run the passes of query
+  // i. Returns the CSR result {offsets, items}.
+  template <class Segments, class Write>
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> twoPassQueryBatch(
+      size_t n, const Segments &segments, const Write &write) const {
+    parlay::sequence<parlay::sequence<RangeSegment>> segs(n);
+    parlay::sequence<size_t> offsets(n + 1);
+
+    // count
+    auto count_query = [&](size_t i) {
+      segs[i] = segments(i);
+      offsets[i] = rangeSegmentOffsets(segs[i]);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, n, count_query);
+    } else {
+      for (size_t i = 0; i < n; i++)
+        count_query(i);
     }
+    offsets[n] = 0;
+    auto total = parlay::scan_inplace(offsets);
+
+    // write
+    parlay::sequence<objT> out(total);
+    auto write_query = [&](size_t i) { write(i, segs[i], out.cut(offsets[i], offsets[i + 1])); };
+    if (parallel) {
+      parlay::parallel_for(0, n, write_query);
+    } else {
+      for (size_t i = 0; i < n; i++)
+        write_query(i);
+    }
+    return {std::move(offsets), std::move(out)};
+  }
+
+ public:
+  parlay::sequence<RangeSegment> orthogonalQuerySegments(const objT &qMin, const objT &qMax) const {
+    parlay::sequence<RangeSegment> segs;
+    if (empty()) return segs;
+    nodes[0].orthogonalSegments(qMin, qMax, segs);
+    auto scan = leafScan();
+    countSegments(segs, [&](size_t s, size_t n) { return scan.inBox(qMin, qMax, s, n); });
+    return segs;
+  }
+
+  void orthogonalQueryWrite(const objT &qMin,
+                            const objT &qMax,
+                            const parlay::sequence<RangeSegment> &segs,
+                            parlay::slice<objT *, objT *> out) const {
+    auto scan = leafScan();
+    writeSegments(segs, [&](size_t s, size_t n) { return scan.inBox(qMin, qMax, s, n); }, out);
+  }
+
+  /*!
+   * Number of points inside the box [qMin, qMax], without materializing them.
+   */
+  size_t orthogonalCount(const objT &qMin, const objT &qMax) const {
+    if (empty()) return 0;
+    return nodes[0].orthogonalCount(qMin, qMax, leafScan(), present, nodes, live_counts);
+  }
+
+  /*!
+   * Reduce [f](point) over the points inside the box [qMin, qMax] with the monoid [m] (e.g. sum,
+   * min or max of a coordinate), without materializing them.
+   */
+  template <class F, class M>
+  auto orthogonalReduce(const objT &qMin, const objT &qMax, F f, M m) const {
+    using T = decltype(m.identity);
+    if (empty()) return m.identity;
+    parlay::sequence<RangeSegment> segs;
+    nodes[0].orthogonalSegments(qMin, qMax, segs);
+
+    auto scan = leafScan();
+    auto reduce_segment = [&](size_t i) -> T {
+      const auto &seg = segs[i];
+      T acc = m.identity;
+      if (seg.check) {
+        for (size_t s = seg.start; s < seg.end; s += LEAF_SCAN_CHUNK) {
+          auto n = std::min(LEAF_SCAN_CHUNK, seg.end - s);
+          for (auto mask = scan.inBox(qMin, qMax, s, n); mask; mask &= mask - 1) {
+            auto j = s + __builtin_ctzll(mask);
+            if (present[j]) acc = m.f(acc, f(items[j]));
+          }
+        }
+      } else if (parallel && rangeQueryInParallel(seg.end - seg.start)) {
+        auto vals = parlay::delayed_seq<T>(seg.end - seg.start, [&](size_t j) {
+          return present[seg.start + j] ? f(items[seg.start + j]) : m.identity;
+        });
+        acc = parlay::reduce(vals, m);
+      } else {
+        for (size_t j = seg.start; j < seg.end; j++) {
+          if (present[j]) acc = m.f(acc, f(items[j]));
+        }
+      }
+      return acc;
+    };
+    if (parallel) {
+      return parlay::reduce(parlay::delayed_seq<T>(segs.size(), reduce_segment), m);
+    } else {
+      T acc = m.identity;
+      for (size_t i = 0; i < segs.size(); i++)
+        acc = m.f(acc, reduce_segment(i));
+      return acc;
+    }
+  }
+
+  parlay::sequence<objT> orthogonalQuery(const objT &qMin, const objT &qMax) const {
+    auto segs = orthogonalQuerySegments(qMin, qMax);
+    parlay::sequence<objT> ret(rangeSegmentOffsets(segs));
+    orthogonalQueryWrite(qMin, qMax, segs, ret.cut(0, ret.size()));
+    return ret;
+  }
+
+  /*!
+   * Orthogonal range query over a batch of boxes ({qMin, qMax}). Parallelizes across the boxes and
+   * within each box, and allocates the whole result at once.
+   * @return CSR result {offsets, items}: box i's points are items[offsets[i], offsets[i + 1]).
+   */
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> orthogonalQueryBatch(
+      const parlay::sequence<std::pair<objT, objT>> &boxes) const {
+    return twoPassQueryBatch(
+        boxes.size(),
+        [&](size_t i) { return orthogonalQuerySegments(boxes[i].first, boxes[i].second); },
+        [&](size_t i, const auto &segs, auto out) {
+          orthogonalQueryWrite(boxes[i].first, boxes[i].second, segs, out);
+        });
+  }
+
+  // Radius (ball) query: the points within distance [r] of [center]. Subtrees whose farthest
+  // corner is within [r] are taken whole; subtrees whose nearest point is farther are pruned.
+  parlay::sequence<RangeSegment> radiusQuerySegments(const objT &center, double r) const {
+    parlay::sequence<RangeSegment> segs;
+    if (empty()) return segs;
+    pointT q(center.coordinate());
+    nodes[0].radiusSegments(q, r * r, segs);
+    auto scan = leafScan();
+    countSegments(segs, [&](size_t s, size_t n) { return scan.inBall(q, r * r, s, n); });
+    return segs;
+  }
+
+  void radiusQueryWrite(const objT &center,
+                        double r,
+                        const parlay::sequence<RangeSegment> &segs,
+                        parlay::slice<objT *, objT *> out) const {
+    pointT q(center.coordinate());
+    auto scan = leafScan();
+    writeSegments(segs, [&](size_t s, size_t n) { return scan.inBall(q, r * r, s, n); }, out);
+  }
+
+  parlay::sequence<objT> radiusQuery(const objT &center, double r) const {
+    auto segs = radiusQuerySegments(center, r);
+    parlay::sequence<objT> ret(rangeSegmentOffsets(segs));
+    radiusQueryWrite(center, r, segs, ret.cut(0, ret.size()));
     return ret;
   }
 
+  /*!
+   * Radius query around each of [centers], all with radius [r]; see [orthogonalQueryBatch].
+   * @return CSR result {offsets, items}: center i's points are items[offsets[i], offsets[i + 1]).
+   */
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> radiusQueryBatch(
+      const parlay::sequence<objT> &centers, double r) const {
+    return twoPassQueryBatch(
+        centers.size(),
+        [&](size_t i) { return radiusQuerySegments(centers[i], r); },
+        [&](size_t i, const auto &segs, auto out) { radiusQueryWrite(centers[i], r, segs, out); });
+  }
+
 #if (DUAL_KNN_MODE != DKNN_ARRAY)
   void updateDualDist(const parlay::slice<knnBuf::buffer<const pointT *> *,
                                           knnBuf::buffer<const pointT *> *> &buf_slice) {
@@ -273,11 +658,18 @@ class KdTree {
 #endif
 
   template <bool update, bool recurse_sibling>
-  void knnSinglePoint(const objT &p, knnBuf::buffer<const pointT *> &buf) const {
-    nodes[0].template knnHelper<update, recurse_sibling>(
-        pointT(p.coordinate()), items.begin(), present, buf);
-    buf.keepK();  // TODO: could cause problems in logtree when running on nearly depleted
-                  // subtree
+  void knnSinglePoint(const objT &p,
+                      knnBuf::buffer<const pointT *> &buf,
+                      const knnBuf::approx &approx = {}) const {
+    if (approx.exact()) {
+      nodes[0].template knnHelper<update, recurse_sibling>(
+          pointT(p.coordinate()), leafScan(), present, buf);
+    } else {
+      knnBuf::approxQuery state(approx);
+      nodes[0].template knnHelper<update, recurse_sibling>(
+          pointT(p.coordinate()), leafScan(), present, buf, &state);
+    }
+    if (buf.hasK()) buf.keepK();  // fewer than k live points: the rest of the slots stay null
   }
 
   template <bool set_res, bool update, bool recurse_sibling>
@@ -287,10 +679,11 @@ class KdTree {
       parlay::slice<knnBuf::elem<const pointT *> *, knnBuf::elem<const pointT *> *> &out,
       parlay::slice<const pointT **, const pointT **> &res,
       int k,
-      bool preload) const {
+      bool preload,
+      const knnBuf::approx &approx = {}) const {
     auto buf = knnBuf::buffer<const pointT *>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
-    if (preload) buf.ptr = k;
-    knnSinglePoint<update, recurse_sibling>(p, buf);
+    if (preload) buf.preload();
+    knnSinglePoint<update, recurse_sibling>(p, buf, approx);
 
     if (set_res) {
       for (int j = 0; j < k; j++) {
@@ -315,22 +708,45 @@ class KdTree {
     }
   }
 
+  /*!
+   * Order in which batch kNN visits [queries] (see shared/morton.h): Morton order over the root's
+   * bounding box with KNN_MORTON_ORDER, otherwise empty (the caller's order).
+   */
+  parlay::sequence<uint32_t> knnQueryOrder([[maybe_unused]] const parlay::sequence<objT> &queries)
+      const {
+#ifdef KNN_MORTON_ORDER
+    if (!empty()) return mortonOrder<dim>(queries, nodes[0].getMin(), nodes[0].getMax(), parallel);
+#endif
+    return {};
+  }
+
+  // [order]: visit the queries in this order (results still go to each query's own slot); empty
+  // => use [knnQueryOrder]. [approx]: accuracy knobs, see knnBuf::approx
   template <bool set_res, bool update, bool recurse_sibling>
   void knn(const parlay::sequence<objT> &queries,
            parlay::slice<knnBuf::elem<const pointT *> *, knnBuf::elem<const pointT *> *> &out,
            parlay::slice<const pointT **, const pointT **> &res,
            int k,
-           bool preload = false) const {
+           bool preload = false,
+           const parlay::sequence<uint32_t> &order = {},
+           const knnBuf::approx &approx = {}) const {
     assert(res.size() == k * queries.size());
     assert(out.size() == 2 * k * queries.size());
 
+    auto own_order = order.empty() ? knnQueryOrder(queries) : parlay::sequence<uint32_t>();
+    const auto &q_order = order.empty() ? own_order : order;
+    assert(q_order.empty() || q_order.size() == queries.size());
+    auto run_query = [&](size_t j) {
+      auto i = q_order.empty() ? j : q_order[j];
+      knnSinglePoint<set_res, update, recurse_sibling>(
+          queries[i], i, out, res, k, preload, approx);
+    };
+
     if (parallel) {
-      parlay::parallel_for(0, queries.size(), [&](size_t i) {
-        knnSinglePoint<set_res, update, recurse_sibling>(queries[i], i, out, res, k, preload);
-      });
+      parlay::parallel_for(0, queries.size(), run_query);
     } else {
-      for (size_t i = 0; i < queries.size(); i++)
-        knnSinglePoint<set_res, update, recurse_sibling>(queries[i], i, out, res, k, preload);
+      for (size_t j = 0; j < queries.size(); j++)
+        run_query(j);
     }
   }
 
@@ -346,18 +762,44 @@ class KdTree {
                                         __attribute__((unused)) int k) const {
     throw std::runtime_error("Called knn3 on the wrong tree type!");
   }
+  template <bool update, bool recurse_sibling>
+  parlay::sequence<const pointT *> knn4(__attribute__((unused))
+                                        const parlay::sequence<objT> &queries,
+                                        __attribute__((unused)) int k) const {
+    throw std::runtime_error("Called knn4 on the wrong tree type!");
+  }
 
+  /*!
+   * k nearest neighbors of each of [queries]: query i's are res[i * k, (i + 1) * k). [approx]
+   * trades accuracy for speed (see knnBuf::approx); the default is exact.
+   */
   template <bool update = false, bool recurse_sibling = false>
-  parlay::sequence<const pointT *> knn(const parlay::sequence<objT> &queries, int k) const {
+  parlay::sequence<const pointT *> knn(const parlay::sequence<objT> &queries,
+                                       int k,
+                                       const knnBuf::approx &approx = {}) const {
     parlay::sequence<const pointT *> res(k * queries.size());
     parlay::sequence<knnBuf::elem<const pointT *>> out(2 * k * queries.size());
 
     auto res_slice = res.head(res.size());
     auto out_slice = out.head(out.size());
-    knn<true, update, recurse_sibling>(queries, out_slice, res_slice, k);
+    knn<true, update, recurse_sibling>(queries, out_slice, res_slice, k, false, {}, approx);
     return res;
   }
 
+  /*!
+   * [knn] returning copies of the neighbors (with their IDs/payloads, e.g. for [idPoint]) rather
+   * than pointers into [items], so the results stay valid after the tree changes. Requires [objT]
+   * to derive from point<dim>.
+   * @return CSR result {offsets, items}: query i's neighbors are items[offsets[i], offsets[i + 1]),
+   * fewer than k when the tree holds fewer than k points.
+   */
+  template <bool update = false, bool recurse_sibling = false>
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> knnItems(
+      const parlay::sequence<objT> &queries, int k, const knnBuf::approx &approx = {}) const {
+    auto res = knn<update, recurse_sibling>(queries, k, approx);
+    return knnBuf::gatherItems<objT>(res, queries.size(), k, parallel);
+  }
+
   // Dual knn stuff
   template <int _dim, class _objT, bool _parallel, bool _coarsen>
   friend parlay::sequence<const point<_dim> *> dualKnn(
@@ -365,36 +807,12 @@ class KdTree {
       const KdTree<_dim, _objT, _parallel, _coarsen> &rTree,
       int k);
 
-  template <int _NUM_TREES,
-            int _BUFFER_LOG2_SIZE,
-            int _dim,
-            class _objT,
-            bool _parallel,
-            bool _coarsen>
+  template <int _dim, class _objT, bool _parallel, bool _coarsen>
   friend parlay::sequence<const point<_dim> *> dualKnn(
       parlay::sequence<_objT> &queries,
-      const LogTree<_NUM_TREES, _BUFFER_LOG2_SIZE, _dim, _objT, _parallel, _coarsen> &rTree,
+      const LogTree<_dim, _objT, _parallel, _coarsen> &rTree,
       int k);
 
-#if (DUAL_KNN_MODE == DKNN_ARRAY)
-  template <int _dim, class _objT, bool _parallel, bool _coarsenq, bool _coarsenr>
-  friend void DualKnnHelper(kdNode<_dim, _objT, _parallel> *Q,
-                            const kdNode<_dim, _objT, _parallel> *R,
-                            const KdTree<_dim, _objT, _parallel, _coarsenq> &qTree,
-                            parlay::sequence<double> &dualKnnDists,
-                            const KdTree<_dim, _objT, _parallel, _coarsenr> &rTree,
-                            parlay::slice<knnBuf::buffer<const point<_dim> *> *,
-                                          knnBuf::buffer<const point<_dim> *> *> &bufs);
-#else
-  template <int _dim, class _objT, bool _parallel, bool _coarsenq, bool _coarsenr>
-  friend void DualKnnHelper(kdNode<_dim, _objT, _parallel> *Q,
-                            const kdNode<_dim, _objT, _parallel> *R,
-                            const KdTree<_dim, _objT, _parallel, _coarsenq> &qTree,
-                            const KdTree<_dim, _objT, _parallel, _coarsenr> &rTree,
-                            parlay::slice<knnBuf::buffer<const point<_dim> *> *,
-                                          knnBuf::buffer<const point<_dim> *> *> &bufs);
-#endif
-
   parlay::sequence<const pointT *> dualKnnBase(const KdTree &queryTree, int k) const {
     parlay::sequence<const pointT *> res(k * queryTree.size());
     parlay::sequence<knnBuf::elem<const pointT *>> out(2 * k * queryTree.size());
@@ -416,22 +834,25 @@ class KdTree {
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
     parlay::sequence<double> dualKnnDists(queryTree.num_nodes(),
                                           std::numeric_limits<double>::max());
-    DualKnnHelper(queryTree.unsafe_root(), root(), queryTree, dualKnnDists, *this, buf_slice);
+    DualKnnHelper(DualKnnNode<dim, nodeT>::of(queryTree.unsafe_root()),
+                  DualKnnNode<dim, const nodeT>::of(root()), queryTree, dualKnnDists, *this,
+                  buf_slice);
 #else
-    DualKnnHelper(queryTree.unsafe_root(), root(), queryTree, *this, buf_slice);
+    DualKnnHelper(DualKnnNode<dim, nodeT>::of(queryTree.unsafe_root()),
+                  DualKnnNode<dim, const nodeT>::of(root()), queryTree, *this, buf_slice);
 #endif
 
     // build result
     if (parallel) {
       parlay::parallel_for(0, queryTree.size(), [&](size_t i) {
-        bufs[i].keepK();
+        if (bufs[i].hasK()) bufs[i].keepK();
         for (int j = 0; j < k; j++) {
           res[i * k + j] = bufs[i][j].entry;
         }
       });
     } else {
       for (size_t i = 0; i < queryTree.size(); i++) {
-        bufs[i].keepK();
+        if (bufs[i].hasK()) bufs[i].keepK();
         for (int j = 0; j < k; j++) {
           res[i * k + j] = bufs[i][j].entry;
         }
@@ -445,7 +866,10 @@ class KdTree {
   size_t get_build_size() const { return build_size; }
   size_t size() const { return cur_size; }
   size_t capacity() const { return max_size; }
-  size_t num_nodes() const { return 2 * max_size - 1; }
+  // one record per interior node (see [kdNode]); a tree of a single leaf still has its root
+  size_t num_nodes() const { return std::max<size_t>(max_size - 1, 1); }
+  // number of points of the subtree of [n] not yet deleted
+  int countPoints(const nodeT *n) const { return live_counts[n - nodes]; }
   auto node_idx(const nodeT *n) const {
     assert(n >= nodes);
     assert(n < nodes + num_nodes());
@@ -462,53 +886,48 @@ class KdTree {
     assert(found_point.idx != FoundPoint::NOT_FOUND);
 
     auto node = nodes + found_point.idx;
-    auto parent = nodes + found_point.parent_idx;
-    auto gparent = nodes + found_point.gparent_idx;
-
-    assert(node->isLeaf());
-    assert((parent == nodes) || (gparent != nullptr));  // either child of root or has grandparent
+    auto parent = (found_point.parent_idx == FoundPoint::NOT_FOUND)
+                      ? nullptr
+                      : nodes + found_point.parent_idx;
+    auto right = found_point.right;
+    assert(node->isLeafChild(right));
 
     // mark point as deleted
-    present[found_point.point_idx + (node->getStartValue() - items.begin())] = false;
-    node->removePoints(1);
+    auto point_idx = found_point.point_idx + node->getChildStartIdx(right);
+    present.reset(point_idx);
     cur_size -= 1;
 
-    // remove node if needed
-    if (node->countPoints() == 0) {
-      if (gparent != nullptr) {
-        auto node_sibling = (parent->getLeft() == node) ? parent->getRight() : parent->getLeft();
-        /* cut the parent out
-         *         gp                   gp
-         *        /  \                 /  \
-         *       T    p      ==>      T    \
-         *           / \                    \
-         *          ns  n                   ns
+    // update the live counts on the path to [node]: each side of a split covers a range of [items]
+    for (auto n = nodes;;) {
+      removePoints(n, 1);
+      if (n == node) break;
+      n = n->getChild(point_idx >= n->getChildStartIdx(true));
+      assert(n != nullptr && n->getStartIdx() <= point_idx && point_idx < n->getEndIdx());
+    }
+    if (!ownsNodes()) return;  // a fork leaves the shared node records as they are
+
+    // remove the leaf if needed
+    if (present.count(node->getChildStartIdx(right), node->getChildEndIdx(right), false) == 0) {
+      node->setChild(right, nullptr);
+      if (parent != nullptr && !node->isLeafChild(!right)) {
+        /* cut the node out
+         *         p                    p
+         *        / \                  / \
+         *       T   n       ==>       T   \
+         *          / \                     \
+         *         ns  leaf                  ns
          */
-        if (gparent->getLeft() == parent) {
-          gparent->setLeft(node_sibling);
-        } else {
-          gparent->setRight(node_sibling);
-        }
-        assert(!gparent->isLeaf());
-        gparent->recomputeBoundingBox();
-        // if (node_sibling) parents[node_sibling - nodes] = gparent;
-      } else {
-        if (!log_tree) {
-          // only need to update structure if we're still gonna use it. -> in the case of a log
-          // tree, if the entire side subtree of the root has been deleted, it will definitely be
-          // moved up/down.
-          if (parent->getLeft() == node)
-            parent->setLeft(nullptr);
-          else
-            parent->setRight(nullptr);
-          assert(!parent->isLeaf());
-          parent->recomputeBoundingBox();
-        }
+        parent->setChild(parent->getRight() == node, node->getChild(!right));
+        parent->recomputeBoundingBox(items.begin(), present);
+        return;
       }
-    } else {  // have to recompute bbox of node after erasing a point
-      assert(node->isLeaf());
-      node->recomputeBoundingBoxLeaf(items.begin(), present);
+      // only need to update the root's box if we're still gonna use it. -> in the case of a log
+      // tree, if the entire side subtree of the root has been deleted, it will definitely be
+      // moved up/down.
+      if (parent == nullptr && log_tree) return;
     }
+    // have to recompute bbox of node after erasing a point
+    node->recomputeBoundingBox(items.begin(), present);
   }
 
   // Basic Erase-By-Point: Directly erase the passed-in points in a single phase. ------------------
@@ -572,89 +991,105 @@ class KdTree {
 
   // Bulk Erase Functions --------------------------------------------------------------------------
   /*!
-   * Delete the input nodes from the tree. The input should be directly passed from
-   * [bulk_erase].
+   * Delete [points] from the leaf covering items [start, end) of [items]. Returns whether the leaf
+   * still has points.
    */
   // TODO: think about whether you want objT or objT* in points.
-  nodeT *bulk_erase_leaf(nodeT *node, parlay::slice<objT *, objT *> points, size_t &num_removed) {
-    assert(node->isLeaf());
+  bool bulk_erase_leaf(size_t start,
+                       size_t end,
+                       parlay::slice<objT *, objT *> points,
+                       size_t &num_removed) {
     // remove all the points we can
     num_removed = 0;
 #ifdef ERASE_SEARCH_TIMES
     timer t;
 #endif
+    auto scan = leafScan();
     for (const auto &pt_to_del : points) {
-      for (auto it = node->getStartValue(); it != node->getEndValue(); ++it) {
-        if (present[it - items.begin()] && pt_to_del == *it) {
-          present[it - items.begin()] = false;
-          num_removed++;
-          break;
+      bool removed = false;
+      for (auto s = start; !removed && s < end; s += LEAF_SCAN_CHUNK) {
+        auto count = std::min(LEAF_SCAN_CHUNK, end - s);
+        for (auto mask = scan.equal(pt_to_del, s, count); mask; mask &= mask - 1) {
+          auto i = s + __builtin_ctzll(mask);
+          if (present[i]) {
+            present.reset(i);
+            num_removed++;
+            removed = true;
+            break;
+          }
         }
       }
     }
 #ifdef ERASE_SEARCH_TIMES
     total_search_time += t.get_next();
 #endif
+    return num_removed == 0 || present.count(start, end, false) > 0;
+  }
 
-    node->removePoints(num_removed);  // mark the points as removed
-#ifdef ERASE_SEARCH_TIMES
-    total_bbox_time += t.get_next();
-#endif
-
-    // check if we can delete the leaf
-    if (node->countPoints() == 0) {
-      return nullptr;  // deleted all points -> delete the leaf
-    } else {
-      if (num_removed > 0) {
-        node->recomputeBoundingBoxLeaf(items.begin(), present);
-      }
-      return node;  // didn't delete all the points -> don't delete this leaf
+  /*!
+   * What replaces [node] in its parent once its children have been erased from, and cut out if
+   * they were left without points: nullptr if it has no children left, its only child if that is
+   * an interior node, and otherwise itself (with its bbox recomputed if [num_removed] > 0).
+   */
+  nodeT *bulk_erase_collapse(nodeT *node, size_t num_removed) {
+    auto has_left = node->hasChild(false), has_right = node->hasChild(true);
+    if (!has_left && !has_right) return nullptr;  // both children deleted -> delete me
+    if (has_left != has_right && node->getChild(has_right) != nullptr) {
+      return node->getChild(has_right);  // one child deleted -> delete me, but not my subtree
     }
+    if (num_removed > 0) node->recomputeBoundingBox(items.begin(), present);
+    return node;
   }
 
-  nodeT *bulk_erase_helper(nodeT *node, parlay::slice<objT *, objT *> points, size_t &num_removed) {
-    if (node->isLeaf()) {
+  /*!
+   * Delete [points] from side [right] of [node]. Its child there is cut out if it has no points
+   * left, or replaced by what is left of it.
+   */
+  template <class EraseChild>
+  void bulk_erase_side(nodeT *node,
+                       bool right,
+                       parlay::slice<objT *, objT *> points,
+                       size_t &num_removed,
+                       const EraseChild &erase_child) {
+    num_removed = 0;
+    if (node->isLeafChild(right)) {
 #ifdef ERASE_SEARCH_TIMES
       timer t;
 #endif
-      auto r = bulk_erase_leaf(node, points, num_removed);
+      auto live = bulk_erase_leaf(
+          node->getChildStartIdx(right), node->getChildEndIdx(right), points, num_removed);
 #ifdef ERASE_SEARCH_TIMES
       total_leaf_time += t.get_next();
 #endif
-      return r;
-    } else {
-      auto right_start = serialPartition(points, node->getSplitDimension(), node->getSplitValue());
-
-      // recurse on the two halves
-      size_t num_removed_left, num_removed_right;
-      auto new_left =
-          bulk_erase_helper(node->getLeft(), points.cut(0, right_start), num_removed_left);
-      auto new_right = bulk_erase_helper(
-          node->getRight(), points.cut(right_start, points.size()), num_removed_right);
-
-      num_removed = num_removed_left + num_removed_right;
-      // need to deal with root
-      if (new_left != nullptr && new_right != nullptr) {
-        // neither child deleted -> i'm not deleted
-        // TODO: it's possible to further case based on whether left/right changed, but doesn't seem
-        // worth
-        node->setLeft(new_left);
-        node->setRight(new_right);
-        assert(!node->isLeaf());
-        node->recomputeBoundingBox();
-        // parents[new_left - nodes] = node;
-        // parents[new_right - nodes] = node;
-        return node;
-      } else if (new_left == nullptr && new_right == nullptr) {
-        // both children deleted -> delete me
-        return nullptr;
-      } else {
-        // one child deleted -> delete me, but not my whole subtree
-        return (new_left == nullptr) ? new_right : new_left;
-      }
+      if (!live && ownsNodes()) node->setChild(right, nullptr);  // a fork keeps emptied leaves
+    } else if (node->hasChild(right)) {
+      auto new_child = erase_child(node->getChild(right), points, num_removed);
+      if (ownsNodes()) node->setChild(right, new_child);
     }
   }
 
+  nodeT *bulk_erase_helper(nodeT *node, parlay::slice<objT *, objT *> points, size_t &num_removed) {
+    if (points.size() == 0) {  // the partitions above routed no point here: skip the subtree
+      num_removed = 0;
+      return node;
+    }
+    auto right_start = serialPartition(points, node->getSplitDimension(), node->getSplitValue());
+
+    // recurse on the two halves
+    auto erase_child = [&](nodeT *child, parlay::slice<objT *, objT *> pts, size_t &removed) {
+      return bulk_erase_helper(child, pts, removed);
+    };
+    size_t num_removed_left, num_removed_right;
+    bulk_erase_side(node, false, points.cut(0, right_start), num_removed_left, erase_child);
+    bulk_erase_side(
+        node, true, points.cut(right_start, points.size()), num_removed_right, erase_child);
+
+    num_removed = num_removed_left + num_removed_right;
+    removePoints(node, num_removed);
+    if (!ownsNodes()) return node;
+    return bulk_erase_collapse(node, num_removed);
+  }
+
   nodeT *bulk_erase_helper_parallel(nodeT *node,
                                     parlay::slice<objT *, objT *> points,
                                     parlay::slice<bool *, bool *> flags,
@@ -671,60 +1106,39 @@ class KdTree {
     };
 #endif
 
-    if (node->isLeaf()) {
-      return bulk_erase_leaf(node, points, num_removed);
-    } else {
 #ifdef PRINT_KDTREE_TIMINGS
-      mtime("Start partition: " + std::to_string(points.size()));
+    mtime("Start partition: " + std::to_string(points.size()));
 #endif
-      auto right_start =
-          parallelPartition(points, flags, node->getSplitDimension(), node->getSplitValue());
+    auto right_start =
+        parallelPartition(points, flags, node->getSplitDimension(), node->getSplitValue());
 #ifdef PRINT_KDTREE_TIMINGS
-      mtime("Finish partition: " + std::to_string(points.size()));
-#endif
-
-      // recurse on the two halves
-      nodeT *new_left, *new_right;
-      size_t num_removed_left, num_removed_right;
-      parlay::par_do(
-          [&]() {
-            new_left = bulk_erase_helper_parallel(node->getLeft(),
-                                                  points.cut(0, right_start),
-                                                  flags.cut(0, right_start),
-                                                  num_removed_left);
-          },
-          [&]() {
-            new_right = bulk_erase_helper_parallel(node->getRight(),
-                                                   points.cut(right_start, points.size()),
-                                                   flags.cut(right_start, points.size()),
-                                                   num_removed_right);
-          });
-      num_removed = num_removed_left + num_removed_right;
+    mtime("Finish partition: " + std::to_string(points.size()));
+#endif
+
+    // recurse on the two halves (each side only writes its own link of [node])
+    size_t num_removed_left, num_removed_right;
+    parlay::par_do(
+        [&]() {
+          bulk_erase_side(node, false, points.cut(0, right_start), num_removed_left,
+                          [&](nodeT *child, parlay::slice<objT *, objT *> pts, size_t &removed) {
+                            return bulk_erase_helper_parallel(
+                                child, pts, flags.cut(0, right_start), removed);
+                          });
+        },
+        [&]() {
+          bulk_erase_side(node, true, points.cut(right_start, points.size()), num_removed_right,
+                          [&](nodeT *child, parlay::slice<objT *, objT *> pts, size_t &removed) {
+                            return bulk_erase_helper_parallel(
+                                child, pts, flags.cut(right_start, points.size()), removed);
+                          });
+        });
+    num_removed = num_removed_left + num_removed_right;
+    removePoints(node, num_removed);
+    if (!ownsNodes()) return node;
 #ifdef PRINT_KDTREE_TIMINGS
-      mtime("Finish Recursion: " + std::to_string(points.size()));
-#endif
-
-      // need to deal with root
-      if (new_left != nullptr && new_right != nullptr) {
-        // neither child deleted -> i'm not deleted
-        // TODO: it's possible to further case based on whether left/right changed, but doesn't seem
-        // worth
-        // TODO: can parallelize with atomics if we want
-        node->setLeft(new_left);
-        node->setRight(new_right);
-        assert(!node->isLeaf());
-        node->recomputeBoundingBox();
-        // parents[new_left - nodes] = node;
-        // parents[new_right - nodes] = node;
-        return node;
-      } else if (new_left == nullptr && new_right == nullptr) {
-        // both children deleted -> delete me
-        return nullptr;
-      } else {
-        // one child deleted -> delete me, but not my whole subtree
-        return (new_left == nullptr) ? new_right : new_left;
-      }
-    }
+    mtime("Finish Recursion: " + std::to_string(points.size()));
+#endif
+    return bulk_erase_collapse(node, num_removed);
   }
 
   // Have to make a copy of the points array so that we can move them around.
@@ -735,9 +1149,8 @@ class KdTree {
 #endif
   {
     if (empty()) return;
-      // One scenario where this could create an invalid tree: if the entire left/right subtree
-      // of the root is being deleted, this function will not update root. BUT we don't care about
-      // this scenario, because this necessarily implies that the tree is being rebuilt.
+      // The root itself is never replaced: it keeps whatever children are left, even a single
+      // interior one that the helpers would cut it out for.
 #ifdef ALL_USE_BLOOM
     auto points = bloom_filter.filter(points_in);
 #endif
@@ -758,20 +1171,90 @@ class KdTree {
     cur_size -= num_removed;
   }
 
+  // Erase-By-Slot: erase the items at known positions of [items], e.g. from an ID locator. -------
+  // Subtrees cover contiguous ranges of [items], so the sorted slots are routed down by position:
+  // only the nodes on the paths to the affected leaves are touched, and no point is compared.
+  nodeT *bulk_erase_slots_helper(nodeT *node,
+                                 parlay::slice<uint32_t *, uint32_t *> slots,
+                                 size_t &num_removed) {
+    num_removed = 0;
+    if (slots.size() == 0) return node;
+
+    // the slots on each side of the split; slots outside an interior child were erased with a
+    // subtree that has been cut out, as were all of a side with no child
+    auto side_slots = [&](bool right) {
+      auto lo = node->getChildStartIdx(right), hi = node->getChildEndIdx(right);
+      if (auto child = node->getChild(right)) {
+        lo = child->getStartIdx();
+        hi = child->getEndIdx();
+      } else if (!node->isLeafChild(right)) {
+        return slots.cut(0, 0);
+      }
+      auto start = std::lower_bound(slots.begin(), slots.end(), lo);
+      auto end = std::lower_bound(start, slots.end(), hi);
+      return slots.cut(start - slots.begin(), end - slots.begin());
+    };
+    auto left_slots = side_slots(false), right_slots = side_slots(true);
+
+    size_t num_removed_left = 0, num_removed_right = 0;
+    auto erase_side = [&](bool right, parlay::slice<uint32_t *, uint32_t *> s, size_t &removed) {
+      if (node->isLeafChild(right)) {
+        for (auto slot : s) {
+          if (present[slot]) {
+            present.reset(slot);
+            removed++;
+          }
+        }
+        // deleted all points -> delete the leaf (a fork keeps it)
+        if (removed > 0 && ownsNodes() &&
+            present.count(node->getChildStartIdx(right), node->getChildEndIdx(right), false) == 0)
+          node->setChild(right, nullptr);
+      } else if (node->hasChild(right)) {
+        auto new_child = bulk_erase_slots_helper(node->getChild(right), s, removed);
+        if (ownsNodes()) node->setChild(right, new_child);
+      }
+    };
+    if (parallel && eraseInParallel(slots.size())) {
+      parlay::par_do([&]() { erase_side(false, left_slots, num_removed_left); },
+                     [&]() { erase_side(true, right_slots, num_removed_right); });
+    } else {
+      erase_side(false, left_slots, num_removed_left);
+      erase_side(true, right_slots, num_removed_right);
+    }
+    num_removed = num_removed_left + num_removed_right;
+    if (num_removed == 0) return node;
+    removePoints(node, num_removed);
+    if (!ownsNodes()) return node;
+    return bulk_erase_collapse(node, num_removed);  // same restructuring as [bulk_erase_helper]
+  }
+
+  /*!
+   * Delete the items at positions [slots] of [items] (sorted, within the built size); slots that
+   * are already deleted are skipped. As with [bulk_erase], the root itself is never replaced.
+   */
+  void bulk_erase_slots(parlay::slice<uint32_t *, uint32_t *> slots) {
+    if (empty()) return;
+    assert(slots.size() == 0 || slots[slots.size() - 1] < build_size);
+    size_t num_removed;
+    bulk_erase_slots_helper(nodes, slots, num_removed);
+    cur_size -= num_removed;
+  }
+
   // DEBUG --------------------------------------------
   /*!
    * Verify that the tree is balanced - the right child has either the same number of points as the
-   * left, or exactly one more.
+   * left, or exactly one more (with object median splits) - and that the live counts add up.
    */
   bool verify() const {
-    nodes[0].verify();
+    nodes[0].verify(nodes, live_counts, present);
     return true;
   }
 
-  std::pair<parlay::slice<const objT *, const objT *>, parlay::slice<const bool *, const bool *>>
-  getItems() const {
-    return {items.cut(0, build_size), present.cut(0, build_size)};
+  // the slots of the last build and their liveness bits (only the first [build_size] are used)
+  std::pair<parlay::slice<const objT *, const objT *>, const LiveBitmap &> getItems() const {
+    return {items.cut(0, build_size), present};
   }
+  const CowPages<uint32_t> &getLiveCounts() const { return live_counts; }
 
   /*!
    * Get direct pointer to the root node of the tree.
@@ -788,8 +1271,16 @@ class KdTree {
       node->print(getNodeValueIdx(node));
 
       // print next level
-      print(prefix + (isLeft ? "│   " : "    "), node->getLeft(), true);
-      print(prefix + (isLeft ? "│   " : "    "), node->getRight(), false);
+      for (bool right : {false, true}) {
+        auto child_prefix = prefix + (isLeft ? "│   " : "    ");
+        if (node->isLeafChild(right)) {
+          std::cout << child_prefix << (right ? "└──" : "├──");
+          nodeT::printLeaf(
+              node->getChildStartIdx(right), node->getChildEndIdx(right), items.begin());
+        } else {
+          print(child_prefix, node->getChild(right), !right);
+        }
+      }
     }
   }
   void print() const { print(std::string(""), nodes, false); }
@@ -5,6 +5,8 @@
 // https://github.mit.edu/yiqiuw/pargeo/blob/master/knnSearch/kdTree/kdtKnn.h Later, need to merge +
 // refer to that rather than copying here
 #include <common/geometry.h>
+#include "box.h"
+#include "macro.h"
 namespace knnBuf {
 
 typedef int intT;
@@ -12,17 +14,24 @@ typedef double floatT;
 
 template <typename T>
 struct elem {
-  floatT cost;  // Non-negative
+  floatT cost;  // Non-negative; squared distance to the query point
   T entry;
   elem(floatT t_cost, T t_entry) : cost(t_cost), entry(t_entry) {}
-  elem() : cost(std::numeric_limits<floatT>::max()) {}
+  elem() : cost(std::numeric_limits<floatT>::max()), entry() {}  // an empty slot: null [entry]
   bool operator<(const elem& b) const {
     if (cost < b.cost) return true;
     return false;
   }
 };
 
-template <typename T>
+// A buffer for the k nearest candidates of a single query, stored in an externally owned slice of
+// 2k elements. After [keepK()], the first k slots of the slice hold the k nearest candidates.
+// [mode] selects the implementation:
+//  - KNNBUF_NTH_ELEMENT: append into all 2k slots, std::nth_element when full/queried.
+//  - KNNBUF_HEAP: bounded max-heap in the first k slots; k-th distance is always buf[0].
+//  - KNNBUF_SORTED: insertion-sorted array in the first k slots; k-th distance is buf[k - 1].
+// The heap/sorted modes keep the k-th distance available in O(1), so [keepK()] never sorts.
+template <typename T, int mode = KNN_BUFFER>
 struct buffer {
   typedef parlay::slice<elem<T>*, elem<T>*> sliceT;
   /*const*/ intT k;  // not const because of assignment in dualKnn
@@ -35,10 +44,28 @@ struct buffer {
 
   inline void reset() { ptr = 0; }
 
+  /*!
+   * Treat the first k slots of [buf] as already holding candidates (e.g. the results from a
+   * previous tree that shared this slice).
+   */
+  void preload() {
+    ptr = k;
+    if (mode == KNNBUF_HEAP) {
+      std::make_heap(buf.begin(), buf.begin() + k);
+    } else if (mode == KNNBUF_SORTED) {
+      std::sort(buf.begin(), buf.begin() + k);
+    }
+  }
+
   bool hasK() { return ptr >= k; }
 
   elem<T> keepK() {
     if (ptr < k) throw std::runtime_error("Error, kbuffer not enough k.");
+    if (mode == KNNBUF_HEAP) {
+      return buf[0];
+    } else if (mode == KNNBUF_SORTED) {
+      return buf[k - 1];
+    }
     if (!cached) {  // only need to do this if modified since last call
       std::nth_element(buf.begin(), buf.begin() + k - 1, buf.begin() + ptr);
       ptr = k;
@@ -48,9 +75,42 @@ struct buffer {
   }
 
   void insert(elem<T> t_elem) {
-    buf[ptr++] = t_elem;
-    cached = false;
-    if (ptr >= (int)buf.size()) keepK();
+    if (mode == KNNBUF_HEAP) {
+      if (ptr < k) {
+        buf[ptr++] = t_elem;
+        if (ptr == k) std::make_heap(buf.begin(), buf.begin() + k);
+      } else if (t_elem.cost < buf[0].cost) {
+        // replace the current k-th candidate and sift it down
+        intT i = 0;
+        while (true) {
+          intT c = 2 * i + 1;
+          if (c >= k) break;
+          if (c + 1 < k && buf[c].cost < buf[c + 1].cost) c++;
+          if (!(t_elem.cost < buf[c].cost)) break;
+          buf[i] = buf[c];
+          i = c;
+        }
+        buf[i] = t_elem;
+      }
+    } else if (mode == KNNBUF_SORTED) {
+      intT i;
+      if (ptr < k) {
+        i = ptr++;
+      } else if (t_elem.cost < buf[k - 1].cost) {
+        i = k - 1;
+      } else {
+        return;
+      }
+      // shift larger candidates up one slot
+      for (; i > 0 && t_elem.cost < buf[i - 1].cost; i--) {
+        buf[i] = buf[i - 1];
+      }
+      buf[i] = t_elem;
+    } else {
+      buf[ptr++] = t_elem;
+      cached = false;
+      if (ptr >= (int)buf.size()) keepK();
+    }
   }
 
   elem<T> operator[](intT i) {
@@ -61,6 +121,35 @@ struct buffer {
   }
 };
 
+/*!
+ * Accuracy knobs for approximate kNN; the default is an exact search.
+ *  - [eps] > 0: prune a subtree once it is farther than r / (1 + eps), with r the current k-th
+ *    distance, so the j-th reported neighbor is within (1 + eps) of the true j-th neighbor.
+ *  - [max_leaves] > 0: stop descending after visiting that many leaves per tree, as soon as the
+ *    query has k candidates (no distance guarantee).
+ */
+struct approx {
+  double eps = 0;
+  size_t max_leaves = 0;
+
+  bool exact() const { return eps == 0 && max_leaves == 0; }
+};
+
+// Per-query state of an approximate search
+struct approxQuery {
+  double box_scale;    // the pruning radius is scaled by this: 1 / (1 + eps)
+  size_t leaves_left;  // leaf-visit budget
+
+  approxQuery(const approx& a)
+      : box_scale(1 / (1 + a.eps)),
+        leaves_left(a.max_leaves ? a.max_leaves : std::numeric_limits<size_t>::max()) {}
+
+  inline void visitLeaf() {
+    if (leaves_left > 0) leaves_left--;
+  }
+  inline bool outOfLeaves() const { return leaves_left == 0; }
+};
+
 template <int dim>
 parlay::sequence<const point<dim>*> bruteforceKnn(const parlay::sequence<point<dim>>& queries,
                                                   size_t k) {
@@ -71,9 +160,9 @@ parlay::sequence<const point<dim>*> bruteforceKnn(const parlay::sequence<point<d
     buffer buf = buffer<const point<dim>*>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
     for (intT j = 0; j < (int)queries.size(); ++j) {
       auto p = &queries[j];
-      buf.insert(elem(q.dist(p), p));
+      buf.insert(elem(pointDistanceSqr(q, *p), p));
     }
-    buf.keepK();
+    if (buf.hasK()) buf.keepK();
 
     // store results
     for (size_t j = 0; j < k; j++) {
@@ -83,6 +172,46 @@ parlay::sequence<const point<dim>*> bruteforceKnn(const parlay::sequence<point<d
   return idx;
 }
 
+/*!
+ * Copy the neighbors in [res] (k slots per query, null where a query found fewer than k) into a
+ * CSR result {offsets, items}: query i's neighbors are items[offsets[i], offsets[i + 1]).
+ */
+template <class objT, class pointT>
+std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> gatherItems(
+    const parlay::sequence<const pointT*>& res, size_t num_queries, int k, bool parallel) {
+  // count
+  parlay::sequence<size_t> offsets(num_queries + 1);
+  auto count_query = [&](size_t i) {
+    offsets[i] = 0;
+    for (int j = 0; j < k; j++)
+      offsets[i] += (res[i * k + j] != nullptr);
+  };
+  if (parallel) {
+    parlay::parallel_for(0, num_queries, count_query);
+  } else {
+    for (size_t i = 0; i < num_queries; i++)
+      count_query(i);
+  }
+  offsets[num_queries] = 0;
+  auto total = parlay::scan_inplace(offsets);
+
+  // write
+  parlay::sequence<objT> out(total);
+  auto write_query = [&](size_t i) {
+    auto pos = offsets[i];
+    for (int j = 0; j < k; j++) {
+      if (auto p = res[i * k + j]) out[pos++] = *static_cast<const objT*>(p);
+    }
+  };
+  if (parallel) {
+    parlay::parallel_for(0, num_queries, write_query);
+  } else {
+    for (size_t i = 0; i < num_queries; i++)
+      write_query(i);
+  }
+  return {std::move(offsets), std::move(out)};
+}
+
 }  // namespace knnBuf
 
 #endif  //  KDTREE_SHARED_KNNBUFFER_H
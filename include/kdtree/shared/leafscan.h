@@ -0,0 +1,179 @@
+#ifndef KDTREE_SHARED_LEAFSCAN_H
+#define KDTREE_SHARED_LEAFSCAN_H
+
+#include <cstdint>
+#include <algorithm>
+#include "common/geometry.h"
+
+#include "macro.h"
+#include "box.h"
+
+#if defined(LEAF_SOA) && (defined(__AVX512F__) || defined(__AVX2__))
+#include <immintrin.h>
+#endif
+
+// Leaf scan kernels. A leaf covers a contiguous range of the tree's [items], so scanning it is a
+// loop over that range. With LEAF_SOA, the tree keeps a structure-of-arrays mirror of the item
+// coordinates (coordinate d of item i at soa[d * stride + i]), built at build() time, and the
+// kernels below evaluate a whole chunk of a leaf with AVX-512/AVX2 (chosen at compile time, with a
+// scalar fallback). Without LEAF_SOA they are plain loops over the array-of-structs [items].
+
+// maximum number of items handled by a single kernel call (bitmasks are 64 bits)
+static constexpr size_t LEAF_SCAN_CHUNK = 64;
+
+template <int dim, class objT>
+struct LeafScan {
+  typedef point<dim> pointT;
+
+  const objT *tree_start;  // the tree's [items]
+#ifdef LEAF_SOA
+  const double *soa;  // coordinate d of item i at soa[d * stride + i]
+  size_t stride;
+#endif
+
+  /*!
+   * <Serial> Squared distance from [q] to each of items [start, start + count) -> [out].
+   */
+  inline void distSqr(const pointT &q, size_t start, size_t count, double *out) const {
+    assert(count <= LEAF_SCAN_CHUNK);
+#ifdef LEAF_SOA
+    size_t j = 0;
+#if defined(__AVX512F__)
+    for (; j < count; j += 8) {
+      __mmask8 m = (count - j >= 8) ? (__mmask8)0xFF : (__mmask8)((1u << (count - j)) - 1);
+      __m512d acc = _mm512_setzero_pd();
+      for (int d = 0; d < dim; d++) {
+        __m512d x = _mm512_maskz_loadu_pd(m, soa + d * stride + start + j);
+        __m512d diff = _mm512_sub_pd(x, _mm512_set1_pd(q.coordinate(d)));
+        acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+      }
+      _mm512_mask_storeu_pd(out + j, m, acc);
+    }
+#elif defined(__AVX2__)
+    for (; j + 4 <= count; j += 4) {
+      __m256d acc = _mm256_setzero_pd();
+      for (int d = 0; d < dim; d++) {
+        __m256d x = _mm256_loadu_pd(soa + d * stride + start + j);
+        __m256d diff = _mm256_sub_pd(x, _mm256_set1_pd(q.coordinate(d)));
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+      }
+      _mm256_storeu_pd(out + j, acc);
+    }
+#endif
+    for (; j < count; j++) {  // scalar fallback / tail
+      double acc = 0;
+      for (int d = 0; d < dim; d++) {
+        double diff = soa[d * stride + start + j] - q.coordinate(d);
+        acc += diff * diff;
+      }
+      out[j] = acc;
+    }
+#else
+    for (size_t j = 0; j < count; j++) {
+      out[j] = pointDistanceSqr(q, tree_start[start + j]);
+    }
+#endif
+  }
+
+  /*!
+   * <Serial> Bitmask of items in [start, start + count) inside the box [qMin, qMax].
+   */
+  inline uint64_t inBox(const objT &qMin, const objT &qMax, size_t start, size_t count) const {
+    assert(count <= LEAF_SCAN_CHUNK);
+    uint64_t ret = 0;
+#ifdef LEAF_SOA
+    size_t j = 0;
+#if defined(__AVX512F__)
+    for (; j < count; j += 8) {
+      __mmask8 m = (count - j >= 8) ? (__mmask8)0xFF : (__mmask8)((1u << (count - j)) - 1);
+      for (int d = 0; d < dim; d++) {
+        __m512d x = _mm512_maskz_loadu_pd(m, soa + d * stride + start + j);
+        m = _mm512_mask_cmp_pd_mask(m, x, _mm512_set1_pd(qMin.coordinate(d)), _CMP_GE_OQ);
+        m = _mm512_mask_cmp_pd_mask(m, x, _mm512_set1_pd(qMax.coordinate(d)), _CMP_LE_OQ);
+      }
+      ret |= (uint64_t)m << j;
+    }
+#elif defined(__AVX2__)
+    for (; j + 4 <= count; j += 4) {
+      __m256d in = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+      for (int d = 0; d < dim; d++) {
+        __m256d x = _mm256_loadu_pd(soa + d * stride + start + j);
+        in = _mm256_and_pd(in, _mm256_cmp_pd(x, _mm256_set1_pd(qMin.coordinate(d)), _CMP_GE_OQ));
+        in = _mm256_and_pd(in, _mm256_cmp_pd(x, _mm256_set1_pd(qMax.coordinate(d)), _CMP_LE_OQ));
+      }
+      ret |= (uint64_t)_mm256_movemask_pd(in) << j;
+    }
+#endif
+    for (; j < count; j++) {  // scalar fallback / tail
+      bool in = true;
+      for (int d = 0; d < dim; d++) {
+        auto x = soa[d * stride + start + j];
+        in &= (qMin.coordinate(d) <= x) & (x <= qMax.coordinate(d));
+      }
+      ret |= (uint64_t)in << j;
+    }
+#else
+    for (size_t j = 0; j < count; j++) {
+      ret |= (uint64_t)itemInBox(qMin, qMax, tree_start + start + j) << j;
+    }
+#endif
+    return ret;
+  }
+
+  /*!
+   * <Serial> Bitmask of items in [start, start + count) within squared distance [r_sqr] of [q].
+   */
+  inline uint64_t inBall(const pointT &q, double r_sqr, size_t start, size_t count) const {
+    double dists[LEAF_SCAN_CHUNK];
+    distSqr(q, start, count, dists);
+    uint64_t ret = 0;
+    for (size_t j = 0; j < count; j++) {
+      ret |= (uint64_t)(dists[j] <= r_sqr) << j;
+    }
+    return ret;
+  }
+
+  /*!
+   * <Serial> Bitmask of items in [start, start + count) equal to [p].
+   */
+  inline uint64_t equal(const objT &p, size_t start, size_t count) const {
+    assert(count <= LEAF_SCAN_CHUNK);
+    uint64_t ret = 0;
+#ifdef LEAF_SOA
+    size_t j = 0;
+#if defined(__AVX512F__)
+    for (; j < count; j += 8) {
+      __mmask8 m = (count - j >= 8) ? (__mmask8)0xFF : (__mmask8)((1u << (count - j)) - 1);
+      for (int d = 0; d < dim; d++) {
+        __m512d x = _mm512_maskz_loadu_pd(m, soa + d * stride + start + j);
+        m = _mm512_mask_cmp_pd_mask(m, x, _mm512_set1_pd(p.coordinate(d)), _CMP_EQ_OQ);
+      }
+      ret |= (uint64_t)m << j;
+    }
+#elif defined(__AVX2__)
+    for (; j + 4 <= count; j += 4) {
+      __m256d eq = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+      for (int d = 0; d < dim; d++) {
+        __m256d x = _mm256_loadu_pd(soa + d * stride + start + j);
+        eq = _mm256_and_pd(eq, _mm256_cmp_pd(x, _mm256_set1_pd(p.coordinate(d)), _CMP_EQ_OQ));
+      }
+      ret |= (uint64_t)_mm256_movemask_pd(eq) << j;
+    }
+#endif
+    for (; j < count; j++) {  // scalar fallback / tail
+      bool eq = true;
+      for (int d = 0; d < dim; d++) {
+        eq &= (soa[d * stride + start + j] == p.coordinate(d));
+      }
+      ret |= (uint64_t)eq << j;
+    }
+#else
+    for (size_t j = 0; j < count; j++) {
+      ret |= (uint64_t)(p == tree_start[start + j]) << j;
+    }
+#endif
+    return ret;
+  }
+};
+
+#endif  // KDTREE_SHARED_LEAFSCAN_H
@@ -8,7 +8,7 @@
 //#define PRINT_DELETE_TIMINGS
 //#define PRINT_KDTREE_TIMINGS
 //#define PRINT_COKDTREE_TIMINGS
-//#define USE_MEDIAN_SELECTION
+//#define USE_MEDIAN_SORT
 //#define PRINT_PARALLEL_PARTITION_TIMINGS
 //#define ERASE_SEARCH_TIMES
 
@@ -16,12 +16,21 @@
 //#define LOGTREE_USE_BLOOM
 //#define BLOOM_FILTER_BUILD_COPY
 
+//#define LEAF_SOA
+//#define KNN_MORTON_ORDER
+
 #define PARTITION_OBJECT_MEDIAN 0
 #define PARTITION_SPATIAL_MEDIAN 1
 #ifndef PARTITION_TYPE
 #define PARTITION_TYPE PARTITION_OBJECT_MEDIAN
 #endif
 
+#define SPLIT_ROUND_ROBIN 0
+#define SPLIT_MAX_SPREAD 1
+#ifndef SPLIT_RULE
+#define SPLIT_RULE SPLIT_ROUND_ROBIN
+#endif
+
 // DUAL KNN MODE
 #define DKNN_ATOMIC_LEAF 0
 #define DKNN_NONATOMIC_LEAF 1
@@ -31,10 +40,32 @@
 #define DUAL_KNN_MODE DKNN_NONATOMIC_LEAF
 #endif
 
+// KNN BUFFER
+#define KNNBUF_NTH_ELEMENT 0
+#define KNNBUF_HEAP 1
+#define KNNBUF_SORTED 2
+
+#ifndef KNN_BUFFER  // default if not defined in cmake
+#define KNN_BUFFER KNNBUF_NTH_ELEMENT
+#endif
+
 // LOGTREE BUFFER
 #define BHL_BUFFER 0
 #define ARR_BUFFER 1
+
+#ifndef LOGTREE_BUFFER  // default if not defined in cmake
 #define LOGTREE_BUFFER BHL_BUFFER
+#endif
+
+// LOGTREE GEOMETRY: default buffer size of a LogTree (see LogTreeConfig)
+#ifndef LOGTREE_BUFFER_LOG2_SIZE
+#define LOGTREE_BUFFER_LOG2_SIZE 10
+#endif
+
+// BLOOM FILTER: target false-positive rate, sets the filter size
+#ifndef BLOOM_FP_RATE
+#define BLOOM_FP_RATE 0.01
+#endif
 
 // LEAF CLUSTER SIZE
 #ifndef CLUSTER_SIZE
@@ -70,12 +101,32 @@
 #define BHL_BUILD_BASE_CASE 1000
 #endif
 
+// an incremental insert into a BHL tree rebuilds a subtree once one child would hold more than
+// this fraction of its points
+#ifndef BHL_REBUILD_ALPHA
+#define BHL_REBUILD_ALPHA 0.75
+#endif
+
+#ifndef SELECT_BASE_CASE
+#define SELECT_BASE_CASE 10000
+#endif
+
+// COPY-ON-WRITE PAGES: a tree's liveness bits and live counts are copied in pages of this many
+// bytes when a tree shared with a snapshot is modified (see shared/cow.h)
+#ifndef COW_PAGE_BYTES
+#define COW_PAGE_BYTES 4096
+#endif
+
 #ifdef PRINT_CONFIG
 #include <iostream>
 void print_config() {
   std::cout << "DUAL_KNN_MODE = " << DUAL_KNN_MODE << ";\n"
             << "PARTITION_TYPE = " << PARTITION_TYPE << ";\n"
+            << "SPLIT_RULE = " << SPLIT_RULE << ";\n"
+            << "KNN_BUFFER = " << KNN_BUFFER << ";\n"
             << "LOGTREE_BUFFER = " << LOGTREE_BUFFER << ";\n"
+            << "LOGTREE_BUFFER_LOG2_SIZE = " << LOGTREE_BUFFER_LOG2_SIZE << ";\n"
+            << "BLOOM_FP_RATE = " << BLOOM_FP_RATE << ";\n"
             << "CLUSTER_SIZE = " << CLUSTER_SIZE << ";\n"
             << "ERASE_BASE_CASE = " << ERASE_BASE_CASE << ";\n"
             << "RANGEQUERY_BASE_CASE = " << RANGEQUERY_BASE_CASE << ";\n"
@@ -83,7 +134,10 @@ void print_config() {
             << "DUALKNN_BASE_CASE = " << DUALKNN_BASE_CASE << ";\n"
             << "CO_TOP_BUILD_BASE_CASE = " << CO_TOP_BUILD_BASE_CASE << ";\n"
             << "CO_BOTTOM_BUILD_BASE_CASE = " << CO_BOTTOM_BUILD_BASE_CASE << ";\n"
-            << "BHL_BUILD_BASE_CASE = " << BHL_BUILD_BASE_CASE << std::endl;
+            << "BHL_BUILD_BASE_CASE = " << BHL_BUILD_BASE_CASE << ";\n"
+            << "BHL_REBUILD_ALPHA = " << BHL_REBUILD_ALPHA << ";\n"
+            << "SELECT_BASE_CASE = " << SELECT_BASE_CASE << ";\n"
+            << "COW_PAGE_BYTES = " << COW_PAGE_BYTES << std::endl;
 }
 #else
 void print_config() {}
@@ -0,0 +1,65 @@
+#ifndef KDTREE_SHARED_MORTON_H
+#define KDTREE_SHARED_MORTON_H
+
+#include <cstdint>
+#include <algorithm>
+#include "common/geometry.h"
+#include "parlay/sequence.h"
+#include "parlay/primitives.h"
+
+#include "macro.h"
+
+// Morton (Z-order) ordering of query batches. Queries that are close in space get close keys, so
+// visiting a batch in key order makes consecutive queries on a worker walk mostly the same
+// root-to-leaf paths, which then stay in L1/L2. With KNN_MORTON_ORDER, batch kNN visits its queries
+// in this order and writes each result to the query's original slot.
+
+/*!
+ * <Serial> Z-order key of [p] on the grid over the box [pMin, pMax] (points outside are clamped).
+ */
+template <int dim>
+inline uint64_t mortonKey(const point<dim> &p, const point<dim> &pMin, const point<dim> &pMax) {
+  constexpr int bits = std::max(1, std::min(32, 64 / dim));  // bits per coordinate
+  constexpr double cells = (double)(uint64_t(1) << bits);
+
+  uint64_t cell[dim];
+  for (int d = 0; d < dim; d++) {
+    auto extent = pMax.coordinate(d) - pMin.coordinate(d);
+    auto t = (extent > 0) ? (p.coordinate(d) - pMin.coordinate(d)) / extent * cells : 0.0;
+    cell[d] = (uint64_t)std::clamp(t, 0.0, cells - 1);
+  }
+
+  // interleave the coordinate bits, most significant first
+  uint64_t key = 0;
+  int pos = 63;
+  for (int b = bits - 1; b >= 0 && pos >= 0; b--) {
+    for (int d = 0; d < dim && pos >= 0; d++, pos--) {
+      key |= ((cell[d] >> b) & 1) << pos;
+    }
+  }
+  return key;
+}
+
+/*!
+ * Order in which to visit [queries]: their indices sorted by Morton key over the box [pMin, pMax].
+ */
+template <int dim, class objT>
+parlay::sequence<uint32_t> mortonOrder(const parlay::sequence<objT> &queries,
+                                       const point<dim> &pMin,
+                                       const point<dim> &pMax,
+                                       bool parallel) {
+  auto keyed = parlay::tabulate(queries.size(), [&](size_t i) {
+    return std::make_pair(mortonKey<dim>(point<dim>(queries[i].coordinate()), pMin, pMax),
+                          (uint32_t)i);
+  });
+  auto compare = [](const std::pair<uint64_t, uint32_t> &l,
+                    const std::pair<uint64_t, uint32_t> &r) { return l.first < r.first; };
+  if (parallel) {
+    parlay::sort_inplace(keyed, compare);
+  } else {
+    std::sort(keyed.begin(), keyed.end(), compare);
+  }
+  return parlay::tabulate(keyed.size(), [&](size_t j) { return keyed[j].second; });
+}
+
+#endif  // KDTREE_SHARED_MORTON_H
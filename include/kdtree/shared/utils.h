@@ -6,6 +6,8 @@
 #include "parlay/primitives.h"
 #include "parlay/monoid.h"
 #include "parlay/delayed_sequence.h"
+#include "parlay/utilities.h"
+#include "common/geometry.h"
 
 #include "macro.h"
 
@@ -67,16 +69,93 @@ static inline void serialMedianPartitionSelect(parlay::slice<objT *, objT *> &it
   std::nth_element(items.begin(), items.begin() + split_point, items.end(), compare);
 }
 
+// parallel select based implementation (Floyd-Rivest style): a sorted random sample gives two
+// pivots that bracket the median with high probability; a parallel three-way partition (< lo,
+// [lo, hi], > hi) then narrows the window that contains the median, usually to a small fraction of
+// the input after a single round. Once the window is small, finish with the serial select.
+static constexpr size_t SELECT_SAMPLE_SIZE = 1024;
+static constexpr size_t SELECT_SAMPLE_GAP = 32;  // ~sqrt(SELECT_SAMPLE_SIZE)
+static constexpr size_t SELECT_BLOCK_SIZE = 4096;
+
+template <class objT>
+static inline void parallelMedianPartitionSelect(parlay::slice<objT *, objT *> &items,
+                                                 int dimension) {
+  auto compare = [dimension](const objT &l, const objT &r) {
+    return l.coordinate(dimension) < r.coordinate(dimension);
+  };
+
+  // invariant: items [0, lo) <= items [lo, hi) <= items [hi, n), and the median is in [lo, hi)
+  const size_t k = split_n(items);
+  size_t lo = 0, hi = items.size();
+  parlay::sequence<objT> tmp;
+  for (size_t round = 0; hi - lo > SELECT_BASE_CASE; round++) {
+    auto window = items.cut(lo, hi);
+    const size_t n = window.size();
+
+    // pick the pivots from a sorted sample
+    auto sample = parlay::tabulate(SELECT_SAMPLE_SIZE, [&](size_t i) {
+      return window[parlay::hash64(round * SELECT_SAMPLE_SIZE + i) % n].coordinate(dimension);
+    });
+    std::sort(sample.begin(), sample.end());
+    auto rank = (k - lo) * SELECT_SAMPLE_SIZE / n;
+    double lo_pivot = sample[rank > SELECT_SAMPLE_GAP ? rank - SELECT_SAMPLE_GAP : 0];
+    double hi_pivot = sample[std::min(rank + SELECT_SAMPLE_GAP, SELECT_SAMPLE_SIZE - 1)];
+    auto bucket = [&](const objT &o) -> int {
+      auto x = o.coordinate(dimension);
+      return (x < lo_pivot) ? 0 : ((x <= hi_pivot) ? 1 : 2);
+    };
+
+    // three-way partition: count each bucket per block, scan, then scatter into [tmp]
+    const size_t num_blocks = (n + SELECT_BLOCK_SIZE - 1) / SELECT_BLOCK_SIZE;
+    parlay::sequence<size_t> counts(3 * num_blocks);  // bucket-major: counts[b * num_blocks + i]
+    parlay::parallel_for(0, num_blocks, [&](size_t i) {
+      size_t c[3] = {0, 0, 0};
+      for (size_t j = i * SELECT_BLOCK_SIZE; j < std::min((i + 1) * SELECT_BLOCK_SIZE, n); j++)
+        c[bucket(window[j])]++;
+      for (int b = 0; b < 3; b++)
+        counts[b * num_blocks + i] = c[b];
+    });
+    size_t num_less = parlay::reduce(counts.cut(0, num_blocks));
+    size_t num_mid = parlay::reduce(counts.cut(num_blocks, 2 * num_blocks));
+    parlay::scan_inplace(counts);
+
+    if (num_mid == n) {
+      if (lo_pivot == hi_pivot) return;  // the whole window equals the median
+      break;                             // pivots didn't separate anything, select serially
+    }
+
+    if (tmp.size() < n) tmp = parlay::sequence<objT>(n);
+    parlay::parallel_for(0, num_blocks, [&](size_t i) {
+      size_t offset[3] = {counts[i], counts[num_blocks + i], counts[2 * num_blocks + i]};
+      for (size_t j = i * SELECT_BLOCK_SIZE; j < std::min((i + 1) * SELECT_BLOCK_SIZE, n); j++)
+        tmp[offset[bucket(window[j])]++] = window[j];
+    });
+    parlay::parallel_for(0, n, [&](size_t j) { window[j] = tmp[j]; });
+
+    // narrow the window to the bucket that holds the median
+    if (k < lo + num_less) {
+      hi = lo + num_less;
+    } else if (k < lo + num_less + num_mid) {
+      lo += num_less;
+      hi = lo + num_mid;
+      if (lo_pivot == hi_pivot) return;  // the middle bucket is all equal to the median
+    } else {
+      lo += num_less + num_mid;
+    }
+  }
+  std::nth_element(items.begin() + lo, items.begin() + k, items.begin() + hi, compare);
+}
+
 // Top level functions ------------------
 // object median
 template <class objT>
 double parallelMedianPartition(parlay::slice<objT *, objT *> items, int dimension) {
-#ifdef USE_MEDIAN_SELECTION
-  serialMedianPartitionSelect<objT>(items, dimension);  // selection-based version
-  return split_val<objT, true>(items, dimension);
-#else
+#ifdef USE_MEDIAN_SORT
   medianPartitionSort<objT, true>(items, dimension);  // sort-based version
   return split_val(items, dimension);
+#else
+  parallelMedianPartitionSelect<objT>(items, dimension);  // selection-based version
+  return split_val<objT, true>(items, dimension);
 #endif
 }
 
@@ -91,6 +170,58 @@ double serialMedianPartition(parlay::slice<objT *, objT *> items, int dimension)
   //#endif
 }
 
+// SPLIT DIMENSION FUNCTIONS -----------------------------------------------------------------------
+// dimension of greatest extent (max - min) among [items]; ties go to [split_dim]
+template <int dim, class objT>
+int maxSpreadDimension(parlay::slice<objT *, objT *> items, int split_dim, bool parallel) {
+  typedef point<dim> pointT;
+  auto block_box = [&](size_t s, size_t e) {
+    std::pair<pointT, pointT> box = {pointT(items[s].coordinate()), pointT(items[s].coordinate())};
+    for (auto i = s + 1; i < e; i++) {
+      box.first.minCoords(items[i].coordinate());
+      box.second.maxCoords(items[i].coordinate());
+    }
+    return box;
+  };
+
+  std::pair<pointT, pointT> box;
+  if (parallel && items.size() >= BOUNDINGBOX_BASE_CASE) {
+    const size_t num_blocks = (items.size() + BOUNDINGBOX_BASE_CASE - 1) / BOUNDINGBOX_BASE_CASE;
+    auto boxes = parlay::tabulate(num_blocks, [&](size_t b) {
+      return block_box(b * BOUNDINGBOX_BASE_CASE,
+                       std::min((b + 1) * BOUNDINGBOX_BASE_CASE, items.size()));
+    });
+    box = boxes[0];
+    for (size_t b = 1; b < num_blocks; b++) {
+      box.first.minCoords(boxes[b].first);
+      box.second.maxCoords(boxes[b].second);
+    }
+  } else {
+    box = block_box(0, items.size());
+  }
+
+  int best = split_dim;
+  for (int d = 0; d < dim; d++) {
+    auto spread = box.second.coordinate(d) - box.first.coordinate(d);
+    if (spread > box.second.coordinate(best) - box.first.coordinate(best)) best = d;
+  }
+  return best;
+}
+
+// split dimension for a node over [items], given the round-robin choice [split_dim]
+template <int dim, class objT>
+int splitDimension([[maybe_unused]] parlay::slice<objT *, objT *> items,
+                   int split_dim,
+                   [[maybe_unused]] bool parallel) {
+#if (SPLIT_RULE == SPLIT_ROUND_ROBIN)
+  return split_dim;
+#elif (SPLIT_RULE == SPLIT_MAX_SPREAD)
+  return maxSpreadDimension<dim, objT>(items, split_dim, parallel);
+#else
+  throw std::runtime_error("invalid split rule");
+#endif
+}
+
 // PARTITION FUNCTIONS -----------------------------------------------------------------------------
 
 template <class objT>
@@ -149,6 +280,9 @@ auto parallelPartition(parlay::slice<objT *, objT *> points,
 }
 
 bool eraseInParallel(size_t num_points) { return num_points >= ERASE_BASE_CASE; }
+inline bool rangeQueryInParallel(size_t num_points) {
+  return num_points >= RANGEQUERY_BASE_CASE;
+}
 
 template <class TT>
 struct minmaxm {
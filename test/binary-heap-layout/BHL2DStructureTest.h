@@ -18,18 +18,18 @@ class BHL2DStructureTest : public BasicStructure2D<Tree> {
 TYPED_TEST_SUITE_P(BHL2DStructureTest);
 
 TYPED_TEST_P(BHL2DStructureTest, LayoutSize2) {
+#if PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN
+  GTEST_SKIP() << "the expected layout assumes object median partitioning";
+#endif
   // create the tree
   auto tree = this->CONSTRUCT_2D_SIZE_2();
   auto root = tree.root();  // get the root to verify the layout
 
-  // Check node types
-  ASSERT_FALSE(root[0].isLeaf());
-  ASSERT_TRUE(root[1].isLeaf());
-  ASSERT_TRUE(root[2].isLeaf());
+  // Check node types: the leaves have no record of their own
+  ASSERT_TRUE(root[0].isLeafChild(false));
+  ASSERT_TRUE(root[0].isLeafChild(true));
   // Check point counts
-  ASSERT_EQ(root[0].countPoints(), 2);
-  ASSERT_EQ(root[1].countPoints(), 1);
-  ASSERT_EQ(root[2].countPoints(), 1);
+  ASSERT_EQ(tree.countPoints(root), 2);
   // Check memory values
   ASSERT_EQ(root[0].getSplitDimension(), 0);
   //#ifdef USE_MEDIAN_SELECTION
@@ -37,18 +37,21 @@ TYPED_TEST_P(BHL2DStructureTest, LayoutSize2) {
   //#else
   // ASSERT_EQ(root[0].getSplitValue(), 0.5);
   //#endif
-  ASSERT_EQ(root[1].getValues().size(), 1);
-  ASSERT_EQ(root[1].getValues()[0], this->POINT_ARR_2[0]);
-  ASSERT_EQ(tree.getNodeValueIdx(&root[1]), std::make_pair(0, 1));
-  ASSERT_EQ(root[2].getValues().size(), 1);
-  ASSERT_EQ(root[2].getValues()[0], this->POINT_ARR_2[1]);
-  ASSERT_EQ(tree.getNodeValueIdx(&root[2]), std::make_pair(1, 2));
+  ASSERT_EQ(tree.getLeafValues(root, false).size(), 1);
+  ASSERT_EQ(tree.getLeafValues(root, false)[0], this->POINT_ARR_2[0]);
+  ASSERT_EQ(tree.getLeafValueIdx(root, false), std::make_pair(0, 1));
+  ASSERT_EQ(tree.getLeafValues(root, true).size(), 1);
+  ASSERT_EQ(tree.getLeafValues(root, true)[0], this->POINT_ARR_2[1]);
+  ASSERT_EQ(tree.getLeafValueIdx(root, true), std::make_pair(1, 2));
   // Check memory layout
-  ASSERT_EQ(root->getLeft(), root + 1);
-  ASSERT_EQ(root->getRight(), root + 2);
+  ASSERT_EQ(root->getLeft(), nullptr);
+  ASSERT_EQ(root->getRight(), nullptr);
 }
 
 TYPED_TEST_P(BHL2DStructureTest, LayoutSize8) {
+#if PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN
+  GTEST_SKIP() << "the expected layout assumes object median partitioning";
+#endif
   // create the tree
   auto tree = this->CONSTRUCT_2D_SIZE_8();
   auto root = tree.root();  // get the root to verify the layout
@@ -58,33 +61,25 @@ TYPED_TEST_P(BHL2DStructureTest, LayoutSize8) {
   /*               0
    *           1       2
    *         3   4   5   6
-   *        7 8 9 A B C D E
+   *        . . . . . . . .    <- leaves, no record
    */
-  ASSERT_FALSE(root[0].isLeaf());
-
-  ASSERT_FALSE(root[1].isLeaf());
-  ASSERT_FALSE(root[2].isLeaf());
-
-  for (int i = 3; i < 7; i++) {
-    ASSERT_FALSE(root[i].isLeaf());
+  for (int i = 0; i < 3; i++) {
+    ASSERT_FALSE(root[i].isLeafChild(false));
+    ASSERT_FALSE(root[i].isLeafChild(true));
   }
-
-  for (int i = 7; i < 15; i++) {
-    ASSERT_TRUE(root[i].isLeaf());
+  for (int i = 3; i < 7; i++) {
+    ASSERT_TRUE(root[i].isLeafChild(false));
+    ASSERT_TRUE(root[i].isLeafChild(true));
   }
 
   // Check point counts
-  ASSERT_EQ(root[0].countPoints(), 8);
+  ASSERT_EQ(tree.countPoints(root), 8);
 
-  ASSERT_EQ(root[1].countPoints(), 4);
-  ASSERT_EQ(root[2].countPoints(), 4);
+  ASSERT_EQ(tree.countPoints(root + 1), 4);
+  ASSERT_EQ(tree.countPoints(root + 2), 4);
 
   for (int i = 3; i < 7; i++) {
-    ASSERT_EQ(root[i].countPoints(), 2);
-  }
-
-  for (int i = 7; i < 15; i++) {
-    ASSERT_EQ(root[i].countPoints(), 1);
+    ASSERT_EQ(tree.countPoints(root + i), 2);
   }
 
   // Check memory values - serial case always uses median selection
@@ -102,28 +97,103 @@ TYPED_TEST_P(BHL2DStructureTest, LayoutSize8) {
   ASSERT_EQ(root[2].getSplitDimension(), 1);
   ASSERT_EQ(root[2].getSplitValue(), split_values[2]);
 
-  ASSERT_EQ(root[3].getSplitDimension(), 0);
-  ASSERT_EQ(root[3].getSplitValue(), split_values[3]);
-  ASSERT_EQ(root[4].getSplitDimension(), 0);
-  ASSERT_EQ(root[4].getSplitValue(), split_values[4]);
-  ASSERT_EQ(root[5].getSplitDimension(), 0);
-  ASSERT_EQ(root[5].getSplitValue(), split_values[5]);
-  ASSERT_EQ(root[6].getSplitDimension(), 0);
-  ASSERT_EQ(root[6].getSplitValue(), split_values[6]);
+  for (int i = 3; i < 7; i++) {
+    ASSERT_EQ(root[i].getSplitDimension(), 0);
+    ASSERT_EQ(root[i].getSplitValue(), split_values[i]);
+  }
 
   for (int i = 0; i < 8; i++) {
-    ASSERT_EQ(root[i + 7].getValues().size(), 1);
-    ASSERT_EQ(root[i + 7].getValues()[0], this->POINT_ARR_8[i]);
-    ASSERT_EQ(tree.getNodeValueIdx(&root[i + 7]), std::make_pair(i, i + 1));
+    auto n = root + 3 + i / 2;
+    ASSERT_EQ(tree.getLeafValues(n, i % 2).size(), 1);
+    ASSERT_EQ(tree.getLeafValues(n, i % 2)[0], this->POINT_ARR_8[i]);
+    ASSERT_EQ(tree.getLeafValueIdx(n, i % 2), std::make_pair(i, i + 1));
   }
 
   // Check memory layout
-  for (int i = 0; i < 7; i++) {
+  for (int i = 0; i < 3; i++) {
     ASSERT_EQ(root[i].getLeft(), root + 2 * i + 1);
     ASSERT_EQ(root[i].getRight(), root + 2 * i + 2);
   }
+  for (int i = 3; i < 7; i++) {
+    ASSERT_EQ(root[i].getLeft(), nullptr);
+    ASSERT_EQ(root[i].getRight(), nullptr);
+  }
+}
+
+TYPED_TEST_P(BHL2DStructureTest, IncrementalInsert) {
+#if PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN
+  GTEST_SKIP() << "the expected layout assumes object median partitioning";
+#endif
+  typedef point<2> pointT;
+  auto P = [](double d) { return pointT({d, d}); };
+  const auto points = parlay::tabulate(8, [&](int i) { return P(i); });
+  TypeParam tree(4);  // room for 16 points
+  tree.insert(points.cut(0, points.size()));
+  auto root = tree.root();  // the layout of LayoutSize8
+
+  // lands in the leaf of {6, 6}: only that leaf is rebuilt, the items after it move up by one
+  const parlay::sequence<pointT> one = {P(6.5)};
+  tree.insert(one.cut(0, one.size()));
+  double split_values[7] = {4, 2, 6, 1, 3, 5, 7};
+  for (int i = 0; i < 7; i++) {
+    ASSERT_EQ(root[i].getSplitValue(), split_values[i]);
+  }
+  ASSERT_EQ(tree.countPoints(root), 9);
+  ASSERT_EQ(tree.countPoints(root + 2), 5);
+  ASSERT_EQ(tree.countPoints(root + 6), 3);
+  ASSERT_EQ(root[6].getLeft(), root + 13);
+  ASSERT_TRUE(root[13].isLeafChild(false));
+  ASSERT_TRUE(root[13].isLeafChild(true));
+  ASSERT_EQ(tree.getLeafValues(root + 13, false)[0], P(6));
+  ASSERT_EQ(tree.getLeafValues(root + 13, true)[0], P(6.5));
+  ASSERT_EQ(tree.getLeafValueIdx(root + 6, true), std::make_pair(8, 9));
+  ASSERT_EQ(tree.getLeafValues(root + 6, true)[0], P(7));
+
+  // unbalances the right subtree, which has no room for them below node 2: rebuilt from the root
+  const auto more = parlay::tabulate(6, [&](int i) { return P(7.1 + i / 10.0); });
+  tree.insert(more.cut(0, more.size()));
+  ASSERT_EQ(tree.size(), (size_t)15);
+  ASSERT_EQ(tree.countPoints(root), 15);
+  ASSERT_EQ(tree.countPoints(root + 1), 7);
+  ASSERT_EQ(tree.countPoints(root + 2), 8);
+  for (const auto& p : points) {
+    ASSERT_TRUE(tree.contains(p));
+  }
+  ASSERT_TRUE(tree.contains(P(6.5)));
+  for (const auto& p : more) {
+    ASSERT_TRUE(tree.contains(p));
+  }
+}
+
+// erased points stay erased while the items around them move to make room
+TYPED_TEST_P(BHL2DStructureTest, IncrementalInsertAfterErase) {
+  typedef point<2> pointT;
+  // no two points share a coordinate (the splits send ties to the right)
+  auto P = [](size_t i) { return pointT({(double)((i * 37) % 401), (double)((i * 61) % 409)}); };
+  const auto points = parlay::tabulate(256, [&](size_t i) { return P(i); });
+  TypeParam tree(10);
+  tree.insert(points.cut(0, points.size()));
+  for (size_t i = 0; i < points.size(); i += 3) {
+    ASSERT_TRUE(tree.erase(points[i]));
+  }
+
+  const auto more = parlay::tabulate(128, [&](size_t i) { return P(256 + i); });
+  for (size_t b = 0; b < more.size(); b += 8) {
+    tree.insert(more.cut(b, b + 8));
+  }
+  ASSERT_EQ(tree.size(), points.size() - (points.size() + 2) / 3 + more.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    ASSERT_EQ(tree.contains(points[i]), i % 3 != 0) << "point " << i;
+  }
+  for (const auto& p : more) {
+    ASSERT_TRUE(tree.contains(p));
+  }
 }
 
-REGISTER_TYPED_TEST_SUITE_P(BHL2DStructureTest, LayoutSize2, LayoutSize8);
+REGISTER_TYPED_TEST_SUITE_P(BHL2DStructureTest,
+                            LayoutSize2,
+                            LayoutSize8,
+                            IncrementalInsert,
+                            IncrementalInsertAfterErase);
 
 #endif  // TEST_BINARYHEAPLAYOUT_BHLSTRUCTURE2D_H
@@ -5,6 +5,7 @@
 
 #include "../shared/Shared2DTest.h"
 #include "../shared/QueryTest.h"
+#include "../shared/PayloadTest.h"
 #include "BHL2DStructureTest.h"
 
 static constexpr int dim = 2;
@@ -35,3 +36,10 @@ typedef BHL_KdTree<dim, point<dim>, true, true> parallelCoarseTreeT;
 
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_BHL, Shared2DTest, parallelCoarseTreeT);
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_BHL, QueryTest, parallelCoarseTreeT);
+
+// points with IDs
+typedef BHL_KdTree<dim, idPoint<dim>, false, false> serialIdTreeT;
+typedef BHL_KdTree<dim, idPoint<dim>, true, false> parallelIdTreeT;
+
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial_BHL, PayloadTest, serialIdTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(Parallel_BHL, PayloadTest, parallelIdTreeT);
@@ -6,6 +6,7 @@
 #include "CO2DStructureTest.h"
 #include "../shared/Shared2DTest.h"
 #include "../shared/QueryTest.h"
+#include "../shared/PayloadTest.h"
 
 static constexpr int dim = 2;
 // <dim, objT, parallel, false>
@@ -35,3 +36,10 @@ typedef CO_KdTree<dim, point<dim>, true, true> parallelCoarseTreeT;
 
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_CO, Shared2DTest, parallelCoarseTreeT);
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_CO, QueryTest, parallelCoarseTreeT);
+
+// points with IDs
+typedef CO_KdTree<dim, idPoint<dim>, false, false> serialIdTreeT;
+typedef CO_KdTree<dim, idPoint<dim>, true, false> parallelIdTreeT;
+
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial_CO, PayloadTest, serialIdTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(Parallel_CO, PayloadTest, parallelIdTreeT);
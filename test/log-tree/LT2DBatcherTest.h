@@ -0,0 +1,99 @@
+#ifndef TEST_LOGTREE_LT2DBATCHERTEST_H
+#define TEST_LOGTREE_LT2DBATCHERTEST_H
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "common/geometryIO.h"
+
+#include <kdtree/log-tree/batcher.h>
+#include <kdtree/log-tree/logtree.h>
+#include "../shared/BasicStructure.h"
+
+// LogTrees updated through an UpdateBatcher
+template <typename LTree>
+class LT2DBatcherTest : public ::testing::Test {
+ public:
+  typedef point<2> pointT;
+  typedef UpdateBatcher<2, pointT, LTree> batcherT;
+
+  static pointT P(double d) { return pointT({d, d}); }
+  static parlay::sequence<pointT> RANGE(int start, int end) {
+    return parlay::tabulate(end - start, [&](int i) { return P((double)(start + i)); });
+  }
+};
+
+TYPED_TEST_SUITE_P(LT2DBatcherTest);
+
+TYPED_TEST_P(LT2DBatcherTest, Coalesce) {
+  TypeParam tree;
+  tree.insert(this->RANGE(0, 96));
+  {
+    typename TestFixture::batcherT batcher(tree, 1000);
+    batcher.insert(this->RANGE(100, 148));
+    batcher.erase(this->RANGE(124, 148));  // cancels inserts
+    batcher.erase(this->RANGE(0, 8));
+    batcher.erase(this->RANGE(200, 208));  // not in the tree yet: not cancelled by the insert
+    batcher.insert(this->RANGE(200, 208));
+    batcher.erase(this->RANGE(48, 56));  // erased, then inserted again
+    batcher.insert(this->RANGE(48, 56));
+
+    // nothing is applied before the flush
+    ASSERT_EQ(batcher.staged(), (size_t)(48 + 24 + 8 + 8 + 8 + 8 + 8));
+    ASSERT_EQ(tree.size(), (size_t)96);
+    batcher.flush();
+    ASSERT_EQ(batcher.staged(), (size_t)0);
+  }
+
+  ASSERT_EQ(tree.size(), (size_t)(96 - 8 + 24 + 8));
+  for (int i = 0; i < 220; i++) {
+    bool expected = (8 <= i && i < 96) || (100 <= i && i < 124) || (200 <= i && i < 208);
+    ASSERT_EQ(tree.contains(this->P(i)), expected) << "point " << i;
+  }
+}
+
+TYPED_TEST_P(LT2DBatcherTest, ConcurrentProducers) {
+  constexpr int NUM_PRODUCERS = 4, NUM_BATCHES = 50, BATCH_SIZE = 16;
+  TypeParam tree;
+  {
+    // small enough to flush (and switch stages) many times
+    typename TestFixture::batcherT batcher(tree, 96);
+
+    // each producer inserts its batches and erases every other one again
+    auto producer = [&](int t) {
+      for (int b = 0; b < NUM_BATCHES; b++) {
+        auto start = (t * NUM_BATCHES + b) * BATCH_SIZE;
+        batcher.insert(this->RANGE(start, start + BATCH_SIZE));
+        if (b % 2 == 1) batcher.erase(this->RANGE(start, start + BATCH_SIZE));
+      }
+    };
+    std::vector<std::thread> producers;
+    for (int t = 0; t < NUM_PRODUCERS; t++)
+      producers.emplace_back(producer, t);
+    for (auto& p : producers)
+      p.join();
+  }  // flushes the rest
+
+  ASSERT_EQ(tree.size(), (size_t)(NUM_PRODUCERS * NUM_BATCHES / 2 * BATCH_SIZE));
+  for (int i = 0; i < NUM_PRODUCERS * NUM_BATCHES * BATCH_SIZE; i++) {
+    auto erased = (i / BATCH_SIZE) % 2 == 1;
+    ASSERT_EQ(tree.contains(this->P(i)), !erased) << "point " << i;
+  }
+}
+
+TYPED_TEST_P(LT2DBatcherTest, FlushOnTime) {
+  TypeParam tree;
+  typename TestFixture::batcherT batcher(tree, 1000, std::chrono::milliseconds(5));
+  batcher.insert(this->RANGE(0, 8));
+
+  // far below the flush size: applied by the timer
+  for (int wait = 0; batcher.staged() > 0 && wait < 2000; wait++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  ASSERT_EQ(batcher.staged(), (size_t)0);
+  ASSERT_EQ(tree.size(), (size_t)8);
+}
+
+REGISTER_TYPED_TEST_SUITE_P(LT2DBatcherTest, Coalesce, ConcurrentProducers, FlushOnTime);
+
+#endif  // TEST_LOGTREE_LT2DBATCHERTEST_H
@@ -0,0 +1,103 @@
+#ifndef TEST_LOGTREE_LT2DCONCURRENTTEST_H
+#define TEST_LOGTREE_LT2DCONCURRENTTEST_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "common/geometryIO.h"
+
+#include <kdtree/log-tree/concurrent.h>
+#include "../shared/BasicStructure.h"
+
+// ConcurrentLogTrees: snapshots of the writer's LogTree, read by other threads
+template <typename CTree>
+class LT2DConcurrentTest : public ::testing::Test {
+ public:
+  typedef point<2> pointT;
+
+  static pointT P(double d) { return pointT({d, d}); }
+  static parlay::sequence<pointT> BATCH(int start, int n) {
+    return parlay::tabulate(n, [&](int i) { return P((double)(start + i)); });
+  }
+};
+
+TYPED_TEST_SUITE_P(LT2DConcurrentTest);
+
+TYPED_TEST_P(LT2DConcurrentTest, Snapshot) {
+  TypeParam tree;
+  tree.insert(this->BATCH(0, 100));
+
+  // an old version is unaffected by later updates
+  tree.read([&](const auto& version) {
+    auto snapshot = version.snapshot();
+    tree.insert(this->BATCH(100, 100));
+    tree.template erase<false>(this->BATCH(0, 50));
+
+    ASSERT_EQ(snapshot.size(), (size_t)100);
+    for (int i = 0; i < 200; i++) {
+      ASSERT_EQ(snapshot.contains(this->P(i)), i < 100) << "point " << i;
+    }
+  });
+  ASSERT_EQ(tree.size(), (size_t)150);
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ(tree.contains(this->P(i)), i >= 50) << "point " << i;
+  }
+}
+
+TYPED_TEST_P(LT2DConcurrentTest, ConcurrentReaders) {
+  constexpr int BATCH_SIZE = 40, NUM_BATCHES = 60, NUM_READERS = 4;
+  TypeParam tree;
+  std::atomic<bool> done(false);
+  std::atomic<int> errors(0);
+
+  // every version is the result of a whole update: whole batches, counted alike by every query
+  auto reader = [&]() {
+    auto qMin = this->P(-1), qMax = this->P(1e9);
+    while (!done) {
+      tree.read([&](const auto& version) {
+        auto n = version.size();
+        if (n % BATCH_SIZE != 0 || version.orthogonalCount(qMin, qMax) != n) errors++;
+        if (version.orthogonalQuery(qMin, qMax).size() != n) errors++;
+      });
+    }
+  };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < NUM_READERS; r++)
+    readers.emplace_back(reader);
+
+  for (int b = 0; b < NUM_BATCHES; b++) {
+    tree.insert(this->BATCH(b * BATCH_SIZE, BATCH_SIZE));
+    if (b % 3 == 2) tree.template erase<true>(this->BATCH((b - 1) * BATCH_SIZE, BATCH_SIZE));
+  }
+  done = true;
+  for (auto& t : readers)
+    t.join();
+
+  ASSERT_EQ(errors, 0);
+  ASSERT_EQ(tree.size(), (size_t)(NUM_BATCHES - NUM_BATCHES / 3) * BATCH_SIZE);
+  for (int b = 0; b < NUM_BATCHES; b++) {
+    auto erased = (b % 3 == 1);
+    ASSERT_EQ(tree.contains(this->P(b * BATCH_SIZE)), !erased) << "batch " << b;
+  }
+}
+
+TYPED_TEST_P(LT2DConcurrentTest, AsyncInsertDuring) {
+  TypeParam tree;
+  tree.insert(this->BATCH(0, 10));
+
+  // readers see the old version until the rebuilt trees are published
+  tree.insertAsync(this->BATCH(10, 64), [&](const auto& version) {
+    EXPECT_EQ(version.size(), (size_t)10);
+    EXPECT_EQ(tree.size(), (size_t)10);
+    EXPECT_FALSE(tree.contains(this->P(20)));
+  });
+  ASSERT_EQ(tree.size(), (size_t)74);
+  for (int i = 0; i < 74; i++) {
+    ASSERT_TRUE(tree.contains(this->P(i))) << "point " << i;
+  }
+}
+
+REGISTER_TYPED_TEST_SUITE_P(LT2DConcurrentTest, Snapshot, ConcurrentReaders, AsyncInsertDuring);
+
+#endif  // TEST_LOGTREE_LT2DCONCURRENTTEST_H
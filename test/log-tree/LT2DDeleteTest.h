@@ -161,5 +161,65 @@ TYPED_TEST_P(LT2DDeleteTest, BigDelete2) {
   }
 }
 
-REGISTER_TYPED_TEST_SUITE_P(LT2DDeleteTest, Delete1, Delete2, BigDelete1, BigDelete2);
+TYPED_TEST_P(LT2DDeleteTest, LocalizedDelete) {
+  using LTree = typename TypeParam::first_type;
+  constexpr bool bulk = TypeParam::second_type::bulk;
+
+  const char* test_file = "../resources/2d-UniformInSphere-1k.pbbs";
+  auto points = readPointsFromFile<pointT>(test_file);
+  auto shifted = [&](double dx) {
+    return parlay::map(points, [&](pointT p) {
+      p[0] += dx;
+      p[1] += dx;  // no coordinate shared with [points]: ties on a split go either way
+      return p;
+    });
+  };
+
+  // two batches in disjoint regions, so in different trees
+  LTree tree;
+  tree.insert(points);
+  auto far = shifted(1000);
+  tree.insert(far);
+
+  // erase half of the far batch, along with points outside every tree
+  auto to_remove = shifted(10000);
+  to_remove.append(far.cut(0, far.size() / 2));
+  tree.template erase<bulk>(to_remove);
+  ASSERT_EQ(tree.size(), points.size() + far.size() - far.size() / 2);
+  for (size_t i = 0; i < points.size(); i++) {
+    ASSERT_TRUE(tree.contains(points[i]));
+    ASSERT_EQ(tree.contains(far[i]), i >= far.size() / 2);
+    ASSERT_FALSE(tree.contains(to_remove[i]));
+  }
+}
+
+TYPED_TEST_P(LT2DDeleteTest, SignedZero) {
+  using LTree = typename TypeParam::first_type;
+  constexpr bool bulk = TypeParam::second_type::bulk;
+
+  // fewer points than the smallest test buffer (8), so they stay in it; no two share a coordinate
+  // (the splits send ties to the right), and the first two have a zero one
+  parlay::sequence<pointT> points = {pointT({0.0, 1.0}), pointT({1.0, 0.0})};
+  for (int i = 2; i < 6; i++) {
+    points.push_back(pointT({(double)i, (double)i}));
+  }
+  auto negated = points;  // equal to [points], with -0.0 in place of 0.0
+  negated[0] = pointT({-0.0, 1.0});
+  negated[1] = pointT({1.0, -0.0});
+
+  LTree tree;
+  tree.insert(points);
+  for (size_t i = 0; i < negated.size(); i++) {
+    ASSERT_TRUE(tree.contains(negated[i]));
+  }
+
+  tree.template erase<bulk>(negated.cut(0, negated.size() / 2));
+  ASSERT_EQ(tree.size(), points.size() - points.size() / 2);
+  for (size_t i = 0; i < points.size(); i++) {
+    ASSERT_EQ(tree.contains(points[i]), i >= points.size() / 2);
+  }
+}
+
+REGISTER_TYPED_TEST_SUITE_P(
+    LT2DDeleteTest, Delete1, Delete2, BigDelete1, BigDelete2, LocalizedDelete, SignedZero);
 #endif  // TEST_LOGTREE_LT2DDELETETEST_H
@@ -0,0 +1,83 @@
+#ifndef TEST_LOGTREE_LT2DIDTEST_H
+#define TEST_LOGTREE_LT2DIDTEST_H
+
+#include <gtest/gtest.h>
+#include "common/geometryIO.h"
+
+#include <kdtree/log-tree/logtree.h>
+#include <kdtree/shared/idpoint.h>
+#include "../shared/BasicStructure.h"
+
+// LogTrees over idPoint<2>: erasing by ID through the ID locator
+template <typename LTree>
+class LT2DIdTest : public ::testing::Test {
+ public:
+  typedef idPoint<2> idPointT;
+
+  // the 1k test points, with their index + [first_id] as ID
+  static parlay::sequence<idPointT> RESOURCES_1000(uint32_t first_id = 0) {
+    auto points = BasicStructure2D<LTree>::RESOURCES_1000();
+    return parlay::tabulate(points.size(),
+                            [&](size_t i) { return idPointT(points[i], first_id + i); });
+  }
+
+  // the IDs of the points in [tree], sorted
+  static parlay::sequence<uint32_t> IDS(const LTree& tree) {
+    point<2> qMin({-1e9, -1e9}), qMax({1e9, 1e9});
+    auto ids = parlay::map(tree.orthogonalQuery(qMin, qMax), [](const auto& p) { return p.id; });
+    return parlay::sort(ids, std::less<uint32_t>());
+  }
+};
+
+TYPED_TEST_SUITE_P(LT2DIdTest);
+
+TYPED_TEST_P(LT2DIdTest, EraseById) {
+  auto points = this->RESOURCES_1000();
+  TypeParam tree(points);
+
+  // erase the even IDs
+  auto even = parlay::tabulate(points.size() / 2, [](size_t i) { return (uint32_t)(2 * i); });
+  tree.eraseById(even);
+  ASSERT_EQ(tree.size(), points.size() / 2);
+  auto ids = this->IDS(tree);
+  ASSERT_EQ(ids.size(), points.size() / 2);
+  for (size_t i = 0; i < ids.size(); i++)
+    ASSERT_EQ(ids[i], 2 * i + 1);
+  for (size_t i = 0; i < points.size(); i++)
+    ASSERT_EQ(tree.contains(points[i]), i % 2 == 1);
+
+  // erased, unknown and duplicate IDs are ignored
+  tree.eraseById(parlay::sequence<uint32_t>({0, 2, 5000, 1, 1}));
+  ASSERT_EQ(tree.size(), points.size() / 2 - 1);
+  ASSERT_FALSE(tree.contains(points[1]));
+}
+
+TYPED_TEST_P(LT2DIdTest, EraseByIdAfterRebuilds) {
+  auto points = this->RESOURCES_1000();
+  TypeParam tree(points);
+
+  // erase by coordinates, then insert a shifted copy with new IDs: trees get rebuilt and points
+  // move
+  tree.template erase<true>(KEEP_EVEN(points));
+  auto more = this->RESOURCES_1000(1000);
+  parlay::parallel_for(0, more.size(), [&](size_t i) { more[i][0] += 10; });
+  tree.insert(more);
+  ASSERT_EQ(tree.size(), points.size() / 2 + more.size());
+
+  // erase every third ID, old and new
+  auto to_erase = parlay::tabulate(700, [](size_t i) { return (uint32_t)(3 * i); });
+  tree.eraseById(to_erase);
+  auto all_ids = parlay::tabulate(2000, [](size_t i) { return (uint32_t)i; });
+  auto expected = parlay::filter(all_ids, [](uint32_t id) {
+    return id % 3 != 0 && (id >= 1000 || id % 2 == 1);
+  });
+  auto ids = this->IDS(tree);
+  ASSERT_EQ(tree.size(), expected.size());
+  ASSERT_EQ(ids.size(), expected.size());
+  for (size_t i = 0; i < ids.size(); i++)
+    ASSERT_EQ(ids[i], expected[i]);
+}
+
+REGISTER_TYPED_TEST_SUITE_P(LT2DIdTest, EraseById, EraseByIdAfterRebuilds);
+
+#endif  // TEST_LOGTREE_LT2DIDTEST_H
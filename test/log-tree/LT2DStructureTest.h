@@ -5,6 +5,7 @@
 #include "common/geometryIO.h"
 
 #include <kdtree/log-tree/logtree.h>
+#include "../shared/BasicStructure.h"
 
 typedef point<2> pointT;
 pointT constructPoint(double d) {
@@ -107,6 +108,69 @@ TYPED_TEST_P(LT2DStructureTest, Verify) {
   }
 }
 
+TYPED_TEST_P(LT2DStructureTest, AsyncInsert) {
+  // the rebuild runs outside parlay's scheduler, so only serial trees support this insertAsync
+  if constexpr (TypeParam::parallel_) {
+    GTEST_SKIP();
+  } else {
+    TypeParam tree, sync_tree;
+    auto batch = [](int start, int n) {
+      return parlay::tabulate(n, [&](int i) { return constructPoint((double)(start + i)); });
+    };
+
+    // the new points are only visible once the rebuild is published
+    tree.insertAsync(batch(0, 64));
+    sync_tree.insert(batch(0, 64));
+    ASSERT_TRUE(tree.rebuildPending());
+    for (int i = 0; i < 64; i++) {
+      ASSERT_FALSE(tree.contains(constructPoint((double)i)));
+    }
+    tree.finishRebuild();
+    ASSERT_FALSE(tree.rebuildPending());
+    ASSERT_EQ(tree.getTreeMask(), sync_tree.getTreeMask());
+    for (int i = 0; i < 64; i++) {
+      ASSERT_TRUE(tree.contains(constructPoint((double)i)));
+    }
+
+    // updates publish a pending rebuild first
+    tree.insertAsync(batch(64, 100));
+    tree.template erase<false>(batch(0, 10));
+    ASSERT_FALSE(tree.rebuildPending());
+    for (int i = 0; i < 164; i++) {
+      ASSERT_EQ(tree.contains(constructPoint((double)i)), i >= 10) << "point " << i;
+    }
+  }
+}
+
+// the rebuild is forked next to [during], which keeps querying the trees as they were before
+TYPED_TEST_P(LT2DStructureTest, AsyncInsertDuring) {
+  TypeParam tree, sync_tree;
+  auto batch = [](int start, int n) {
+    return parlay::tabulate(n, [&](int i) { return constructPoint((double)(start + i)); });
+  };
+  tree.insert(batch(0, 10));
+  sync_tree.insert(batch(0, 10));
+
+  bool ran = false;
+  tree.insertAsync(batch(10, 64), [&](const auto& version) {
+    ran = true;
+    EXPECT_EQ(version.size(), (size_t)10);
+    for (int i = 0; i < 74; i++) {
+      EXPECT_EQ(version.contains(constructPoint((double)i)), i < 10) << "point " << i;
+    }
+  });
+  sync_tree.insert(batch(10, 64));
+  ASSERT_TRUE(ran);
+
+  // published before insertAsync returns
+  ASSERT_FALSE(tree.rebuildPending());
+  ASSERT_EQ(tree.getTreeMask(), sync_tree.getTreeMask());
+  ASSERT_EQ(tree.size(), (size_t)74);
+  for (int i = 0; i < 74; i++) {
+    ASSERT_TRUE(tree.contains(constructPoint((double)i))) << "point " << i;
+  }
+}
+
 // Come up with a better abstraction; this is a direct copy of BasicKnn test
 TYPED_TEST_P(LT2DStructureTest, BasicKnn2) {
   // construct tree
@@ -215,7 +279,151 @@ TYPED_TEST_P(LT2DStructureTest, BasicKnn3) {
   }
 }
 
+// best-first knn across the trees, also after erasing (which leaves nodes with no live points)
+TYPED_TEST_P(LT2DStructureTest, BasicKnn4) {
+  // construct tree
+  const char* test_file = "../resources/2d-UniformInSphere-1k.pbbs";
+  int check_dim = readDimensionFromFile(test_file);
+  ASSERT_EQ(check_dim, this->DIM);
+  auto points = readPointsFromFile<pointT>(test_file);
+
+  TypeParam tree;
+  tree.insert(points);
+
+  ASSERT_EQ(tree.size(), points.size());
+
+  constexpr int k = 4;
+  for (int round = 0; round < 2; round++) {
+    auto remaining = points;
+    if (round == 1) {
+      auto to_remove = KEEP_EVEN(points);
+      tree.template erase<false>(to_remove);
+      remaining = KEEP_ODD(points);
+    }
+
+    // construct brute force solution
+    auto check = knnBuf::bruteforceKnn(remaining, k);
+    ASSERT_EQ(check.size(), k * remaining.size());
+    auto res = tree.template knn4<false, false>(remaining, k);
+
+    // verify result
+    ASSERT_EQ(res.size(), k * remaining.size());
+    for (size_t i = 0; i < remaining.size(); i++) {
+      auto res_start = res.begin() + i * k;
+      auto check_start = check.begin() + i * k;
+      auto compare = [&](const pointT* l, const pointT* r) {
+        return l->coordinate(0) < r->coordinate(0);
+      };
+      std::sort(check_start, check_start + k, compare);
+      std::sort(res_start, res_start + k, compare);
+
+      for (int j = 0; j < k; j++) {
+        auto res_pt = **(res_start + j);
+        auto check_pt = **(check_start + j);
+        EXPECT_EQ(res_pt, check_pt) << "dist res, dist check =  "
+                                    << remaining[i].dist(res_pt) << ", "
+                                    << remaining[i].dist(check_pt);
+      }
+    }
+  }
+}
+
+// static trees only hold storage while their level is full
+TYPED_TEST_P(LT2DStructureTest, LevelsOnDemand) {
+  TypeParam tree;
+  ASSERT_EQ(tree.numAllocatedTrees(), 0);
+
+  auto batch = [](int start, int n) {
+    return parlay::tabulate(n, [&](int i) { return constructPoint((double)(start + i)); });
+  };
+  auto points = batch(0, 1000);
+  tree.insert(points);
+  ASSERT_EQ(tree.size(), points.size());
+  ASSERT_EQ(tree.numAllocatedTrees(), __builtin_popcount(tree.getTreeMask()));
+  auto buffer_size = (size_t)1 << tree.getBufferLog2Size();
+  ASSERT_EQ((size_t)tree.getTreeMask(), points.size() / buffer_size);
+
+  // erasing most of the points releases the depleted levels
+  tree.template erase<false>(batch(0, 990));
+  ASSERT_EQ(tree.size(), (size_t)10);
+  ASSERT_EQ(tree.numAllocatedTrees(), __builtin_popcount(tree.getTreeMask()));
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(tree.contains(constructPoint((double)i)), i >= 990) << "point " << i;
+  }
+}
+
+// erasing from a tree that a snapshot shares copies only the pages of state the erase touches
+TYPED_TEST_P(LT2DStructureTest, SnapshotEraseSharesPages) {
+  TypeParam tree;
+  auto points = parlay::tabulate(1 << 16, [&](int i) { return constructPoint((double)i); });
+  tree.insert(points);
+  ASSERT_EQ(__builtin_popcount(tree.getTreeMask()), 1);  // a single static tree
+  auto level = __builtin_ctz(tree.getTreeMask());
+
+  auto snapshot = tree.snapshot();
+  const parlay::sequence<pointT> one = {constructPoint(100)};
+  tree.template erase<false>(one);
+  ASSERT_FALSE(tree.contains(constructPoint(100)));
+  ASSERT_TRUE(snapshot.contains(constructPoint(100)));
+
+  auto before = snapshot.getStaticTree(level), after = tree.getStaticTree(level);
+  ASSERT_NE(before, after);
+  ASSERT_EQ(before->root(), after->root());  // the node records and points are shared
+  ASSERT_EQ(before->getItems().first.begin(), after->getItems().first.begin());
+
+  auto changed_pages = [](const auto& a, const auto& b) {
+    EXPECT_EQ(a.numPages(), b.numPages());
+    size_t changed = 0;
+    for (size_t p = 0; p < a.numPages(); p++)
+      changed += (a.page(p) != b.page(p));
+    return changed;
+  };
+  // one bit was cleared, and one live count per level of the tree changed
+  ASSERT_EQ(changed_pages(before->getItems().second.wordPages(),
+                          after->getItems().second.wordPages()),
+            (size_t)1);
+  auto changed_counts = changed_pages(before->getLiveCounts(), after->getLiveCounts());
+  ASSERT_GE(changed_counts, (size_t)1);
+  ASSERT_LE(changed_counts, (size_t)17);
+}
+
+// updates that leave the buffer tree as it is do not copy it, and erasing from a buffer that a
+// snapshot shares leaves the snapshot's buffer as it is
+TYPED_TEST_P(LT2DStructureTest, SnapshotBufferUpdates) {
+  TypeParam tree;
+  tree.insert(parlay::tabulate(4, [&](int i) { return constructPoint((double)i); }));
+  ASSERT_EQ(tree.getTreeMask(), 0);  // all in the buffer
+
+  auto snapshot = tree.snapshot();
+  tree.insert(parlay::sequence<pointT>());
+  tree.template erase<true>(parlay::sequence<pointT>());
+  ASSERT_EQ(tree.getBufferTree(), snapshot.getBufferTree());
+
+  const parlay::sequence<pointT> one = {constructPoint(2)};
+  tree.template erase<true>(one);
+  ASSERT_NE(tree.getBufferTree(), snapshot.getBufferTree());
+  ASSERT_FALSE(tree.contains(constructPoint(2)));
+  ASSERT_TRUE(snapshot.contains(constructPoint(2)));
+
+  // overfilling the buffer moves its points into a static tree, and leaves the snapshot's buffer
+  auto size = ((size_t)1 << tree.getBufferLog2Size()) - 2;
+  tree.insert(parlay::tabulate(size, [&](int i) { return constructPoint((double)(10 + i)); }));
+  ASSERT_EQ(tree.getTreeMask(), 1);
+  ASSERT_EQ(tree.size(), size + 3);
+  ASSERT_EQ(snapshot.size(), (size_t)4);
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(tree.contains(constructPoint((double)i)), i != 2) << "point " << i;
+    ASSERT_TRUE(snapshot.contains(constructPoint((double)i))) << "point " << i;
+  }
+  for (size_t i = 0; i < size; i++) {
+    ASSERT_TRUE(tree.contains(constructPoint((double)(10 + i)))) << "point " << 10 + i;
+    ASSERT_FALSE(snapshot.contains(constructPoint((double)(10 + i)))) << "point " << 10 + i;
+  }
+}
+
 REGISTER_TYPED_TEST_SUITE_P(
-    LT2DStructureTest, LayoutSize32, LayoutSize64, Verify, BasicKnn2, BasicKnn3);
+    LT2DStructureTest, LayoutSize32, LayoutSize64, Verify, BasicKnn2, BasicKnn3, BasicKnn4,
+    AsyncInsert, AsyncInsertDuring, LevelsOnDemand, SnapshotEraseSharesPages,
+    SnapshotBufferUpdates);
 
 #endif  // TEST_LOGTREE_LT2DSTRUCTURETEST_H
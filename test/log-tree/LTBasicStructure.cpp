@@ -5,15 +5,30 @@
 
 #include "LT2DStructureTest.h"
 #include "LT2DDeleteTest.h"
+#include "LT2DIdTest.h"
+#include "LT2DConcurrentTest.h"
+#include "LT2DBatcherTest.h"
 #include "../shared/QueryTest.h"
+#include "../shared/PayloadTest.h"
 
 static constexpr int dim = 2;
-static constexpr int NUM_TREES = 14;
 static constexpr int BUFFER_LOG2_SIZE = 3;
 typedef point<dim> pointT;
 
+// A (Concurrent)LogTree with the given buffer size, default-constructible for the typed tests
+template <class Tree, int buffer_log2_size>
+struct WithBuffer : Tree {
+  WithBuffer() : Tree(LogTreeConfig{buffer_log2_size}) {}
+  template <class R>
+  explicit WithBuffer(const R& points) : WithBuffer() {
+    this->insert(points);
+  }
+};
+template <class objT, bool parallel, bool coarsen, int buffer_log2_size = BUFFER_LOG2_SIZE>
+using TestLogTree = WithBuffer<LogTree<dim, objT, parallel, coarsen>, buffer_log2_size>;
+
 // serial, not coarse
-typedef LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, pointT, false, false> serialSingleTreeT;
+typedef TestLogTree<pointT, false, false> serialSingleTreeT;
 typedef std::pair<serialSingleTreeT, NotBulk> SSNoBulk;
 typedef std::pair<serialSingleTreeT, Bulk> SSBulk;
 
@@ -21,9 +36,10 @@ INSTANTIATE_TYPED_TEST_SUITE_P(Serial, LT2DStructureTest, serialSingleTreeT);
 INSTANTIATE_TYPED_TEST_SUITE_P(SerialNoBulk, LT2DDeleteTest, SSNoBulk);
 INSTANTIATE_TYPED_TEST_SUITE_P(SerialBulk, LT2DDeleteTest, SSBulk);
 INSTANTIATE_TYPED_TEST_SUITE_P(Serial_LT, QueryTest, serialSingleTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial, LT2DBatcherTest, serialSingleTreeT);  // serial trees only
 
 // serial, coarse
-typedef LogTree<NUM_TREES, 5, dim, pointT, false, true>
+typedef TestLogTree<pointT, false, true, 5>
     serialCoarseTreeT;  // use 5 so that smallest static tree is not degenerate
 typedef std::pair<serialCoarseTreeT, NotBulk> SCNoBulk;
 typedef std::pair<serialCoarseTreeT, Bulk> SCBulk;
@@ -34,7 +50,7 @@ INSTANTIATE_TYPED_TEST_SUITE_P(SerialCoarse_LT_B, LT2DDeleteTest, SCBulk);
 INSTANTIATE_TYPED_TEST_SUITE_P(SerialCoarse_LT, QueryTest, serialCoarseTreeT);
 
 // parallel, not coarse
-typedef LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, pointT, true, false> parallelSingleTreeT;
+typedef TestLogTree<pointT, true, false> parallelSingleTreeT;
 typedef std::pair<parallelSingleTreeT, NotBulk> PSNoBulk;
 typedef std::pair<parallelSingleTreeT, Bulk> PSBulk;
 
@@ -44,7 +60,7 @@ INSTANTIATE_TYPED_TEST_SUITE_P(ParallelBulk, LT2DDeleteTest, PSBulk);
 INSTANTIATE_TYPED_TEST_SUITE_P(Parallel_LT, QueryTest, parallelSingleTreeT);
 
 // parallel, coarse
-typedef LogTree<NUM_TREES, 5, dim, pointT, true, true>
+typedef TestLogTree<pointT, true, true, 5>
     parallelCoarseTreeT;  // use 5 so that smallest static tree is not degenerate
 typedef std::pair<parallelCoarseTreeT, NotBulk> PCNoBulk;
 typedef std::pair<parallelCoarseTreeT, Bulk> PCBulk;
@@ -53,3 +69,18 @@ INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT, LT2DStructureTest, parallelCoa
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT_NB, LT2DDeleteTest, PCNoBulk);
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT_B, LT2DDeleteTest, PCBulk);
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT, QueryTest, parallelCoarseTreeT);
+
+// points with IDs
+typedef TestLogTree<idPoint<dim>, false, false> serialIdTreeT;
+typedef TestLogTree<idPoint<dim>, true, false> parallelIdTreeT;
+
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial_LT, PayloadTest, serialIdTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(Parallel_LT, PayloadTest, parallelIdTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial, LT2DIdTest, serialIdTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(Parallel, LT2DIdTest, parallelIdTreeT);
+
+// concurrent readers (serial trees only: the readers are not parlay workers)
+typedef WithBuffer<ConcurrentLogTree<dim, pointT, false, false>, BUFFER_LOG2_SIZE>
+    serialConcurrentTreeT;
+
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial, LT2DConcurrentTest, serialConcurrentTreeT);
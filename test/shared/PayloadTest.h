@@ -0,0 +1,106 @@
+#ifndef TEST_PAYLOADTEST_H
+#define TEST_PAYLOADTEST_H
+
+#include "BasicStructure.h"
+#include <gtest/gtest.h>
+#include "common/geometryIO.h"
+
+#include <kdtree/shared/idpoint.h>
+#include <kdtree/shared/knnbuffer.h>
+
+// Trees over idPoint<2>: payloads ride along with the points, but only coordinates are compared
+template <typename Tree>
+class PayloadTest : public ::testing::Test {
+ public:
+  static const int DIM = 2;
+  typedef idPoint<DIM> idPointT;
+
+  // the 1k test points, with their index as ID
+  static parlay::sequence<idPointT> RESOURCES_1000() {
+    auto points = BasicStructure2D<Tree>::RESOURCES_1000();
+    return parlay::tabulate(points.size(), [&](size_t i) { return idPointT(points[i], i); });
+  }
+};
+
+TYPED_TEST_SUITE_P(PayloadTest);
+
+TYPED_TEST_P(PayloadTest, RangeQueryKeepsIds) {
+  auto points = this->RESOURCES_1000();
+  TypeParam tree(points);
+
+  // the whole set, then after erasing by coordinates only (no IDs)
+  for (int round = 0; round < 2; round++) {
+    if (round == 1) {
+      auto to_remove = parlay::map(KEEP_EVEN(points), [](const auto& p) {
+        return typename TestFixture::idPointT(point<2>(p.coordinate()));
+      });
+      tree.template erase<false>(to_remove);
+    }
+    point<2> qMin({-1e9, -1e9}), qMax({1e9, 1e9});
+    auto res = tree.orthogonalQuery(qMin, qMax);
+    ASSERT_EQ(res.size(), round == 0 ? points.size() : points.size() / 2);
+    for (const auto& p : res) {
+      ASSERT_LT(p.id, points.size());
+      ASSERT_EQ(p, points[p.id]);
+      if (round == 1) {
+        ASSERT_EQ(p.id % 2, 1u);
+      }
+    }
+  }
+}
+
+TYPED_TEST_P(PayloadTest, KnnItemsKeepIds) {
+  auto points = this->RESOURCES_1000();
+  TypeParam tree(points);
+
+  constexpr int k = 4;
+  auto coords = parlay::map(points, [](const auto& p) { return point<2>(p.coordinate()); });
+  auto check = knnBuf::bruteforceKnn(coords, k);
+  auto [offsets, res] = tree.knnItems(points, k);
+  ASSERT_EQ(offsets.size(), points.size() + 1);
+  ASSERT_EQ(res.size(), k * points.size());
+
+  for (size_t i = 0; i < points.size(); i++) {
+    ASSERT_EQ(offsets[i], i * k);
+    auto check_dists =
+        parlay::tabulate(k, [&](size_t j) { return points[i].dist(*check[i * k + j]); });
+    auto res_dists = parlay::tabulate(k, [&](size_t j) { return points[i].dist(res[i * k + j]); });
+    std::sort(check_dists.begin(), check_dists.end());
+    std::sort(res_dists.begin(), res_dists.end());
+    for (int j = 0; j < k; j++) {
+      const auto& p = res[i * k + j];
+      ASSERT_LT(p.id, points.size());
+      ASSERT_EQ(p, points[p.id]);
+      ASSERT_EQ(res_dists[j], check_dists[j]);
+    }
+  }
+}
+
+// with fewer than k points, each query gets all of them and no empty slots
+TYPED_TEST_P(PayloadTest, KnnItemsFewerThanK) {
+  auto all_points = this->RESOURCES_1000();
+  constexpr size_t n = 3;
+  auto points = parlay::tabulate(n, [&](size_t i) { return all_points[i]; });
+  TypeParam tree(points);
+
+  constexpr int k = 5;
+  auto [offsets, res] = tree.knnItems(points, k);
+  ASSERT_EQ(offsets.size(), n + 1);
+  ASSERT_EQ(res.size(), n * n);
+  for (size_t i = 0; i < n; i++) {
+    ASSERT_EQ(offsets[i + 1] - offsets[i], n);
+    auto ids = parlay::tabulate(n, [&](size_t j) { return res[offsets[i] + j].id; });
+    std::sort(ids.begin(), ids.end());
+    for (size_t j = 0; j < n; j++) {
+      ASSERT_EQ(ids[j], j);
+      ASSERT_EQ(res[offsets[i] + j], points[res[offsets[i] + j].id]);
+    }
+  }
+}
+
+REGISTER_TYPED_TEST_SUITE_P(PayloadTest,
+                            RangeQueryKeepsIds,
+                            KnnItemsKeepIds,
+                            KnnItemsFewerThanK);
+
+#endif  // TEST_PAYLOADTEST_H
@@ -50,6 +50,150 @@ TYPED_TEST_P(QueryTest, BasicRangeQuery) {
   }
 }
 
+TYPED_TEST_P(QueryTest, RangeQueryAfterErase) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+  auto to_remove = KEEP_EVEN(points);
+  tree.template erase<false>(to_remove);
+  auto remaining = KEEP_ODD(points);
+
+  auto compare = [&](const pointT& l, const pointT& r) {
+    return l.coordinate(0) < r.coordinate(0);
+  };
+  parlay::sort_inplace(points, compare);
+  parlay::sort_inplace(remaining, compare);
+
+  pointT qMin, qMax;
+  for (int i = 0; i < 3; i++) {
+    auto div = (1 << i);
+    auto size = points.size() / div;
+    for (int b = 0; b < div; b++) {
+      boundingBoxSerial(qMin, qMax, points.cut(b * size, (b + 1) * size));
+      auto expected = parlay::filter(remaining, [&](const pointT& p) {
+        return p.coordinate(0) >= qMin.coordinate(0) && p.coordinate(0) <= qMax.coordinate(0);
+      });
+
+      auto res = tree.orthogonalQuery(qMin, qMax);
+      ASSERT_EQ(res.size(), expected.size());
+      parlay::sort_inplace(res, compare);
+      for (size_t j = 0; j < expected.size(); j++)
+        ASSERT_EQ(expected[j], res[j]);
+    }
+  }
+}
+
+TYPED_TEST_P(QueryTest, BatchRangeQuery) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+
+  auto compare = [&](const pointT& l, const pointT& r) {
+    return l.coordinate(0) < r.coordinate(0);
+  };
+  parlay::sort_inplace(points, compare);
+
+  // boxes from test 1 of BasicRangeQuery, plus an empty one
+  parlay::sequence<std::pair<pointT, pointT>> boxes;
+  for (int i = 0; i < 4; i++) {
+    auto div = (1 << i);
+    auto size = points.size() / div;
+    for (int b = 0; b < div; b++) {
+      pointT qMin, qMax;
+      boundingBoxSerial(qMin, qMax, points.cut(b * size, (b + 1) * size));
+      boxes.push_back({qMin, qMax});
+    }
+  }
+  boxes.push_back({pointT({10, 10}), pointT({11, 11})});
+
+  auto [offsets, items] = tree.orthogonalQueryBatch(boxes);
+  ASSERT_EQ(offsets.size(), boxes.size() + 1);
+  ASSERT_EQ(offsets[boxes.size()], items.size());
+  for (size_t i = 0; i < boxes.size(); i++) {
+    auto expected = tree.orthogonalQuery(boxes[i].first, boxes[i].second);
+    auto res = parlay::to_sequence(items.cut(offsets[i], offsets[i + 1]));
+    ASSERT_EQ(res.size(), expected.size());
+    parlay::sort_inplace(expected, compare);
+    parlay::sort_inplace(res, compare);
+    for (size_t j = 0; j < expected.size(); j++)
+      ASSERT_EQ(expected[j], res[j]);
+  }
+}
+
+TYPED_TEST_P(QueryTest, RangeCount) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+
+  auto compare = [&](const pointT& l, const pointT& r) {
+    return l.coordinate(0) < r.coordinate(0);
+  };
+  auto sorted = parlay::sort(points, compare);
+  auto x = [](const pointT& p) { return p.coordinate(0); };
+
+  // count/reduce must agree with the materialized query, before and after erasing
+  for (int round = 0; round < 2; round++) {
+    auto to_remove = KEEP_EVEN(points);
+    if (round == 1) tree.template erase<false>(to_remove);
+    for (int i = 0; i < 3; i++) {
+      auto div = (1 << i);
+      auto size = sorted.size() / div;
+      for (int b = 0; b < div; b++) {
+        pointT qMin, qMax;
+        boundingBoxSerial(qMin, qMax, sorted.cut(b * size, (b + 1) * size));
+        auto res = tree.orthogonalQuery(qMin, qMax);
+
+        ASSERT_EQ(tree.orthogonalCount(qMin, qMax), res.size());
+        auto sum = tree.orthogonalReduce(qMin, qMax, x, parlay::addm<double>());
+        ASSERT_NEAR(sum, parlay::reduce(parlay::map(res, x)), 1e-6);
+        auto min = tree.orthogonalReduce(qMin, qMax, x, parlay::minm<double>());
+        ASSERT_EQ(min, parlay::reduce(parlay::map(res, x), parlay::minm<double>()));
+      }
+    }
+  }
+}
+
+TYPED_TEST_P(QueryTest, RadiusQuery) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+
+  auto compare = [&](const pointT& l, const pointT& r) {
+    return l.coordinate(0) < r.coordinate(0);
+  };
+  pointT pMin, pMax;
+  boundingBoxSerial(pMin, pMax, points.cut(0, points.size()));
+  auto diameter = std::sqrt(pointDistanceSqr(pMin, pMax));
+  auto centers = parlay::tabulate(points.size() / 50, [&](size_t i) { return points[i * 50]; });
+
+  // compare against brute force, before and after erasing
+  auto remaining = points;
+  for (int round = 0; round < 2; round++) {
+    if (round == 1) {
+      tree.template erase<false>(KEEP_EVEN(points));
+      remaining = KEEP_ODD(points);
+    }
+    for (double frac : {0.0, 0.05, 0.2, 2.0}) {
+      auto r = frac * diameter;
+      auto [offsets, items] = tree.radiusQueryBatch(centers, r);
+      ASSERT_EQ(offsets.size(), centers.size() + 1);
+      ASSERT_EQ(offsets[centers.size()], items.size());
+      for (size_t i = 0; i < centers.size(); i++) {
+        auto expected = parlay::filter(remaining, [&](const pointT& p) {
+          return pointDistanceSqr(centers[i], p) <= r * r;
+        });
+        auto res = tree.radiusQuery(centers[i], r);
+        auto batch_res = parlay::to_sequence(items.cut(offsets[i], offsets[i + 1]));
+        ASSERT_EQ(res.size(), expected.size());
+        ASSERT_EQ(batch_res.size(), expected.size());
+        parlay::sort_inplace(expected, compare);
+        parlay::sort_inplace(res, compare);
+        parlay::sort_inplace(batch_res, compare);
+        for (size_t j = 0; j < expected.size(); j++) {
+          ASSERT_EQ(expected[j], res[j]);
+          ASSERT_EQ(expected[j], batch_res[j]);
+        }
+      }
+    }
+  }
+}
+
 TYPED_TEST_P(QueryTest, BasicKnn) {
   // construct tree
   auto tree = this->CONSTRUCT_RESOURCES_1000();
@@ -97,6 +241,57 @@ TYPED_TEST_P(QueryTest, BasicKnn) {
   }
 }
 
+TYPED_TEST_P(QueryTest, ApproxKnn) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+
+  constexpr int k = 4;
+  auto check = knnBuf::bruteforceKnn(points, k);
+
+  // sorted distances of query i's results
+  auto dists = [&](const parlay::sequence<const pointT*>& res, size_t i) {
+    auto ret = parlay::tabulate(k, [&](size_t j) { return points[i].dist(*res[i * k + j]); });
+    std::sort(ret.begin(), ret.end());
+    return ret;
+  };
+
+  // (1 + eps)-approximate: the j-th result is at most (1 + eps) farther than the true j-th
+  for (double eps : {0.0, 0.5, 2.0}) {
+    auto res = tree.template knn<false, false>(points, k, knnBuf::approx{eps, 0});
+    ASSERT_EQ(res.size(), k * points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+      auto res_dists = dists(res, i);
+      auto check_dists = dists(check, i);
+      for (int j = 0; j < k; j++) {
+        ASSERT_LE(res_dists[j], (1 + eps) * check_dists[j] + 1e-9);
+      }
+    }
+  }
+
+  // no knob set: the exact search
+  auto exact = tree.template knn<false, false>(points, k, knnBuf::approx{0, 0});
+  ASSERT_EQ(exact.size(), k * points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    ASSERT_EQ(dists(exact, i), dists(check, i));
+  }
+
+  // leaf cap: still k valid results per query, never better than the exact ones, and worse for
+  // some query, since the 1000 points span many leaves
+  auto res = tree.template knn<false, false>(points, k, knnBuf::approx{0, 1});
+  ASSERT_EQ(res.size(), k * points.size());
+  size_t num_worse = 0;
+  for (size_t i = 0; i < points.size(); i++) {
+    auto res_dists = dists(res, i);
+    auto check_dists = dists(check, i);
+    for (int j = 0; j < k; j++) {
+      ASSERT_NE(res[i * k + j], nullptr);
+      ASSERT_GE(res_dists[j], check_dists[j] - 1e-9);
+    }
+    num_worse += (res_dists != check_dists);
+  }
+  ASSERT_GT(num_worse, 0);
+}
+
 TYPED_TEST_P(QueryTest, DualKnn) {
   constexpr int k = 4;
   // construct tree
@@ -136,6 +331,14 @@ TYPED_TEST_P(QueryTest, DualKnn) {
   }
 }
 
-REGISTER_TYPED_TEST_SUITE_P(QueryTest, BasicRangeQuery, BasicKnn, DualKnn);
+REGISTER_TYPED_TEST_SUITE_P(QueryTest,
+                            BasicRangeQuery,
+                            RangeQueryAfterErase,
+                            BatchRangeQuery,
+                            RangeCount,
+                            RadiusQuery,
+                            BasicKnn,
+                            ApproxKnn,
+                            DualKnn);
 
 #endif  // TEST_QUERYTEST_H
@@ -1,8 +1,13 @@
 #include <set>
 #include <gtest/gtest.h>
 #include "common/geometryIO.h"
+#include "kdtree/shared/bitmap.h"
 #include "kdtree/shared/box.h"
 #include "kdtree/shared/bloom.h"
+#include "kdtree/shared/leafscan.h"
+#include "kdtree/shared/morton.h"
+#include "kdtree/shared/knnbuffer.h"
+#include "kdtree/shared/utils.h"
 #include "BasicStructure.h"
 
 class SharedTests : public ::testing::Test {};
@@ -11,6 +16,175 @@ TEST_F(SharedTests, BoundingBoxDistance) {
   auto ret1 =
       BoundingBoxDistance(point<2>({0, 0}), point<2>({1, 1}), point<2>({4, 5}), point<2>({6, 6}));
   ASSERT_EQ(ret1, 5);
+  auto ret2 = BoundingBoxDistanceSqr(point<2>({0, 0}), point<2>({1, 1}), point<2>({4, 5}),
+                                     point<2>({6, 6}));
+  ASSERT_EQ(ret2, 25);
+  ASSERT_EQ(pointDistanceSqr(point<2>({1, 1}), point<2>({4, 5})), 25);
+}
+
+TEST_F(SharedTests, LeafScan) {
+  parlay::sequence<point<2>> points;
+  for (int i = 0; i < 37; i++) {
+    points.push_back(point<2>({(double)(i % 7), (double)(i / 7)}));
+  }
+#ifdef LEAF_SOA
+  parlay::sequence<double> soa(2 * points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    soa[i] = points[i].coordinate(0);
+    soa[points.size() + i] = points[i].coordinate(1);
+  }
+  LeafScan<2, point<2>> scan{points.begin(), soa.begin(), points.size()};
+#else
+  LeafScan<2, point<2>> scan{points.begin()};
+#endif
+
+  auto q = point<2>({2.5, 1});
+  auto qMin = point<2>({1, 1});
+  auto qMax = point<2>({4, 3});
+  for (size_t start : {0, 3}) {
+    auto count = points.size() - start;
+    double dists[LEAF_SCAN_CHUNK];
+    scan.distSqr(q, start, count, dists);
+    auto in_box = scan.inBox(qMin, qMax, start, count);
+    auto equal = scan.equal(points[start + 9], start, count);
+    for (size_t j = 0; j < count; j++) {
+      const auto& pt = points[start + j];
+      ASSERT_EQ(dists[j], pointDistanceSqr(q, pt));
+      ASSERT_EQ((bool)((in_box >> j) & 1), itemInBox(qMin, qMax, &pt));
+      ASSERT_EQ((bool)((equal >> j) & 1), j == 9);
+    }
+  }
+}
+
+template <int mode>
+static void checkKnnBuffer() {
+  constexpr int k = 5;
+  parlay::sequence<knnBuf::elem<int>> out(2 * k);
+  knnBuf::buffer<int, mode> buf(k, out.cut(0, 2 * k));
+  const int costs[] = {9, 3, 7, 1, 8, 6, 2, 10, 4, 5, 0, 11};
+  for (int c : costs) {
+    buf.insert(knnBuf::elem<int>(c, c));
+  }
+  ASSERT_TRUE(buf.hasK());
+  ASSERT_EQ(buf.keepK().cost, 4);
+
+  // the first k slots hold the k nearest
+  std::set<int> kept;
+  for (int i = 0; i < k; i++) {
+    kept.insert(buf[i].entry);
+  }
+  ASSERT_EQ(kept, std::set<int>({0, 1, 2, 3, 4}));
+
+  // reuse the slice as a preloaded buffer
+  knnBuf::buffer<int, mode> buf2(k, out.cut(0, 2 * k));
+  buf2.preload();
+  ASSERT_EQ(buf2.keepK().cost, 4);
+  buf2.insert(knnBuf::elem<int>(-1, -1));
+  ASSERT_EQ(buf2.keepK().cost, 3);
+}
+
+TEST_F(SharedTests, KnnBuffer) {
+  checkKnnBuffer<KNNBUF_NTH_ELEMENT>();
+  checkKnnBuffer<KNNBUF_HEAP>();
+  checkKnnBuffer<KNNBUF_SORTED>();
+}
+
+TEST_F(SharedTests, MedianPartition) {
+  // large enough to take the parallel select path; the second case has many duplicates
+  for (int mod : {1000000, 7}) {
+    auto points = parlay::tabulate(50001, [&](size_t i) {
+      return point<2>({(double)(parlay::hash64(i) % mod), (double)i});
+    });
+    auto sorted = parlay::to_sequence(points);
+    std::sort(sorted.begin(), sorted.end(), [](const point<2>& l, const point<2>& r) {
+      return l.coordinate(0) < r.coordinate(0);
+    });
+
+    auto items = points.cut(0, points.size());
+    auto median = parallelMedianPartition<point<2>>(items, 0);
+    auto k = points.size() / 2;
+#ifdef USE_MEDIAN_SORT  // the sort splits halfway between the middle two
+    ASSERT_EQ(median, (sorted[k - 1].coordinate(0) + sorted[k].coordinate(0)) / 2.0);
+#else
+    ASSERT_EQ(median, sorted[k].coordinate(0));
+#endif
+    for (size_t i = 0; i < k; i++)
+      ASSERT_LE(points[i].coordinate(0), median);
+    for (size_t i = k + 1; i < points.size(); i++)
+      ASSERT_GE(points[i].coordinate(0), median);
+  }
+}
+
+TEST_F(SharedTests, MaxSpreadDimension) {
+  // spread 10 in x, 1000 in y, 100 in z
+  auto points = parlay::tabulate(5000, [&](size_t i) {
+    return point<3>({(double)(i % 11), (double)(i % 1001), (double)(i % 101)});
+  });
+  auto items = points.cut(0, points.size());
+  ASSERT_EQ((maxSpreadDimension<3, point<3>>(items, 0, false)), 1);
+  ASSERT_EQ((maxSpreadDimension<3, point<3>>(items, 0, true)), 1);
+  ASSERT_EQ((maxSpreadDimension<3, point<3>>(items.cut(0, 50), 0, false)), 1);
+  ASSERT_EQ((maxSpreadDimension<3, point<3>>(items.cut(0, 10), 2, false)), 2);  // tie
+}
+
+TEST_F(SharedTests, MortonOrder) {
+  auto pMin = point<2>({0, 0});
+  auto pMax = point<2>({4, 4});
+  auto key = [&](double x, double y) { return mortonKey<2>(point<2>({x, y}), pMin, pMax); };
+  ASSERT_EQ(key(0, 0), 0);
+  // x's bit is the more significant of each pair
+  ASSERT_LT(key(0, 1), key(1, 0));
+  ASSERT_LT(key(1, 1), key(0, 2));
+  ASSERT_EQ(key(-1, 9), key(0, 4));  // clamped
+
+  // the 4x4 grid in Z order
+  parlay::sequence<point<2>> queries;
+  for (int x = 3; x >= 0; x--)
+    for (int y = 3; y >= 0; y--)
+      queries.push_back(point<2>({x + 0.5, y + 0.5}));
+  auto order = mortonOrder<2>(queries, pMin, pMax, true);
+  ASSERT_EQ(order.size(), queries.size());
+  int expected[16][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3},
+                         {2, 0}, {2, 1}, {3, 0}, {3, 1}, {2, 2}, {2, 3}, {3, 2}, {3, 3}};
+  for (size_t j = 0; j < order.size(); j++) {
+    ASSERT_EQ(queries[order[j]].coordinate(0), expected[j][0] + 0.5);
+    ASSERT_EQ(queries[order[j]].coordinate(1), expected[j][1] + 0.5);
+  }
+}
+
+TEST_F(SharedTests, LiveBitmap) {
+  const size_t n = 1000;
+  LiveBitmap live(n);
+  auto items = parlay::tabulate(n, [](size_t i) { return (int)i; });
+  for (size_t i = 0; i < n; i++)
+    ASSERT_TRUE(live[i]);
+
+  // erase the multiples of 3 and the whole second word
+  for (size_t i = 0; i < n; i++) {
+    if (i % 3 == 0 || (i >= 64 && i < 128)) {
+      ASSERT_TRUE(live.reset(i));
+    }
+  }
+  ASSERT_FALSE(live.reset(0));
+  auto is_live = [](size_t i) { return i % 3 != 0 && !(i >= 64 && i < 128); };
+
+  // unaligned masks, counts and packs
+  ASSERT_EQ(live.bits(1, 5), 0b11011u);
+  ASSERT_EQ(live.bits(60, 10), 0b0000000110u);
+  for (bool parallel : {false, true}) {
+    for (auto [s, e] : {std::pair<size_t, size_t>{0, n}, {5, 5}, {7, 200}, {130, 999}}) {
+      auto expected = parlay::filter(items.cut(s, e), [&](int i) { return is_live(i); });
+      ASSERT_EQ(live.count(s, e, parallel), expected.size());
+      parlay::sequence<int> out(e - s);
+      ASSERT_EQ(live.packInto(items.begin(), s, e, out.begin(), parallel), expected.size());
+      for (size_t j = 0; j < expected.size(); j++)
+        ASSERT_EQ(out[j], expected[j]);
+    }
+  }
+
+  // setting the used prefix brings back every bit
+  live.setPrefix(n, true);
+  ASSERT_EQ(live.count(0, n, false), n);
 }
 
 TEST_F(SharedTests, BloomFilter) {
@@ -39,4 +213,14 @@ TEST_F(SharedTests, BloomFilter) {
     ASSERT_EQ(filtered_points.count(round(ipt.coordinate(0))), 1)
         << "missing point " << ipt.coordinate(0) << " rounded -> " << round(ipt.coordinate(0));
   }
+
+  // false positives stay near the target rate (1% by default)
+  auto false_positives = filtered.size() - to_insert.size();
+  ASSERT_LT(false_positives, (points.size() - to_insert.size()) * 3 * BLOOM_FP_RATE);
+  ASSERT_LT(bf.memoryBytes(), to_insert.size() * 2);  // bits, not bytes, per point
+
+  // -0.0 equals 0.0, so it must hash the same
+  BloomFilter<2> zeros(1);
+  zeros.build(parlay::sequence<point<2>>(1, point<2>({0.0, 1.0})));
+  ASSERT_TRUE(zeros.might_contain(point<2>({-0.0, 1.0})));
 }